@@ -0,0 +1,165 @@
+#include "Matcher.h"
+#include "SuffixTrie.h"
+#include "WuManber.h"
+#include <stdio.h>
+
+const unsigned int CMatcher::DFA_BUDGET;
+const unsigned int CMatcher::LONG_PATTERN;
+const unsigned int CMatcher::WU_MANBER_PATTERNS;
+const unsigned int CMatcher::WU_MANBER_SHORT;
+
+CMatcher::~CMatcher()
+{
+}
+
+CMatcher* CMatcher::Build(const std::vector<std::string>& rStrings)
+{
+	//The trie of the strings, it has their shape
+	CSuffixTrie* pTrie;
+	pTrie=new CSuffixTrie;
+	pTrie->SetBuildThreads(0);
+	pTrie->AddStrings(rStrings);
+
+	//It searches them, Compile picks its engine (and tells why not Wu-Manber)
+	std::string sReason;
+	if (SelectEngine(pTrie->GetStats().aShape,sReason)!=meWuManber)
+	{
+		pTrie->Compile();
+		return pTrie;
+	}
+
+	//Long patterns, the shift table skips over the data
+	delete pTrie;
+
+	CWuManber* pWuManber;
+	pWuManber=new CWuManber;
+
+	for (size_t iString=0;
+		 iString<rStrings.size();
+		 ++iString)
+		pWuManber->AddString(rStrings[iString],iString+1);
+
+	pWuManber->Compile();
+	pWuManber->m_sReason=sReason;
+
+	//Done
+	return pWuManber;
+}
+
+CMatcher::MatcherEngine CMatcher::SelectEngine(const MatcherShape& rShape,
+											   std::string& rReason)
+{
+	//Nothing to compile
+	if (!rShape.iPatterns)
+	{
+		rReason="no patterns, nothing to compile";
+		return meTrie;
+	}
+
+	//The short patterns
+	size_t iShort;
+	iShort=rShape.iPatterns-rShape.iLongPatterns;
+
+	//Our reason
+	char aReason[256];
+
+	//Mostly long patterns, the window jumps over most of the data while a trie reads every byte
+	if (rShape.iLongPatterns>=WU_MANBER_PATTERNS &&
+		iShort*WU_MANBER_SHORT<=rShape.iPatterns)
+	{
+		snprintf(aReason,
+				 sizeof(aReason),
+				 "%lu of the %lu patterns (%lu to %lu bytes) are %u bytes or longer, a Wu-Manber window skips ahead on them",
+				 (unsigned long)rShape.iLongPatterns,
+				 (unsigned long)rShape.iPatterns,
+				 (unsigned long)rShape.iMinLength,
+				 (unsigned long)rShape.iMaxLength,
+				 LONG_PATTERN);
+		rReason=aReason;
+		return meWuManber;
+	}
+
+	//A trie then, and why not Wu-Manber
+	MatcherEngine eEngine;
+	eEngine=SelectTrieEngine(rShape,rReason);
+
+	if (rShape.iLongPatterns<WU_MANBER_PATTERNS)
+		snprintf(aReason,
+				 sizeof(aReason),
+				 ", %lu patterns are %u bytes or longer, too few for Wu-Manber",
+				 (unsigned long)rShape.iLongPatterns,
+				 LONG_PATTERN);
+	else
+		snprintf(aReason,
+				 sizeof(aReason),
+				 ", %lu patterns are shorter than %u bytes, too many for Wu-Manber",
+				 (unsigned long)iShort,
+				 LONG_PATTERN);
+	rReason+=aReason;
+
+	//Done
+	return eEngine;
+}
+
+CMatcher::MatcherEngine CMatcher::SelectTrieEngine(const MatcherShape& rShape,
+												   std::string& rReason)
+{
+	//What the DFA would take, a row per state with a transition per byte the patterns have
+	//(and one for the rest), then the state data
+	double dDFA;
+	dDFA=(double)rShape.iStates*(rShape.uiAlphabet+1+3)*sizeof(unsigned int);
+
+	//Our reason
+	char aReason[256];
+
+	//It fits, one load per byte is the fastest we have
+	if (dDFA<=DFA_BUDGET)
+	{
+		snprintf(aReason,
+				 sizeof(aReason),
+				 "%lu patterns (%lu to %lu bytes) take %lu states over %u byte values, the DFA needs %.1f MB of the %u MB budget",
+				 (unsigned long)rShape.iPatterns,
+				 (unsigned long)rShape.iMinLength,
+				 (unsigned long)rShape.iMaxLength,
+				 (unsigned long)rShape.iStates,
+				 rShape.uiAlphabet,
+				 dDFA/(1024*1024),
+				 DFA_BUDGET/(1024*1024));
+		rReason=aReason;
+		return meDFA;
+	}
+
+	//Too big, the compact encoding takes about 20 bytes a state
+	snprintf(aReason,
+			 sizeof(aReason),
+			 "%lu patterns (%lu to %lu bytes) take %lu states over %u byte values, the DFA would need %.1f MB (budget %u MB), the compact encoding about %.1f MB",
+			 (unsigned long)rShape.iPatterns,
+			 (unsigned long)rShape.iMinLength,
+			 (unsigned long)rShape.iMaxLength,
+			 (unsigned long)rShape.iStates,
+			 rShape.uiAlphabet,
+			 dDFA/(1024*1024),
+			 DFA_BUDGET/(1024*1024),
+			 rShape.iStates*20.0/(1024*1024));
+	rReason=aReason;
+	return meCompact;
+}
+
+const char* CMatcher::GetEngineName(MatcherEngine eEngine)
+{
+	switch (eEngine)
+	{
+		case meTrie:
+			return "trie";
+		case meDFA:
+			return "dfa";
+		case meCompact:
+			return "compact";
+		case meWuManber:
+			return "wu-manber";
+		case meRegex:
+			return "regex";
+	}
+
+	return "unknown";
+}
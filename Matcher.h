@@ -0,0 +1,198 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <string>
+#include <vector>
+
+//A compiled multi pattern matcher, the searches only see this
+//CSuffixTrie is one, it picks the engine it compiles to by the shape of the rule set
+//CWuManber is another, for rule sets of long patterns
+//Build picks between them by the shape of the rule set
+//CRegexMatcher adds regex rules to the literal ones
+class CMatcher {
+
+public:
+	//A match (no strings attached)
+	typedef struct _Match {
+		int		rule_id;
+		size_t	iFoundPosition;	//First char of the match
+		size_t	iEndPosition;	//Last char of the match
+	} Match;
+
+	//Called for every match, return false to stop the search
+	typedef bool (*MatchCallback)(const Match& rMatch,
+								  void* pContext);
+
+	//The engines a rule set can be compiled to
+	enum MatcherEngine {
+		meTrie,		//The trie itself (nothing compiled)
+		meDFA,		//Dense DFA, one load per byte
+		meCompact,	//Compact sparse encoding, for rule sets the DFA is too big for
+		meWuManber,	//Block shift table (CWuManber), skips ahead on long patterns
+		meRegex		//Literals with lazy regex DFAs (CRegexMatcher), a regex runs where its literal hit
+	};
+
+	//The shape of a rule set, the engine is picked by it
+	typedef struct _MatcherShape {
+		size_t			iPatterns;		//Distinct patterns
+		size_t			iRules;			//Rules they belong to
+		size_t			iMinLength;		//Shortest pattern
+		size_t			iMaxLength;		//Longest pattern
+		size_t			iLongPatterns;	//Patterns of LONG_PATTERN bytes or more
+		size_t			iTotalLength;	//Of all of them
+		unsigned int	uiAlphabet;		//Distinct bytes in them
+		size_t			iStates;		//Trie states they take
+	} MatcherShape;
+
+	//What was compiled
+	typedef struct _MatcherStats {
+		MatcherEngine	eEngine;	//Which engine searches
+		std::string		sReason;	//Why it was picked
+		MatcherShape	aShape;		//Of the rule set
+		size_t			iMemory;	//Used by the matcher (bytes)
+		double			dBuildTime;	//Of the last build (milliseconds)
+	} MatcherStats;
+
+	//The most memory a DFA may take before the compact engine is picked (bytes)
+	static const unsigned int DFA_BUDGET = 64*1024*1024;
+
+	//Patterns this long let the Wu-Manber window jump far, shorter ones go to its trie (bytes)
+	static const unsigned int LONG_PATTERN = 16;
+
+	//Wu-Manber is picked for this many long patterns, if at most one pattern in WU_MANBER_SHORT
+	//is short (its trie reads every byte the window skips)
+	static const unsigned int WU_MANBER_PATTERNS = 16;
+	static const unsigned int WU_MANBER_SHORT = 16;
+
+public:
+	//Add a pattern for a rule, returns the rule id (0 if it was not added)
+	//With iRuleId 0 the matcher gives the next id (ids start at 1)
+	virtual int AddString(const std::string& rString,
+						  int iRuleId=0)=0;
+
+	//Compile the patterns with the engine their shape needs, this is done when all of them were added
+	virtual void Compile()=0;
+
+	//Search raw bytes and call pCallback for every match, no allocations are done
+	virtual void SearchBytes(const unsigned char* pData,
+							 size_t iLength,
+							 MatchCallback pCallback,
+							 void* pContext)const=0;
+
+	//Did anything match? (stops at the first match)
+	virtual bool SearchExists(const unsigned char* pData,
+							  size_t iLength)const=0;
+
+	//How many matches
+	virtual size_t SearchCount(const unsigned char* pData,
+							   size_t iLength)const=0;
+
+	//Set the bit of every rule that matched (bit rule_id of pRules, it has iRuleWords words)
+	virtual void SearchRules(const unsigned char* pData,
+							 size_t iLength,
+							 unsigned long long* pRules,
+							 size_t iRuleWords)const=0;
+
+	//What was compiled and why
+	virtual MatcherStats GetStats()const=0;
+
+	//A copy of the compiled matcher, its memory is allocated (and first touched) by the calling thread
+	virtual CMatcher* Clone()const=0;
+
+	//Build and compile a matcher of the strings with the engine their shape needs (each string
+	//is for the next rule id, an empty one uses up its id), GetStats tells which and why
+	static CMatcher* Build(const std::vector<std::string>& rStrings);
+
+	//Pick the engine for a rule set, rReason gets why
+	static MatcherEngine SelectEngine(const MatcherShape& rShape,
+									  std::string& rReason);
+
+	//Pick the engine a trie of the rule set compiles to (meDFA or meCompact), rReason gets why
+	static MatcherEngine SelectTrieEngine(const MatcherShape& rShape,
+										  std::string& rReason);
+
+	//Name of an engine
+	static const char* GetEngineName(MatcherEngine eEngine);
+
+	//Dtor
+	virtual ~CMatcher();
+protected:
+	//The result policies of the search kernels, Report gets every match and returns false to stop
+	//The kernels are compiled for each one, so the checks a policy doesn't need go away
+
+	//Calls the caller back
+	typedef struct _CallbackPolicy {
+		MatchCallback	pCallback;
+		void*			pContext;
+
+		bool Report(const Match& rMatch)
+		{
+			return pCallback(rMatch,pContext);
+		}
+	} CallbackPolicy;
+
+	//Saves the matches to a caller buffer, stops when it is full
+	typedef struct _BufferPolicy {
+		Match*	pMatches;		//Caller buffer
+		size_t	iMaxMatches;	//Its size
+		size_t	iCount;			//Matches saved so far
+
+		bool Report(const Match& rMatch)
+		{
+			pMatches[iCount++]=rMatch;
+			return iCount<iMaxMatches;
+		}
+	} BufferPolicy;
+
+	//Stops at the first word
+	typedef struct _ExistsPolicy {
+		bool	bFound;
+
+		bool Report(const Match& /*rMatch*/)
+		{
+			bFound=true;
+			return false;
+		}
+	} ExistsPolicy;
+
+	//Keeps the first match
+	typedef struct _FirstPolicy {
+		Match*	pMatch;
+		bool	bFound;
+
+		bool Report(const Match& rMatch)
+		{
+			*pMatch=rMatch;
+			bFound=true;
+			return false;
+		}
+	} FirstPolicy;
+
+	//Counts the matches
+	typedef struct _CountPolicy {
+		size_t	iCount;
+
+		bool Report(const Match& /*rMatch*/)
+		{
+			++iCount;
+			return true;
+		}
+	} CountPolicy;
+
+	//Sets a bit per rule
+	typedef struct _RulesPolicy {
+		unsigned long long*	pRules;
+		size_t				iRuleWords;
+
+		bool Report(const Match& rMatch)
+		{
+			size_t iWord;
+			iWord=(unsigned int)rMatch.rule_id>>6;
+			if (iWord<iRuleWords)
+				pRules[iWord]|=1ULL<<(rMatch.rule_id&63);
+			return true;
+		}
+	} RulesPolicy;
+};
+
+#endif
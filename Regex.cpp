@@ -0,0 +1,1621 @@
+#include "Regex.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+const unsigned int CRegex::FACTOR_MAX;
+const unsigned int CRegex::FACTOR_LENGTH;
+const int CRegex::REPEAT_MAX;
+const unsigned int CRegex::PROGRAM_MAX;
+const unsigned int CRegex::CACHE_SIZE;
+const unsigned int CRegex::REGEX_UNKNOWN;
+const unsigned int CRegex::REGEX_FINAL;
+const unsigned int CRegex::REGEX_DEAD;
+const unsigned int CRegex::STATE_OVERHEAD;
+const unsigned int CRegex::CACHE_ROWS;
+
+//Is the byte in the set?
+static inline bool HasByte(const unsigned long long* pBits,
+						   unsigned char ucByte)
+{
+	return (pBits[ucByte>>6]>>(ucByte&63))&1;
+}
+
+//Add a byte to the set
+static inline void SetByte(unsigned long long* pBits,
+						   unsigned char ucByte)
+{
+	pBits[ucByte>>6]|=1ULL<<(ucByte&63);
+}
+
+//Shortest literal of a factor
+static size_t GetShortest(const CRegex::FactorVector& rFactor)
+{
+	size_t iShortest;
+	iShortest=rFactor.empty()?0:rFactor[0].length();
+
+	for (size_t iCount=1;
+		 iCount<rFactor.size();
+		 ++iCount)
+		iShortest=std::min(iShortest,rFactor[iCount].length());
+
+	//Done
+	return iShortest;
+}
+
+CRegex::CRegex()
+{
+	//No pattern
+	m_iMaxLength=0;
+	m_iCacheSize=CACHE_SIZE;
+	memset(m_aClasses,0,sizeof(m_aClasses));
+	m_aClassBytes.assign(1,0);
+	m_uiClasses=1;
+
+	//No caches
+	InitDFA(m_aForward);
+	InitDFA(m_aReverse);
+}
+
+CRegex::CRegex(const CRegex& rRegex)
+{
+	//The caches are ours
+	InitDFA(m_aForward);
+	InitDFA(m_aReverse);
+
+	//Copy the rest
+	*this=rRegex;
+}
+
+CRegex::~CRegex()
+{
+	DestroyDFA(m_aForward);
+	DestroyDFA(m_aReverse);
+}
+
+CRegex& CRegex::operator=(const CRegex& rRegex)
+{
+	//Sanity check
+	if (this==&rRegex)
+		return *this;
+
+	//The pattern and its tables
+	m_sPattern=rRegex.m_sPattern;
+	m_aSets=rRegex.m_aSets;
+	memcpy(m_aClasses,rRegex.m_aClasses,sizeof(m_aClasses));
+	m_aClassBytes=rRegex.m_aClassBytes;
+	m_uiClasses=rRegex.m_uiClasses;
+	m_aFactors=rRegex.m_aFactors;
+	m_iMaxLength=rRegex.m_iMaxLength;
+	m_iCacheSize=rRegex.m_iCacheSize;
+
+	//The programs, the caches start over
+	for (int iCount=0;
+		 iCount<2;
+		 ++iCount)
+	{
+		LazyDFA& rDFA=iCount?m_aReverse:m_aForward;
+		const LazyDFA& rSource=iCount?rRegex.m_aReverse:rRegex.m_aForward;
+
+		pthread_rwlock_wrlock(&rDFA.aCacheLock);
+		rDFA.aProgram=rSource.aProgram;
+		rDFA.uiStart=rSource.uiStart;
+		rDFA.bAnchored=rSource.bAnchored;
+		ResetDFA(rDFA,CACHE_ROWS);
+		pthread_rwlock_unlock(&rDFA.aCacheLock);
+	}
+
+	//Done
+	return *this;
+}
+
+void CRegex::InitDFA(LazyDFA& rDFA)
+{
+	//No program
+	rDFA.uiStart=0;
+	rDFA.bAnchored=false;
+
+	//No cache
+	rDFA.uiRows=0;
+	rDFA.uiCapacity=0;
+	rDFA.uiMaxRows=0;
+	rDFA.iSetSize=0;
+	rDFA.ulGeneration=0;
+	rDFA.ulFlushes=0;
+	rDFA.uiMark=0;
+
+	//A flush must not wait on a stream of new searches
+	pthread_rwlockattr_t aAttributes;
+	pthread_rwlockattr_init(&aAttributes);
+	pthread_rwlockattr_setkind_np(&aAttributes,PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&rDFA.aCacheLock,&aAttributes);
+	pthread_rwlockattr_destroy(&aAttributes);
+
+	pthread_mutex_init(&rDFA.aBuildLock,NULL);
+}
+
+void CRegex::DestroyDFA(LazyDFA& rDFA)
+{
+	pthread_rwlock_destroy(&rDFA.aCacheLock);
+	pthread_mutex_destroy(&rDFA.aBuildLock);
+}
+
+const std::string& CRegex::GetPattern()const
+{
+	return m_sPattern;
+}
+
+const CRegex::FactorVector& CRegex::GetFactors()const
+{
+	return m_aFactors;
+}
+
+size_t CRegex::GetMaxLength()const
+{
+	return m_iMaxLength;
+}
+
+unsigned int CRegex::AddNode(unsigned char ucType)
+{
+	RegexNode aNode;
+	aNode.ucType=ucType;
+	aNode.uiSet=0;
+	aNode.iMin=0;
+	aNode.iMax=0;
+	m_aNodes.push_back(aNode);
+
+	//Done
+	return m_aNodes.size()-1;
+}
+
+unsigned int CRegex::AddSet(const ByteSet& rSet)
+{
+	//The set and its node
+	m_aSets.push_back(rSet);
+
+	unsigned int uiNode;
+	uiNode=AddNode(rnSet);
+	m_aNodes[uiNode].uiSet=m_aSets.size()-1;
+
+	//Done
+	return uiNode;
+}
+
+bool CRegex::Parse(const std::string& rPattern,
+				   std::string& rError)
+{
+	//Start over
+	m_sPattern=rPattern;
+	m_aNodes.clear();
+	m_aSets.clear();
+	m_aFactors.clear();
+	m_iMaxLength=0;
+	m_aForward.aProgram.clear();
+	m_aReverse.aProgram.clear();
+
+	//Parse it
+	size_t iPos;
+	iPos=0;
+
+	int iRoot;
+	iRoot=ParseAlternate(rPattern,iPos,rError);
+
+	if (iRoot>=0 &&
+		iPos<rPattern.length())
+	{
+		rError="unmatched )";
+		iRoot=-1;
+	}
+
+	if (iRoot<0)
+	{
+		m_aNodes.clear();
+		m_aSets.clear();
+		return false;
+	}
+
+	//The programs, the match state is the first one, the reversed one finds where the matches start
+	for (int iCount=0;
+		 iCount<2;
+		 ++iCount)
+	{
+		LazyDFA& rDFA=iCount?m_aReverse:m_aForward;
+
+		ProgramState aMatch;
+		aMatch.ucType=psMatch;
+		aMatch.uiSet=0;
+		aMatch.uiOut=0;
+		aMatch.uiOut1=0;
+		rDFA.aProgram.push_back(aMatch);
+
+		rDFA.uiStart=EmitNode(rDFA.aProgram,iRoot,0,iCount!=0);
+		rDFA.bAnchored=iCount!=0;
+	}
+
+	if (m_aForward.aProgram.size()>PROGRAM_MAX)
+	{
+		rError="the repeats make it too big";
+		m_aForward.aProgram.clear();
+		m_aReverse.aProgram.clear();
+		m_aNodes.clear();
+		m_aSets.clear();
+		return false;
+	}
+
+	//The literals every match has (an empty one means none)
+	NodeLiterals aLiterals;
+	aLiterals=GetLiterals(iRoot);
+
+	if (GetShortest(aLiterals.aFactor))
+		m_aFactors=aLiterals.aFactor;
+
+	//The longest match
+	m_iMaxLength=GetNodeMaxLength(iRoot);
+	if (m_iMaxLength==(size_t)-1)
+		m_iMaxLength=0;
+
+	//The parse is done
+	m_aNodes.clear();
+
+	//The DFAs
+	BuildClasses();
+
+	for (int iCount=0;
+		 iCount<2;
+		 ++iCount)
+	{
+		LazyDFA& rDFA=iCount?m_aReverse:m_aForward;
+
+		pthread_rwlock_wrlock(&rDFA.aCacheLock);
+		ResetDFA(rDFA,CACHE_ROWS);
+		pthread_rwlock_unlock(&rDFA.aCacheLock);
+	}
+
+	//A pattern that matches the empty string matches everywhere
+	const StateSet& rStart=*m_aForward.aRowStates[0];
+	if (!rStart.empty() &&
+		!rStart[0])
+	{
+		rError="it matches the empty string";
+		m_aForward.aProgram.clear();
+		m_aReverse.aProgram.clear();
+		return false;
+	}
+
+	//Done
+	return true;
+}
+
+int CRegex::ParseAlternate(const std::string& rPattern,
+						   size_t& riPos,
+						   std::string& rError)
+{
+	//The first branch
+	int iFirst;
+	iFirst=ParseConcat(rPattern,riPos,rError);
+
+	if (iFirst<0 ||
+		riPos>=rPattern.length() ||
+		rPattern[riPos]!='|')
+		return iFirst;
+
+	//The others
+	unsigned int uiNode;
+	uiNode=AddNode(rnAlternate);
+	m_aNodes[uiNode].aChildren.push_back(iFirst);
+
+	while (riPos<rPattern.length() &&
+		   rPattern[riPos]=='|')
+	{
+		++riPos;
+
+		int iNext;
+		iNext=ParseConcat(rPattern,riPos,rError);
+		if (iNext<0)
+			return -1;
+
+		m_aNodes[uiNode].aChildren.push_back(iNext);
+	}
+
+	//Done
+	return uiNode;
+}
+
+int CRegex::ParseConcat(const std::string& rPattern,
+						size_t& riPos,
+						std::string& rError)
+{
+	//The pieces up to the end of the branch
+	std::vector<unsigned int> aChildren;
+
+	while (riPos<rPattern.length() &&
+		   rPattern[riPos]!='|' &&
+		   rPattern[riPos]!=')')
+	{
+		int iPiece;
+		iPiece=ParseRepeat(rPattern,riPos,rError);
+		if (iPiece<0)
+			return -1;
+
+		aChildren.push_back(iPiece);
+	}
+
+	//One piece is itself
+	if (aChildren.size()==1)
+		return aChildren[0];
+
+	//None matches the empty string
+	unsigned int uiNode;
+	uiNode=AddNode(aChildren.empty()?rnEmpty:rnConcat);
+	m_aNodes[uiNode].aChildren=aChildren;
+
+	//Done
+	return uiNode;
+}
+
+bool CRegex::ParseBounds(const std::string& rPattern,
+						 size_t& riPos,
+						 int& riMin,
+						 int& riMax)
+{
+	//{n}, {n,} or {n,m}, anything else is not a repeat
+	size_t iPos;
+	iPos=riPos+1;
+
+	int aBounds[2];
+	int iBounds;
+	iBounds=0;
+
+	bool bComma;
+	bComma=false;
+
+	for (;;)
+	{
+		//A number (past the largest repeat is too big anyway)
+		int iValue;
+		iValue=-1;
+
+		while (iPos<rPattern.length() &&
+			   rPattern[iPos]>='0' &&
+			   rPattern[iPos]<='9')
+		{
+			iValue=std::min((iValue<0?0:iValue)*10+(rPattern[iPos]-'0'),REPEAT_MAX+1);
+			++iPos;
+		}
+
+		aBounds[iBounds++]=iValue;
+
+		if (iPos>=rPattern.length())
+			return false;
+
+		if (rPattern[iPos]==',' &&
+			!bComma)
+		{
+			bComma=true;
+			++iPos;
+			continue;
+		}
+
+		if (rPattern[iPos]!='}')
+			return false;
+
+		break;
+	}
+
+	//The lower bound is a must
+	if (aBounds[0]<0)
+		return false;
+
+	riMin=aBounds[0];
+	riMax=bComma?aBounds[1]:aBounds[0];
+	riPos=iPos+1;
+
+	//Done
+	return true;
+}
+
+int CRegex::ParseRepeat(const std::string& rPattern,
+						size_t& riPos,
+						std::string& rError)
+{
+	//What is repeated
+	int iNode;
+	iNode=ParseAtom(rPattern,riPos,rError);
+
+	//Its repeats
+	while (iNode>=0 &&
+		   riPos<rPattern.length())
+	{
+		int iMin;
+		int iMax;
+
+		if (rPattern[riPos]=='*')
+		{
+			iMin=0;
+			iMax=-1;
+			++riPos;
+		}
+		else if (rPattern[riPos]=='+')
+		{
+			iMin=1;
+			iMax=-1;
+			++riPos;
+		}
+		else if (rPattern[riPos]=='?')
+		{
+			iMin=0;
+			iMax=1;
+			++riPos;
+		}
+		else if (rPattern[riPos]!='{' ||
+				 !ParseBounds(rPattern,riPos,iMin,iMax))
+			break;
+
+		if (iMin>REPEAT_MAX ||
+			iMax>REPEAT_MAX ||
+			(iMax>=0 && iMax<iMin))
+		{
+			rError="bad repeat bounds";
+			return -1;
+		}
+
+		//A lazy repeat matches the same bytes
+		if (riPos<rPattern.length() &&
+			rPattern[riPos]=='?')
+			++riPos;
+
+		unsigned int uiRepeat;
+		uiRepeat=AddNode(rnRepeat);
+		m_aNodes[uiRepeat].iMin=iMin;
+		m_aNodes[uiRepeat].iMax=iMax;
+		m_aNodes[uiRepeat].aChildren.push_back(iNode);
+		iNode=uiRepeat;
+	}
+
+	//Done
+	return iNode;
+}
+
+int CRegex::ParseAtom(const std::string& rPattern,
+					  size_t& riPos,
+					  std::string& rError)
+{
+	char cChar;
+	cChar=rPattern[riPos++];
+
+	ByteSet aSet;
+	memset(&aSet,0,sizeof(aSet));
+
+	switch (cChar)
+	{
+		case '(':
+		{
+			//A group, (?: is one too
+			if (riPos+1<rPattern.length() &&
+				rPattern[riPos]=='?' &&
+				rPattern[riPos+1]==':')
+				riPos+=2;
+			else if (riPos<rPattern.length() &&
+					 rPattern[riPos]=='?')
+			{
+				rError="unsupported group";
+				return -1;
+			}
+
+			int iNode;
+			iNode=ParseAlternate(rPattern,riPos,rError);
+			if (iNode<0)
+				return -1;
+
+			if (riPos>=rPattern.length() ||
+				rPattern[riPos]!=')')
+			{
+				rError="missing )";
+				return -1;
+			}
+
+			++riPos;
+			return iNode;
+		}
+		case '[':
+			return ParseClass(rPattern,riPos,rError);
+		case '.':
+			memset(&aSet,0xff,sizeof(aSet));
+			return AddSet(aSet);
+		case '\\':
+			if (!ParseEscape(rPattern,riPos,aSet,rError))
+				return -1;
+			return AddSet(aSet);
+		case '*':
+		case '+':
+		case '?':
+			rError="nothing to repeat";
+			return -1;
+		case '^':
+		case '$':
+			rError="anchors are not supported";
+			return -1;
+		default:
+			SetByte(aSet.aBits,cChar);
+			return AddSet(aSet);
+	}
+}
+
+bool CRegex::ParseEscape(const std::string& rPattern,
+						 size_t& riPos,
+						 ByteSet& rSet,
+						 std::string& rError)
+{
+	if (riPos>=rPattern.length())
+	{
+		rError="trailing \\";
+		return false;
+	}
+
+	char cChar;
+	cChar=rPattern[riPos++];
+
+	//The sets
+	char cSet;
+	cSet=tolower(cChar);
+
+	if (cSet=='d' || cSet=='w' || cSet=='s')
+	{
+		ByteSet aSet;
+		memset(&aSet,0,sizeof(aSet));
+
+		for (int iByte=0;
+			 iByte<256;
+			 ++iByte)
+			if ((cSet=='d' && iByte>='0' && iByte<='9') ||
+				(cSet=='w' && (isalnum(iByte) || iByte=='_')) ||
+				(cSet=='s' && (iByte==' ' || (iByte>='\t' && iByte<='\r'))))
+				SetByte(aSet.aBits,iByte);
+
+		//The capital is the rest
+		for (int iWord=0;
+			 iWord<4;
+			 ++iWord)
+			rSet.aBits[iWord]|=cChar==cSet?aSet.aBits[iWord]:~aSet.aBits[iWord];
+
+		return true;
+	}
+
+	//A byte
+	unsigned char ucByte;
+
+	switch (cChar)
+	{
+		case 'n':
+			ucByte='\n';
+			break;
+		case 'r':
+			ucByte='\r';
+			break;
+		case 't':
+			ucByte='\t';
+			break;
+		case 'f':
+			ucByte='\f';
+			break;
+		case 'v':
+			ucByte='\v';
+			break;
+		case 'x':
+		{
+			//Two hex digits
+			if (riPos+2>rPattern.length() ||
+				!isxdigit(rPattern[riPos]) ||
+				!isxdigit(rPattern[riPos+1]))
+			{
+				rError="bad \\x";
+				return false;
+			}
+
+			ucByte=(unsigned char)strtol(rPattern.substr(riPos,2).c_str(),NULL,16);
+			riPos+=2;
+			break;
+		}
+		default:
+			//Letters and digits may mean something we don't do (\b, back references)
+			if (isalnum((unsigned char)cChar))
+			{
+				rError=std::string("unsupported escape \\")+cChar;
+				return false;
+			}
+
+			ucByte=cChar;
+	}
+
+	SetByte(rSet.aBits,ucByte);
+
+	//Done
+	return true;
+}
+
+int CRegex::ParseClass(const std::string& rPattern,
+					   size_t& riPos,
+					   std::string& rError)
+{
+	ByteSet aSet;
+	memset(&aSet,0,sizeof(aSet));
+
+	//Negated?
+	bool bNegate;
+	bNegate=riPos<rPattern.length() &&
+			rPattern[riPos]=='^';
+	if (bNegate)
+		++riPos;
+
+	//The items, a ] first is a byte
+	bool bFirst;
+	bFirst=true;
+
+	for (;;)
+	{
+		if (riPos>=rPattern.length())
+		{
+			rError="missing ]";
+			return -1;
+		}
+
+		if (rPattern[riPos]==']' &&
+			!bFirst)
+		{
+			++riPos;
+			break;
+		}
+
+		bFirst=false;
+
+		//A byte or an escape
+		ByteSet aItem;
+		memset(&aItem,0,sizeof(aItem));
+
+		int iLow;
+		if (rPattern[riPos]=='\\')
+		{
+			++riPos;
+			if (!ParseEscape(rPattern,riPos,aItem,rError))
+				return -1;
+
+			//Only a single byte can start a range
+			iLow=-1;
+			for (int iByte=0;
+				 iByte<256;
+				 ++iByte)
+				if (HasByte(aItem.aBits,iByte))
+				{
+					if (iLow>=0)
+					{
+						iLow=-1;
+						break;
+					}
+					iLow=iByte;
+				}
+		}
+		else
+		{
+			iLow=(unsigned char)rPattern[riPos++];
+			SetByte(aItem.aBits,iLow);
+		}
+
+		//A range?
+		if (iLow>=0 &&
+			riPos+1<rPattern.length() &&
+			rPattern[riPos]=='-' &&
+			rPattern[riPos+1]!=']')
+		{
+			++riPos;
+
+			int iHigh;
+			if (rPattern[riPos]=='\\')
+			{
+				++riPos;
+
+				ByteSet aHigh;
+				memset(&aHigh,0,sizeof(aHigh));
+				if (!ParseEscape(rPattern,riPos,aHigh,rError))
+					return -1;
+
+				iHigh=-1;
+				for (int iByte=0;
+					 iByte<256;
+					 ++iByte)
+					if (HasByte(aHigh.aBits,iByte))
+						iHigh=iHigh<0?iByte:256;
+			}
+			else
+				iHigh=(unsigned char)rPattern[riPos++];
+
+			if (iHigh<iLow ||
+				iHigh>255)
+			{
+				rError="bad range";
+				return -1;
+			}
+
+			for (int iByte=iLow;
+				 iByte<=iHigh;
+				 ++iByte)
+				SetByte(aItem.aBits,iByte);
+		}
+
+		for (int iWord=0;
+			 iWord<4;
+			 ++iWord)
+			aSet.aBits[iWord]|=aItem.aBits[iWord];
+	}
+
+	if (bNegate)
+		for (int iWord=0;
+			 iWord<4;
+			 ++iWord)
+			aSet.aBits[iWord]=~aSet.aBits[iWord];
+
+	//Done
+	return AddSet(aSet);
+}
+
+bool CRegex::CrossLiterals(const FactorVector& rA,
+						   const FactorVector& rB,
+						   LiteralCut eCut,
+						   FactorVector& rResult)
+{
+	//Too many?
+	if (rA.size()*rB.size()>FACTOR_MAX)
+		return false;
+
+	FactorVector aResult;
+	for (size_t iA=0;
+		 iA<rA.size();
+		 ++iA)
+		for (size_t iB=0;
+			 iB<rB.size();
+			 ++iB)
+		{
+			std::string sLiteral;
+			sLiteral=rA[iA]+rB[iB];
+
+			//Too long, a part of it is still there (not for an exact one)
+			if (sLiteral.length()>FACTOR_LENGTH)
+			{
+				if (eCut==lcNone)
+					return false;
+				else if (eCut==lcHead)
+					sLiteral.resize(FACTOR_LENGTH);
+				else
+					sLiteral.erase(0,sLiteral.length()-FACTOR_LENGTH);
+			}
+
+			aResult.push_back(sLiteral);
+		}
+
+	std::sort(aResult.begin(),aResult.end());
+	aResult.erase(std::unique(aResult.begin(),aResult.end()),aResult.end());
+	rResult.swap(aResult);
+
+	//Done
+	return true;
+}
+
+bool CRegex::JoinLiterals(const FactorVector& rA,
+						  const FactorVector& rB,
+						  FactorVector& rResult)
+{
+	FactorVector aResult(rA);
+	aResult.insert(aResult.end(),rB.begin(),rB.end());
+	std::sort(aResult.begin(),aResult.end());
+	aResult.erase(std::unique(aResult.begin(),aResult.end()),aResult.end());
+
+	//Too many?
+	if (aResult.size()>FACTOR_MAX)
+		return false;
+
+	rResult.swap(aResult);
+
+	//Done
+	return true;
+}
+
+bool CRegex::BetterFactor(const FactorVector& rA,
+						  const FactorVector& rB)
+{
+	//The longer the shortest literal the fewer payloads it hits
+	size_t iA;
+	iA=GetShortest(rA);
+
+	size_t iB;
+	iB=GetShortest(rB);
+
+	if (iA!=iB)
+		return iA>iB;
+	else
+		return rA.size()<rB.size();
+}
+
+CRegex::NodeLiterals CRegex::GetLiterals(unsigned int uiNode)const
+{
+	//Nothing known is the empty literal
+	const FactorVector aAny(1,std::string());
+
+	NodeLiterals aEmpty;
+	aEmpty.bExact=true;
+	aEmpty.aExact=aAny;
+	aEmpty.aPrefix=aAny;
+	aEmpty.aSuffix=aAny;
+	aEmpty.aFactor=aAny;
+
+	NodeLiterals aResult;
+	aResult.bExact=false;
+
+	const RegexNode& rNode=m_aNodes[uiNode];
+
+	switch (rNode.ucType)
+	{
+		case rnEmpty:
+			aResult=aEmpty;
+			break;
+		case rnSet:
+		{
+			//A few bytes are each a literal
+			for (int iByte=0;
+				 iByte<256 &&
+				 aResult.aExact.size()<=FACTOR_MAX;
+				 ++iByte)
+				if (HasByte(m_aSets[rNode.uiSet].aBits,iByte))
+					aResult.aExact.push_back(std::string(1,(char)iByte));
+
+			aResult.bExact=aResult.aExact.size()<=FACTOR_MAX;
+			if (!aResult.bExact)
+			{
+				aResult.aExact.clear();
+				aResult.aPrefix=aAny;
+				aResult.aSuffix=aAny;
+				aResult.aFactor=aAny;
+			}
+			break;
+		}
+		case rnConcat:
+		{
+			aResult=aEmpty;
+
+			for (size_t iChild=0;
+				 iChild<rNode.aChildren.size();
+				 ++iChild)
+				aResult=ConcatLiterals(aResult,GetLiterals(rNode.aChildren[iChild]));
+			break;
+		}
+		case rnAlternate:
+		{
+			aResult=GetLiterals(rNode.aChildren[0]);
+
+			for (size_t iChild=1;
+				 iChild<rNode.aChildren.size();
+				 ++iChild)
+				aResult=AlternateLiterals(aResult,GetLiterals(rNode.aChildren[iChild]));
+			break;
+		}
+		case rnRepeat:
+		{
+			//The copies it must have, then the ones it may have
+			NodeLiterals aChild;
+			aChild=GetLiterals(rNode.aChildren[0]);
+
+			NodeLiterals aUnknown;
+			aUnknown.bExact=false;
+			aUnknown.aPrefix=aAny;
+			aUnknown.aSuffix=aAny;
+			aUnknown.aFactor=aAny;
+
+			aResult=aEmpty;
+
+			//Past FACTOR_LENGTH copies the literals don't get any better
+			for (int iCount=0;
+				 iCount<rNode.iMin &&
+				 iCount<(int)FACTOR_LENGTH;
+				 ++iCount)
+				aResult=ConcatLiterals(aResult,aChild);
+
+			if (rNode.iMin>(int)FACTOR_LENGTH ||
+				rNode.iMax<0 ||
+				rNode.iMax-rNode.iMin>(int)FACTOR_LENGTH)
+				aResult=ConcatLiterals(aResult,aUnknown);
+			else
+			{
+				NodeLiterals aOptional;
+				aOptional=AlternateLiterals(aEmpty,aChild);
+
+				for (int iCount=rNode.iMin;
+					 iCount<rNode.iMax;
+					 ++iCount)
+					aResult=ConcatLiterals(aResult,aOptional);
+			}
+			break;
+		}
+	}
+
+	//An exact one starts, ends and has its strings
+	if (aResult.bExact)
+	{
+		aResult.aPrefix=aResult.aExact;
+		aResult.aSuffix=aResult.aExact;
+		aResult.aFactor=aResult.aExact;
+	}
+
+	//Done
+	return aResult;
+}
+
+CRegex::NodeLiterals CRegex::ConcatLiterals(const NodeLiterals& rA,
+											const NodeLiterals& rB)
+{
+	NodeLiterals aResult;
+
+	//Both exact, so is the pair
+	if (rA.bExact &&
+		rB.bExact &&
+		CrossLiterals(rA.aExact,rB.aExact,lcNone,aResult.aExact))
+	{
+		aResult.bExact=true;
+		aResult.aPrefix=aResult.aExact;
+		aResult.aSuffix=aResult.aExact;
+		aResult.aFactor=aResult.aExact;
+		return aResult;
+	}
+
+	aResult.bExact=false;
+	aResult.aExact.clear();
+
+	//Starts with A (and the start of B if A is exact)
+	if (!rA.bExact ||
+		!CrossLiterals(rA.aExact,rB.aPrefix,lcHead,aResult.aPrefix))
+		aResult.aPrefix=rA.aPrefix;
+
+	//Ends with B (and the end of A if B is exact)
+	if (!rB.bExact ||
+		!CrossLiterals(rA.aSuffix,rB.aExact,lcTail,aResult.aSuffix))
+		aResult.aSuffix=rB.aSuffix;
+
+	//Has what they have, and the end of A joined to the start of B
+	aResult.aFactor=BetterFactor(rA.aFactor,rB.aFactor)?rA.aFactor:rB.aFactor;
+
+	FactorVector aJoined;
+	if (CrossLiterals(rA.aSuffix,rB.aPrefix,lcHead,aJoined) &&
+		BetterFactor(aJoined,aResult.aFactor))
+		aResult.aFactor=aJoined;
+
+	if (BetterFactor(aResult.aPrefix,aResult.aFactor))
+		aResult.aFactor=aResult.aPrefix;
+	if (BetterFactor(aResult.aSuffix,aResult.aFactor))
+		aResult.aFactor=aResult.aSuffix;
+
+	//Done
+	return aResult;
+}
+
+CRegex::NodeLiterals CRegex::AlternateLiterals(const NodeLiterals& rA,
+											   const NodeLiterals& rB)
+{
+	NodeLiterals aResult;
+
+	//Both exact, so is either
+	if (rA.bExact &&
+		rB.bExact &&
+		JoinLiterals(rA.aExact,rB.aExact,aResult.aExact))
+	{
+		aResult.bExact=true;
+		aResult.aPrefix=aResult.aExact;
+		aResult.aSuffix=aResult.aExact;
+		aResult.aFactor=aResult.aExact;
+		return aResult;
+	}
+
+	//A match is of one of them, so it has what that one has
+	const FactorVector aAny(1,std::string());
+
+	aResult.bExact=false;
+	aResult.aExact.clear();
+
+	if (!JoinLiterals(rA.aPrefix,rB.aPrefix,aResult.aPrefix))
+		aResult.aPrefix=aAny;
+	if (!JoinLiterals(rA.aSuffix,rB.aSuffix,aResult.aSuffix))
+		aResult.aSuffix=aAny;
+	if (!JoinLiterals(rA.aFactor,rB.aFactor,aResult.aFactor))
+		aResult.aFactor=aAny;
+
+	if (BetterFactor(aResult.aPrefix,aResult.aFactor))
+		aResult.aFactor=aResult.aPrefix;
+	if (BetterFactor(aResult.aSuffix,aResult.aFactor))
+		aResult.aFactor=aResult.aSuffix;
+
+	//Done
+	return aResult;
+}
+
+size_t CRegex::GetNodeMaxLength(unsigned int uiNode)const
+{
+	//No bound
+	const size_t iUnbounded=(size_t)-1;
+
+	const RegexNode& rNode=m_aNodes[uiNode];
+
+	switch (rNode.ucType)
+	{
+		case rnSet:
+			return 1;
+		case rnConcat:
+		case rnAlternate:
+		{
+			size_t iLength;
+			iLength=0;
+
+			for (size_t iChild=0;
+				 iChild<rNode.aChildren.size();
+				 ++iChild)
+			{
+				size_t iChildLength;
+				iChildLength=GetNodeMaxLength(rNode.aChildren[iChild]);
+
+				if (iChildLength==iUnbounded)
+					return iUnbounded;
+				else if (rNode.ucType==rnConcat)
+					iLength+=iChildLength;
+				else
+					iLength=std::max(iLength,iChildLength);
+			}
+
+			return iLength;
+		}
+		case rnRepeat:
+		{
+			size_t iChildLength;
+			iChildLength=GetNodeMaxLength(rNode.aChildren[0]);
+
+			if (!iChildLength || !rNode.iMax)
+				return 0;
+			else if (iChildLength==iUnbounded || rNode.iMax<0)
+				return iUnbounded;
+			else
+				return iChildLength*rNode.iMax;
+		}
+		default:
+			return 0;
+	}
+}
+
+unsigned int CRegex::EmitNode(std::vector<ProgramState>& rProgram,
+							  unsigned int uiNode,
+							  unsigned int uiNext,
+							  bool bReverse)const
+{
+	//Too big already, Parse gives up
+	if (rProgram.size()>PROGRAM_MAX)
+		return uiNext;
+
+	const RegexNode& rNode=m_aNodes[uiNode];
+
+	ProgramState aState;
+	aState.ucType=psSplit;
+	aState.uiSet=0;
+	aState.uiOut=uiNext;
+	aState.uiOut1=uiNext;
+
+	switch (rNode.ucType)
+	{
+		case rnSet:
+		{
+			aState.ucType=psByte;
+			aState.uiSet=rNode.uiSet;
+			rProgram.push_back(aState);
+			return rProgram.size()-1;
+		}
+		case rnConcat:
+		{
+			//Emitted from the last one, reversed from the first one
+			unsigned int uiStart;
+			uiStart=uiNext;
+
+			for (size_t iCount=0;
+				 iCount<rNode.aChildren.size();
+				 ++iCount)
+				uiStart=EmitNode(rProgram,
+								 rNode.aChildren[bReverse?iCount:rNode.aChildren.size()-1-iCount],
+								 uiStart,
+								 bReverse);
+
+			return uiStart;
+		}
+		case rnAlternate:
+		{
+			//A split per branch
+			unsigned int uiStart;
+			uiStart=EmitNode(rProgram,rNode.aChildren.back(),uiNext,bReverse);
+
+			for (size_t iCount=rNode.aChildren.size()-1;
+				 iCount>0;
+				 --iCount)
+			{
+				aState.uiOut=EmitNode(rProgram,rNode.aChildren[iCount-1],uiNext,bReverse);
+				aState.uiOut1=uiStart;
+				rProgram.push_back(aState);
+				uiStart=rProgram.size()-1;
+			}
+
+			return uiStart;
+		}
+		case rnRepeat:
+		{
+			unsigned int uiStart;
+			uiStart=uiNext;
+
+			if (rNode.iMax<0)
+			{
+				//A loop, the split runs the child again or goes on
+				rProgram.push_back(aState);
+				uiStart=rProgram.size()-1;
+
+				unsigned int uiBody;
+				uiBody=EmitNode(rProgram,rNode.aChildren[0],uiStart,bReverse);
+				rProgram[uiStart].uiOut=uiBody;
+			}
+			else
+				//The copies it may have, each may go on
+				for (int iCount=rNode.iMin;
+					 iCount<rNode.iMax;
+					 ++iCount)
+				{
+					aState.uiOut=EmitNode(rProgram,rNode.aChildren[0],uiStart,bReverse);
+					aState.uiOut1=uiNext;
+					rProgram.push_back(aState);
+					uiStart=rProgram.size()-1;
+				}
+
+			//The copies it must have
+			for (int iCount=0;
+				 iCount<rNode.iMin;
+				 ++iCount)
+				uiStart=EmitNode(rProgram,rNode.aChildren[0],uiStart,bReverse);
+
+			return uiStart;
+		}
+		default:
+			return uiNext;
+	}
+}
+
+void CRegex::BuildClasses()
+{
+	//All the bytes start in one class, each set splits the classes it cuts
+	memset(m_aClasses,0,sizeof(m_aClasses));
+	m_uiClasses=1;
+
+	std::vector<int> aSplit;
+
+	for (size_t iSet=0;
+		 iSet<m_aSets.size();
+		 ++iSet)
+	{
+		//A new class for every old class and side of the set
+		aSplit.assign(m_uiClasses*2,-1);
+
+		unsigned int uiClasses;
+		uiClasses=0;
+
+		for (int iByte=0;
+			 iByte<256;
+			 ++iByte)
+		{
+			int& rClass=aSplit[m_aClasses[iByte]*2+HasByte(m_aSets[iSet].aBits,iByte)];
+			if (rClass<0)
+				rClass=uiClasses++;
+
+			m_aClasses[iByte]=rClass;
+		}
+
+		m_uiClasses=uiClasses;
+	}
+
+	//A byte of every class
+	m_aClassBytes.assign(m_uiClasses,0);
+	for (int iByte=255;
+		 iByte>=0;
+		 --iByte)
+		m_aClassBytes[m_aClasses[iByte]]=iByte;
+}
+
+void CRegex::ResetDFA(LazyDFA& rDFA,
+					  unsigned int uiRows)const
+{
+	//How many rows the cache size holds (the start and a few more at least)
+	rDFA.uiMaxRows=std::max<size_t>(4,m_iCacheSize/(m_uiClasses*sizeof(unsigned int)+STATE_OVERHEAD));
+	rDFA.uiCapacity=std::min(uiRows,rDFA.uiMaxRows);
+
+	//Empty it
+	rDFA.aTransitions.assign(rDFA.uiCapacity*m_uiClasses,REGEX_UNKNOWN);
+	rDFA.aStates.clear();
+	rDFA.aRowStates.clear();
+	rDFA.uiRows=0;
+	rDFA.iSetSize=0;
+	rDFA.aMarks.assign(rDFA.aProgram.size(),0);
+	rDFA.uiMark=0;
+	++rDFA.ulGeneration;
+
+	//No program, no states
+	if (rDFA.aProgram.empty())
+		return;
+
+	//The start state is the first row
+	StateSet aStart;
+	++rDFA.uiMark;
+	AddClosure(rDFA,rDFA.uiStart,aStart);
+	std::sort(aStart.begin(),aStart.end());
+	FindRow(rDFA,aStart);
+}
+
+void CRegex::AddClosure(LazyDFA& rDFA,
+						unsigned int uiState,
+						StateSet& rSet)const
+{
+	//Follow the splits, keep the rest (once, by the mark of this build)
+	rDFA.aStack.push_back(uiState);
+
+	while (!rDFA.aStack.empty())
+	{
+		unsigned int uiCurrent;
+		uiCurrent=rDFA.aStack.back();
+		rDFA.aStack.pop_back();
+
+		if (rDFA.aMarks[uiCurrent]==rDFA.uiMark)
+			continue;
+		rDFA.aMarks[uiCurrent]=rDFA.uiMark;
+
+		const ProgramState& rState=rDFA.aProgram[uiCurrent];
+		if (rState.ucType==psSplit)
+		{
+			rDFA.aStack.push_back(rState.uiOut1);
+			rDFA.aStack.push_back(rState.uiOut);
+		}
+		else
+			rSet.push_back(uiCurrent);
+	}
+}
+
+unsigned int CRegex::FindRow(LazyDFA& rDFA,
+							 const StateSet& rSet)const
+{
+	//No state, no match can go on
+	if (rSet.empty())
+		return REGEX_DEAD;
+
+	//The match state is the first one
+	unsigned int uiFinal;
+	uiFinal=rSet[0]?0:REGEX_FINAL;
+
+	//Do we have it?
+	StateMap::const_iterator aIterator;
+	aIterator=rDFA.aStates.find(rSet);
+	if (aIterator!=rDFA.aStates.end())
+		return aIterator->second|uiFinal;
+
+	//Full?
+	if (rDFA.uiRows==rDFA.uiCapacity)
+		return REGEX_UNKNOWN;
+
+	//Add it, its row is all unknown already
+	unsigned int uiRow;
+	uiRow=rDFA.uiRows*m_uiClasses;
+
+	aIterator=rDFA.aStates.insert(StateMap::value_type(rSet,uiRow)).first;
+	rDFA.aRowStates.push_back(&aIterator->first);
+	++rDFA.uiRows;
+	rDFA.iSetSize+=rSet.size()*sizeof(unsigned int)+STATE_OVERHEAD;
+
+	//Done
+	return uiRow|uiFinal;
+}
+
+unsigned int CRegex::AddTransition(LazyDFA& rDFA,
+								   unsigned int& ruiRow,
+								   unsigned int uiClass)const
+{
+	for (;;)
+	{
+		pthread_mutex_lock(&rDFA.aBuildLock);
+
+		//Another search may have made it
+		unsigned int uiNext;
+		uiNext=__atomic_load_n(&rDFA.aTransitions[ruiRow+uiClass],__ATOMIC_ACQUIRE);
+
+		if (uiNext!=REGEX_UNKNOWN)
+		{
+			pthread_mutex_unlock(&rDFA.aBuildLock);
+			return uiNext;
+		}
+
+		//Where the bytes of the class go (and a match may start anywhere if we are not anchored)
+		const StateSet& rFrom=*rDFA.aRowStates[ruiRow/m_uiClasses];
+
+		unsigned char ucByte;
+		ucByte=m_aClassBytes[uiClass];
+
+		StateSet aTo;
+		if (++rDFA.uiMark==0)
+		{
+			rDFA.aMarks.assign(rDFA.aProgram.size(),0);
+			rDFA.uiMark=1;
+		}
+
+		for (size_t iState=0;
+			 iState<rFrom.size();
+			 ++iState)
+		{
+			const ProgramState& rState=rDFA.aProgram[rFrom[iState]];
+			if (rState.ucType==psByte &&
+				HasByte(m_aSets[rState.uiSet].aBits,ucByte))
+				AddClosure(rDFA,rState.uiOut,aTo);
+		}
+
+		if (!rDFA.bAnchored)
+			AddClosure(rDFA,rDFA.uiStart,aTo);
+
+		std::sort(aTo.begin(),aTo.end());
+
+		//Its row, the searches see it once the transition is there
+		uiNext=FindRow(rDFA,aTo);
+		if (uiNext!=REGEX_UNKNOWN)
+		{
+			__atomic_store_n(&rDFA.aTransitions[ruiRow+uiClass],uiNext,__ATOMIC_RELEASE);
+			pthread_mutex_unlock(&rDFA.aBuildLock);
+			return uiNext;
+		}
+
+		//The cache is full, keep our state while it grows (or is flushed)
+		StateSet aCurrent(rFrom);
+
+		unsigned long ulGeneration;
+		ulGeneration=rDFA.ulGeneration;
+
+		pthread_mutex_unlock(&rDFA.aBuildLock);
+
+		ruiRow=MakeRoom(rDFA,aCurrent,ulGeneration);
+	}
+}
+
+unsigned int CRegex::MakeRoom(LazyDFA& rDFA,
+							  const StateSet& rSet,
+							  unsigned long ulGeneration)const
+{
+	for (;;)
+	{
+		//Nobody may search it now
+		pthread_rwlock_unlock(&rDFA.aCacheLock);
+		pthread_rwlock_wrlock(&rDFA.aCacheLock);
+
+		//Unless another search did it already
+		if (rDFA.ulGeneration==ulGeneration)
+		{
+			if (rDFA.uiCapacity<rDFA.uiMaxRows)
+			{
+				rDFA.uiCapacity=std::min(rDFA.uiCapacity*2,rDFA.uiMaxRows);
+				rDFA.aTransitions.resize(rDFA.uiCapacity*m_uiClasses,REGEX_UNKNOWN);
+				++rDFA.ulGeneration;
+			}
+			else
+			{
+				ResetDFA(rDFA,rDFA.uiCapacity);
+				++rDFA.ulFlushes;
+			}
+		}
+
+		pthread_rwlock_unlock(&rDFA.aCacheLock);
+		pthread_rwlock_rdlock(&rDFA.aCacheLock);
+
+		//Our state in it
+		pthread_mutex_lock(&rDFA.aBuildLock);
+
+		unsigned int uiRow;
+		uiRow=FindRow(rDFA,rSet);
+		ulGeneration=rDFA.ulGeneration;
+
+		pthread_mutex_unlock(&rDFA.aBuildLock);
+
+		if (uiRow!=REGEX_UNKNOWN)
+			return uiRow&~REGEX_FINAL;
+	}
+}
+
+bool CRegex::Search(const unsigned char* pData,
+					size_t iLength,
+					size_t iFrom,
+					int iRuleId,
+					bool bStart,
+					CMatcher::MatchCallback pCallback,
+					void* pContext)const
+{
+	//Nothing to search
+	if (m_aForward.aProgram.empty() ||
+		iFrom>=iLength)
+		return true;
+
+	LazyDFA& rDFA=m_aForward;
+	pthread_rwlock_rdlock(&rDFA.aCacheLock);
+
+	//The cache, it only moves when we make a transition
+	const unsigned int* pTransitions;
+	pTransitions=&rDFA.aTransitions[0];
+
+	unsigned int uiRow;
+	uiRow=0;
+
+	bool bGoOn;
+	bGoOn=true;
+
+	//Our state while the callback runs
+	StateSet aCurrent;
+
+	for (size_t iPos=iFrom;
+		 iPos<iLength;
+		 ++iPos)
+	{
+		unsigned int uiClass;
+		uiClass=m_aClasses[pData[iPos]];
+
+		unsigned int uiNext;
+		uiNext=__atomic_load_n(pTransitions+uiRow+uiClass,__ATOMIC_ACQUIRE);
+
+		if (uiNext==REGEX_UNKNOWN)
+		{
+			uiNext=AddTransition(rDFA,uiRow,uiClass);
+			pTransitions=&rDFA.aTransitions[0];
+		}
+
+		uiRow=uiNext&~REGEX_FINAL;
+
+		//A match ends here, the callback runs without the cache (it may search, this regex too), so
+		//we keep our state in case the cache changes meanwhile
+		if (uiNext&REGEX_FINAL)
+		{
+			pthread_mutex_lock(&rDFA.aBuildLock);
+			aCurrent=*rDFA.aRowStates[uiRow/m_uiClasses];
+			pthread_mutex_unlock(&rDFA.aBuildLock);
+
+			unsigned long ulGeneration;
+			ulGeneration=rDFA.ulGeneration;
+
+			pthread_rwlock_unlock(&rDFA.aCacheLock);
+
+			CMatcher::Match aMatch;
+			aMatch.rule_id=iRuleId;
+			aMatch.iFoundPosition=bStart?FindStart(pData,iPos,iFrom):iFrom;
+			aMatch.iEndPosition=iPos;
+
+			bGoOn=pCallback(aMatch,pContext);
+
+			pthread_rwlock_rdlock(&rDFA.aCacheLock);
+			if (!bGoOn)
+				break;
+
+			//Grown or flushed, find our state in it (make room for it if there is none)
+			if (rDFA.ulGeneration!=ulGeneration)
+			{
+				pthread_mutex_lock(&rDFA.aBuildLock);
+				uiRow=FindRow(rDFA,aCurrent);
+				ulGeneration=rDFA.ulGeneration;
+				pthread_mutex_unlock(&rDFA.aBuildLock);
+
+				if (uiRow==REGEX_UNKNOWN)
+					uiRow=MakeRoom(rDFA,aCurrent,ulGeneration);
+				uiRow&=~REGEX_FINAL;
+			}
+
+			pTransitions=&rDFA.aTransitions[0];
+		}
+	}
+
+	pthread_rwlock_unlock(&rDFA.aCacheLock);
+
+	//Done
+	return bGoOn;
+}
+
+size_t CRegex::FindStart(const unsigned char* pData,
+						 size_t iEnd,
+						 size_t iFrom)const
+{
+	//Walk back with the reversed pattern, the last match is the longest
+	LazyDFA& rDFA=m_aReverse;
+	pthread_rwlock_rdlock(&rDFA.aCacheLock);
+
+	const unsigned int* pTransitions;
+	pTransitions=&rDFA.aTransitions[0];
+
+	unsigned int uiRow;
+	uiRow=0;
+
+	size_t iStart;
+	iStart=iEnd+1;
+
+	for (size_t iPos=iEnd+1;
+		 iPos>iFrom;
+		 --iPos)
+	{
+		unsigned int uiClass;
+		uiClass=m_aClasses[pData[iPos-1]];
+
+		unsigned int uiNext;
+		uiNext=__atomic_load_n(pTransitions+uiRow+uiClass,__ATOMIC_ACQUIRE);
+
+		if (uiNext==REGEX_UNKNOWN)
+		{
+			uiNext=AddTransition(rDFA,uiRow,uiClass);
+			pTransitions=&rDFA.aTransitions[0];
+		}
+
+		//No match goes on
+		if (uiNext==REGEX_DEAD)
+			break;
+
+		uiRow=uiNext&~REGEX_FINAL;
+		if (uiNext&REGEX_FINAL)
+			iStart=iPos-1;
+	}
+
+	pthread_rwlock_unlock(&rDFA.aCacheLock);
+
+	//Done
+	return iStart;
+}
+
+void CRegex::SetCacheSize(size_t iSize)
+{
+	m_iCacheSize=iSize;
+
+	//Start over with the new size
+	for (int iCount=0;
+		 iCount<2;
+		 ++iCount)
+	{
+		LazyDFA& rDFA=iCount?m_aReverse:m_aForward;
+
+		pthread_rwlock_wrlock(&rDFA.aCacheLock);
+		ResetDFA(rDFA,CACHE_ROWS);
+		pthread_rwlock_unlock(&rDFA.aCacheLock);
+	}
+}
+
+size_t CRegex::GetCacheSize()const
+{
+	return m_iCacheSize;
+}
+
+unsigned long CRegex::GetFlushes()const
+{
+	return m_aForward.ulFlushes+m_aReverse.ulFlushes;
+}
+
+size_t CRegex::GetSize()const
+{
+	//The pattern tables
+	size_t iSize;
+	iSize=m_aSets.size()*sizeof(ByteSet)+
+		  m_aFactors.size()*FACTOR_LENGTH;
+
+	//The programs and the caches
+	for (int iCount=0;
+		 iCount<2;
+		 ++iCount)
+	{
+		LazyDFA& rDFA=iCount?m_aReverse:m_aForward;
+
+		pthread_rwlock_rdlock(&rDFA.aCacheLock);
+		iSize+=rDFA.aProgram.size()*sizeof(ProgramState)+
+			   rDFA.aTransitions.size()*sizeof(unsigned int)+
+			   rDFA.iSetSize;
+		pthread_rwlock_unlock(&rDFA.aCacheLock);
+	}
+
+	//Done
+	return iSize;
+}
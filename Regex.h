@@ -0,0 +1,319 @@
+#ifndef REGEX_H
+#define REGEX_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <pthread.h>
+
+#include "Matcher.h"
+
+//A regular expression over raw bytes, searched with a DFA that is built lazily
+//The syntax: literal bytes, . (any byte), [classes] (ranges, negation, \d \w \s), groups ( (?: too),
+//alternation |, the repeats * + ? {n} {n,} {n,m} (their lazy forms match the same), the escapes
+//\n \r \t \f \v \xHH (any other escaped byte is itself), there are no anchors and no back references
+//The DFA states are made the first time a search needs them and kept in a cache of a bounded size,
+//when it is full it is flushed and the search goes on from where it was
+//A regex is searched by many threads at once, they share the cache
+class CRegex {
+
+public:
+	//Literals, every match has one of them
+	typedef std::vector<std::string> FactorVector;
+
+	//The most literals a factor has
+	static const unsigned int FACTOR_MAX = 16;
+
+	//The longest literal of a factor
+	static const unsigned int FACTOR_LENGTH = 64;
+
+	//The largest bounded repeat
+	static const int REPEAT_MAX = 1000;
+
+	//The most states a program may have (the bounded repeats are copies)
+	static const unsigned int PROGRAM_MAX = 100000;
+
+	//Default size of a DFA cache (bytes)
+	static const unsigned int CACHE_SIZE = 256*1024;
+public:
+	//Parse a pattern and build its programs, returns false if it is bad, or if it matches the
+	//empty string (it would match everywhere), rError tells why
+	bool Parse(const std::string& rPattern,
+			   std::string& rError);
+
+	//The pattern
+	const std::string& GetPattern()const;
+
+	//Literals one of which every match has, empty if the pattern has none (it must always run)
+	const FactorVector& GetFactors()const;
+
+	//The longest match (0 if it has no bound)
+	size_t GetMaxLength()const;
+
+	//Search the bytes from iFrom (the matches don't start before it), pCallback gets every byte
+	//a match ends on, with bStart iFoundPosition is the first byte of the longest match ending
+	//there (else it is iFrom), returns false if the callback stopped it
+	//The search lets go of its cache while the callback runs, so the callback may search any regex
+	//(this one too), the cache may then be grown or flushed under it
+	bool Search(const unsigned char* pData,
+				size_t iLength,
+				size_t iFrom,
+				int iRuleId,
+				bool bStart,
+				CMatcher::MatchCallback pCallback,
+				void* pContext)const;
+
+	//The first byte of the longest match ending on iEnd that starts at iFrom or after it (iEnd+1 if
+	//there is none)
+	size_t FindStart(const unsigned char* pData,
+					 size_t iEnd,
+					 size_t iFrom)const;
+
+	//Size of each of the two DFA caches (in bytes), the caches start over
+	void SetCacheSize(size_t iSize);
+	size_t GetCacheSize()const;
+
+	//How many times the caches were flushed
+	unsigned long GetFlushes()const;
+
+	//Memory used by the programs and the caches (in bytes)
+	size_t GetSize()const;
+
+	//Assignment operator (the caches are not copied)
+	CRegex& operator=(const CRegex& rRegex);
+
+	//Ctor and Dtor
+	CRegex();
+	CRegex(const CRegex& rRegex);
+	virtual ~CRegex();
+private:
+	//A set of bytes
+	typedef struct _ByteSet {
+		unsigned long long	aBits[4];
+	} ByteSet;
+
+	//A node of the parsed pattern
+	enum RegexNodeType {
+		rnEmpty,		//Matches the empty string
+		rnSet,			//A byte of a set
+		rnConcat,		//The children one after the other
+		rnAlternate,	//One of the children
+		rnRepeat		//The child iMin to iMax times
+	};
+
+	typedef struct _RegexNode {
+		unsigned char				ucType;		//RegexNodeType
+		unsigned int				uiSet;		//rnSet, index into m_aSets
+		int							iMin;		//rnRepeat
+		int							iMax;		//rnRepeat, -1 has no bound
+		std::vector<unsigned int>	aChildren;
+	} RegexNode;
+
+	//The literals of a node
+	typedef struct _NodeLiterals {
+		bool			bExact;		//aExact are all the strings it matches
+		FactorVector	aExact;
+		FactorVector	aPrefix;	//Every match starts with one of these
+		FactorVector	aSuffix;	//Ends with one of these
+		FactorVector	aFactor;	//Has one of these
+	} NodeLiterals;
+
+	//How a literal is cut when it is too long
+	enum LiteralCut {
+		lcNone,		//It can't be
+		lcHead,		//Keep its head
+		lcTail		//Keep its tail
+	};
+
+	//A program state
+	enum ProgramStateType {
+		psMatch,	//A match
+		psByte,		//A byte of uiSet, then uiOut
+		psSplit		//uiOut or uiOut1
+	};
+
+	typedef struct _ProgramState {
+		unsigned char	ucType;		//ProgramStateType
+		unsigned int	uiSet;
+		unsigned int	uiOut;
+		unsigned int	uiOut1;
+	} ProgramState;
+
+	//The program states a DFA state is in (sorted, the match state first)
+	typedef std::vector<unsigned int> StateSet;
+	typedef std::map<StateSet,unsigned int> StateMap;
+
+	//A DFA built lazily from a program
+	typedef struct _LazyDFA {
+		//The program
+		std::vector<ProgramState>	aProgram;
+		unsigned int				uiStart;		//Where the program starts
+		bool						bAnchored;		//Matches start where the search does (else anywhere)
+
+		//The cache, a row of m_uiClasses transitions per state, a transition is the row of the
+		//target (with REGEX_FINAL if it is a match), REGEX_UNKNOWN until it is made
+		std::vector<unsigned int>	aTransitions;
+		unsigned int				uiRows;			//Rows in use
+		unsigned int				uiCapacity;		//Rows we have
+		unsigned int				uiMaxRows;		//Rows the cache size holds
+		StateMap					aStates;		//The row of every state
+		std::vector<const StateSet*> aRowStates;	//The state of every row
+		size_t						iSetSize;		//Bytes the states take
+		unsigned long				ulGeneration;	//Goes up on every grow or flush
+		unsigned long				ulFlushes;
+
+		//Searches hold it shared, growing and flushing hold it exclusive
+		pthread_rwlock_t			aCacheLock;
+
+		//Serializes adding states
+		pthread_mutex_t				aBuildLock;
+
+		//Scratch of the state builds
+		std::vector<unsigned int>	aStack;
+		std::vector<unsigned int>	aMarks;
+		unsigned int				uiMark;
+	} LazyDFA;
+
+	//A transition we don't have yet
+	static const unsigned int REGEX_UNKNOWN = 0xffffffff;
+
+	//The target is a match
+	static const unsigned int REGEX_FINAL = 0x80000000;
+
+	//No match can go on (anchored only)
+	static const unsigned int REGEX_DEAD = 0x7fffffff;
+
+	//What a state costs the cache beyond its transitions (map node and such, in bytes)
+	static const unsigned int STATE_OVERHEAD = 64;
+
+	//The first rows of a cache
+	static const unsigned int CACHE_ROWS = 16;
+private:
+	//The parser, each returns the node index (-1 on an error, rError tells why)
+	int ParseAlternate(const std::string& rPattern,
+					   size_t& riPos,
+					   std::string& rError);
+	int ParseConcat(const std::string& rPattern,
+					size_t& riPos,
+					std::string& rError);
+	int ParseRepeat(const std::string& rPattern,
+					size_t& riPos,
+					std::string& rError);
+	int ParseAtom(const std::string& rPattern,
+				  size_t& riPos,
+				  std::string& rError);
+
+	//Parse a [class] (riPos is after the [)
+	int ParseClass(const std::string& rPattern,
+				   size_t& riPos,
+				   std::string& rError);
+
+	//Parse an escape (riPos is after the \) into rSet
+	bool ParseEscape(const std::string& rPattern,
+					 size_t& riPos,
+					 ByteSet& rSet,
+					 std::string& rError);
+
+	//Parse a {n,m} (riPos is at the {), returns false if it is not one
+	bool ParseBounds(const std::string& rPattern,
+					 size_t& riPos,
+					 int& riMin,
+					 int& riMax);
+
+	//Add a node
+	unsigned int AddNode(unsigned char ucType);
+	unsigned int AddSet(const ByteSet& rSet);
+
+	//The literals of a node
+	NodeLiterals GetLiterals(unsigned int uiNode)const;
+
+	//The literals of A then B, and of A or B
+	static NodeLiterals ConcatLiterals(const NodeLiterals& rA,
+									   const NodeLiterals& rB);
+	static NodeLiterals AlternateLiterals(const NodeLiterals& rA,
+										  const NodeLiterals& rB);
+
+	//Every pair of strings of A and B joined, returns false if there are too many
+	static bool CrossLiterals(const FactorVector& rA,
+							  const FactorVector& rB,
+							  LiteralCut eCut,
+							  FactorVector& rResult);
+
+	//The strings of both, returns false if there are too many
+	static bool JoinLiterals(const FactorVector& rA,
+							 const FactorVector& rB,
+							 FactorVector& rResult);
+
+	//How good a factor is (its shortest literal, then the fewer the better)
+	static bool BetterFactor(const FactorVector& rA,
+							 const FactorVector& rB);
+
+	//Longest match of a node (-1 if it has no bound)
+	size_t GetNodeMaxLength(unsigned int uiNode)const;
+
+	//Emit the program of a node, it goes on to uiNext, returns where it starts
+	unsigned int EmitNode(std::vector<ProgramState>& rProgram,
+						  unsigned int uiNode,
+						  unsigned int uiNext,
+						  bool bReverse)const;
+
+	//Split the bytes into the classes no set tells apart
+	void BuildClasses();
+
+	//Set up a DFA cache (the locks too), drop it
+	void InitDFA(LazyDFA& rDFA);
+	void DestroyDFA(LazyDFA& rDFA);
+
+	//Empty the cache, only the start state is left (caller holds the cache exclusive)
+	void ResetDFA(LazyDFA& rDFA,
+				  unsigned int uiRows)const;
+
+	//Add the states uiState leads to (splits followed) to rSet
+	void AddClosure(LazyDFA& rDFA,
+					unsigned int uiState,
+					StateSet& rSet)const;
+
+	//The row of a state (added if we don't have it), REGEX_DEAD for no state, REGEX_UNKNOWN if the cache is full
+	//(the caller holds the build lock)
+	unsigned int FindRow(LazyDFA& rDFA,
+						 const StateSet& rSet)const;
+
+	//Make a transition the cache doesn't have (the caller holds the cache shared)
+	//If the cache is full it is grown or flushed, ruiRow is then the row of the same state in the new one
+	unsigned int AddTransition(LazyDFA& rDFA,
+							   unsigned int& ruiRow,
+							   unsigned int uiClass)const;
+
+	//Grow or flush the full cache (unless another search did since ulGeneration) until rSet has a row
+	//in it, returns the row (the caller holds the cache shared, it is let go in between)
+	unsigned int MakeRoom(LazyDFA& rDFA,
+						  const StateSet& rSet,
+						  unsigned long ulGeneration)const;
+
+	//The pattern
+	std::string m_sPattern;
+
+	//The parsed pattern (only while it is built)
+	std::vector<RegexNode> m_aNodes;
+
+	//The byte sets of the programs
+	std::vector<ByteSet> m_aSets;
+
+	//The class of every byte, and a byte of every class
+	unsigned char m_aClasses[256];
+	std::vector<unsigned char> m_aClassBytes;
+	unsigned int m_uiClasses;
+
+	//The factor and the longest match
+	FactorVector m_aFactors;
+	size_t m_iMaxLength;
+
+	//Finds the ends of the matches (unanchored), and their starts (the reversed pattern, anchored at the end)
+	mutable LazyDFA m_aForward;
+	mutable LazyDFA m_aReverse;
+
+	//Size of each cache
+	size_t m_iCacheSize;
+};
+
+#endif
@@ -0,0 +1,756 @@
+#include "RegexMatcher.h"
+#include <algorithm>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+
+const unsigned int CRegexMatcher::CANDIDATES_MAX;
+
+//Monotonic time in milliseconds
+static double GetTimeMS()
+{
+	timespec aTime;
+	clock_gettime(CLOCK_MONOTONIC,&aTime);
+	return aTime.tv_sec*1000.0+aTime.tv_nsec/1000000.0;
+}
+
+CRegexMatcher::CRegexMatcher()
+{
+	//Nothing was added
+	m_iCacheSize=CRegex::CACHE_SIZE;
+	Clear();
+}
+
+CRegexMatcher::~CRegexMatcher()
+{
+}
+
+void CRegexMatcher::Clear()
+{
+	//No rules (ids start over)
+	m_aTrie.Clear();
+	m_aTrieRules.clear();
+	m_aLiterals.clear();
+	m_aLiteralRules.clear();
+	m_aRegexes.clear();
+	m_aRegexRules.clear();
+	m_aRegexWindows.clear();
+	m_aRuleWindows.clear();
+	m_aWindows.clear();
+	m_iScanEnd=(size_t)-1;
+	m_aUnfiltered.clear();
+	m_iRuleId=0;
+	m_dBuildTime=0;
+}
+
+int CRegexMatcher::AddString(const std::string& rString,
+							 int iRuleId)
+{
+	//Sanity check
+	if (rString.empty() || iRuleId<0)
+		return 0;
+
+	//Our rule id, the next one if we don't have it (ids start at 1)
+	if (!iRuleId)
+		iRuleId=m_iRuleId+1;
+	m_iRuleId=std::max(m_iRuleId,iRuleId);
+
+	//The trie reports it by its own id
+	TrieRule aRule;
+	aRule.iRuleId=iRuleId;
+	aRule.iRegex=-1;
+	aRule.iWindow=-1;
+	m_aTrieRules.push_back(aRule);
+	m_aTrie.AddString(rString,m_aTrieRules.size());
+
+	//Kept for the rules it anchors
+	m_aLiterals.push_back(rString);
+	m_aLiteralRules.push_back(iRuleId);
+
+	//Done
+	return iRuleId;
+}
+
+int CRegexMatcher::AddRegex(const std::string& rPattern,
+							int iRuleId,
+							std::string* pError)
+{
+	//Sanity check
+	if (iRuleId<0)
+		return 0;
+
+	//Parse it
+	CRegex aRegex;
+	aRegex.SetCacheSize(m_iCacheSize);
+
+	std::string sError;
+	if (!aRegex.Parse(rPattern,sError))
+	{
+		if (pError)
+			*pError=sError;
+		return 0;
+	}
+
+	//Our rule id, the next one if we don't have it (ids start at 1)
+	if (!iRuleId)
+		iRuleId=m_iRuleId+1;
+	m_iRuleId=std::max(m_iRuleId,iRuleId);
+
+	unsigned int uiRegex;
+	uiRegex=m_aRegexes.size();
+	m_aRegexes.push_back(aRegex);
+	m_aRegexRules.push_back(iRuleId);
+	m_aRegexWindows.push_back(-1);
+
+	//Its factor goes to the trie, without one it always runs
+	const CRegex::FactorVector& rFactors=aRegex.GetFactors();
+	if (rFactors.empty())
+		m_aUnfiltered.push_back(uiRegex);
+
+	for (size_t iFactor=0;
+		 iFactor<rFactors.size();
+		 ++iFactor)
+	{
+		TrieRule aRule;
+		aRule.iRuleId=iRuleId;
+		aRule.iRegex=uiRegex;
+		aRule.iWindow=-1;
+		m_aTrieRules.push_back(aRule);
+		m_aTrie.AddString(rFactors[iFactor],m_aTrieRules.size());
+	}
+
+	//Done
+	return iRuleId;
+}
+
+bool CRegexMatcher::SetWindow(int iRuleId,
+							  const RuleWindow& rWindow)
+{
+	//Sanity check
+	if (iRuleId<=0 ||
+		(rWindow.iWithin &&
+		 (rWindow.iAnchor<=0 || rWindow.iAnchor==iRuleId)))
+		return false;
+
+	//Compile resolves it
+	m_aRuleWindows[iRuleId]=rWindow;
+
+	//Done
+	return true;
+}
+
+void CRegexMatcher::Compile()
+{
+	//Time the build
+	double dStart;
+	dStart=GetTimeMS();
+
+	//The windows, and where their matches must end
+	std::map<int,int> aWindowIndex;
+	m_aWindows.clear();
+
+	for (std::map<int,RuleWindow>::const_iterator aIterator=m_aRuleWindows.begin();
+		 aIterator!=m_aRuleWindows.end();
+		 ++aIterator)
+	{
+		Window aWindow;
+		aWindow.aRule=aIterator->second;
+		aWindow.iEnd=(size_t)-1;
+		aWindow.iAnchorWindow=-1;
+		if (aWindow.aRule.iDepth)
+			aWindow.iEnd=aWindow.aRule.iOffset+aWindow.aRule.iDepth;
+
+		aWindowIndex[aIterator->first]=m_aWindows.size();
+		m_aWindows.push_back(aWindow);
+	}
+
+	//The window each within leads to (-1 if the chain of anchors ends there)
+	std::vector<int> aNext(m_aWindows.size(),-1);
+	for (size_t iWindow=0;
+		 iWindow<m_aWindows.size();
+		 ++iWindow)
+		if (m_aWindows[iWindow].aRule.iWithin)
+		{
+			std::map<int,int>::const_iterator aAnchor=aWindowIndex.find(m_aWindows[iWindow].aRule.iAnchor);
+			if (aAnchor!=aWindowIndex.end())
+				aNext[iWindow]=aAnchor->second;
+		}
+
+	//Follow the chains, a chain of anchors must end at a rule without a within, so every rule of a
+	//cycle has its within dropped
+	std::vector<int> aWalk(m_aWindows.size(),-1);
+	std::vector<bool> aCycle(m_aWindows.size(),false);
+
+	for (size_t iStart=0;
+		 iStart<m_aWindows.size();
+		 ++iStart)
+	{
+		int iWindow;
+		iWindow=iStart;
+		while (iWindow>=0 && aWalk[iWindow]<0)
+		{
+			aWalk[iWindow]=iStart;
+			iWindow=aNext[iWindow];
+		}
+
+		//We came back to a window of this walk, it is on a cycle and so are the ones after it
+		if (iWindow>=0 && aWalk[iWindow]==(int)iStart)
+			do
+			{
+				aCycle[iWindow]=true;
+				iWindow=aNext[iWindow];
+			} while (!aCycle[iWindow]);
+	}
+
+	//The anchors
+	for (std::map<int,RuleWindow>::const_iterator aIterator=m_aRuleWindows.begin();
+		 aIterator!=m_aRuleWindows.end();
+		 ++aIterator)
+	{
+		Window& rWindow=m_aWindows[aWindowIndex[aIterator->first]];
+		if (!rWindow.aRule.iWithin)
+			continue;
+
+		if (aCycle[aWindowIndex[aIterator->first]])
+		{
+			rWindow.aRule.iWithin=0;
+			continue;
+		}
+
+		int iAnchor;
+		iAnchor=rWindow.aRule.iAnchor;
+
+		std::map<int,RuleWindow>::const_iterator aAnchor=m_aRuleWindows.find(iAnchor);
+		if (aAnchor!=m_aRuleWindows.end())
+		{
+			//A bounded anchor bounds us too
+			rWindow.iAnchorWindow=aWindowIndex[iAnchor];
+			if (aAnchor->second.iDepth)
+				rWindow.iEnd=std::min(rWindow.iEnd,
+									  aAnchor->second.iOffset+aAnchor->second.iDepth+rWindow.aRule.iWithin);
+		}
+
+		for (size_t iLiteral=0;
+			 iLiteral<m_aLiterals.size();
+			 ++iLiteral)
+			if (m_aLiteralRules[iLiteral]==iAnchor)
+				rWindow.aAnchorLiterals.push_back(iLiteral);
+
+		for (size_t iRegex=0;
+			 iRegex<m_aRegexes.size();
+			 ++iRegex)
+			if (m_aRegexRules[iRegex]==iAnchor)
+				rWindow.aAnchorRegexes.push_back(iRegex);
+	}
+
+	//Every literal, factor and regex gets the window of its rule, the searches stop where the last one ends
+	m_iScanEnd=0;
+
+	for (size_t iRule=0;
+		 iRule<m_aTrieRules.size();
+		 ++iRule)
+	{
+		std::map<int,int>::const_iterator aIterator=aWindowIndex.find(m_aTrieRules[iRule].iRuleId);
+		m_aTrieRules[iRule].iWindow=aIterator!=aWindowIndex.end()?aIterator->second:-1;
+
+		if (m_aTrieRules[iRule].iRegex<0)
+			m_iScanEnd=std::max(m_iScanEnd,
+								aIterator!=aWindowIndex.end()?m_aWindows[aIterator->second].iEnd:(size_t)-1);
+	}
+
+	for (size_t iRegex=0;
+		 iRegex<m_aRegexes.size();
+		 ++iRegex)
+	{
+		std::map<int,int>::const_iterator aIterator=aWindowIndex.find(m_aRegexRules[iRegex]);
+		m_aRegexWindows[iRegex]=aIterator!=aWindowIndex.end()?aIterator->second:-1;
+
+		m_iScanEnd=std::max(m_iScanEnd,
+							aIterator!=aWindowIndex.end()?m_aWindows[aIterator->second].iEnd:(size_t)-1);
+	}
+
+	//The regexes are built as they are searched, only the trie is left
+	m_aTrie.Compile();
+
+	//Done
+	m_dBuildTime=GetTimeMS()-dStart;
+}
+
+bool CRegexMatcher::ScanCallback(const Match& rMatch,
+								 void* pContext)
+{
+	ScanContext* pScan;
+	pScan=(ScanContext*)pContext;
+
+	const CRegexMatcher* pMatcher;
+	pMatcher=pScan->pMatcher;
+
+	const TrieRule& rRule=pMatcher->m_aTrieRules[rMatch.rule_id-1];
+
+	//A literal, with its rule (if it is in its window)
+	if (rRule.iRegex<0)
+	{
+		if (rRule.iWindow>=0 &&
+			!pMatcher->InWindow(pMatcher->m_aWindows[rRule.iWindow],
+								pScan->pData,
+								pScan->iLength,
+								rMatch.iFoundPosition,
+								rMatch.iEndPosition))
+			return true;
+
+		Match aMatch;
+		aMatch=rMatch;
+		aMatch.rule_id=rRule.iRuleId;
+
+		if (!pScan->pReport(aMatch,pScan->pPolicy))
+		{
+			pScan->bStopped=true;
+			return false;
+		}
+
+		return true;
+	}
+
+	//A factor, its regex may match (the latest ones first, the hits of a factor come together)
+	//The matches of the regex have it, so it is in their window
+	if (pScan->bOverflow)
+		return true;
+
+	if (rRule.iWindow>=0 &&
+		(rMatch.iFoundPosition<pMatcher->m_aWindows[rRule.iWindow].aRule.iOffset ||
+		 rMatch.iEndPosition>=pMatcher->m_aWindows[rRule.iWindow].iEnd))
+		return true;
+
+	for (size_t iCandidate=pScan->iCandidates;
+		 iCandidate>0;
+		 --iCandidate)
+		if (pScan->aCandidates[iCandidate-1].uiRegex==(unsigned int)rRule.iRegex)
+		{
+			Candidate& rCandidate=pScan->aCandidates[iCandidate-1];
+			rCandidate.iFactorEnd=std::min(rCandidate.iFactorEnd,rMatch.iEndPosition);
+			return true;
+		}
+
+	if (pScan->iCandidates==CANDIDATES_MAX)
+		pScan->bOverflow=true;
+	else
+	{
+		Candidate& rCandidate=pScan->aCandidates[pScan->iCandidates++];
+		rCandidate.uiRegex=rRule.iRegex;
+		rCandidate.iFactorEnd=rMatch.iEndPosition;
+	}
+
+	//Done
+	return true;
+}
+
+bool CRegexMatcher::CandidateLess(const Candidate& rA,
+								  const Candidate& rB)
+{
+	return rA.uiRegex<rB.uiRegex;
+}
+
+template<class Policy>
+bool CRegexMatcher::PolicyReport(const Match& rMatch,
+								 void* pPolicy)
+{
+	return ((Policy*)pPolicy)->Report(rMatch);
+}
+
+bool CRegexMatcher::RuleReport(const Match& rMatch,
+							   void* pPolicy)
+{
+	//The bit is set, the other matches of the regex don't change it
+	((RulesPolicy*)pPolicy)->Report(rMatch);
+	return false;
+}
+
+bool CRegexMatcher::WindowReport(const Match& rMatch,
+								 void* pContext)
+{
+	WindowContext* pWindow;
+	pWindow=(WindowContext*)pContext;
+
+	//An anchor match ends before we end, at most iWithin bytes before
+	size_t iEnd;
+	iEnd=rMatch.iEndPosition;
+
+	size_t iWithin;
+	iWithin=pWindow->pWindow->aRule.iWithin;
+
+	if (!iEnd)
+		return true;
+
+	size_t iAnchor;
+	iAnchor=pWindow->pMatcher->FindAnchor(*pWindow->pWindow,
+										  pWindow->pData,
+										  pWindow->iLength,
+										  iEnd>iWithin?iEnd-iWithin:0,
+										  iEnd-1);
+	if (iAnchor==(size_t)-1)
+		return true;
+
+	//And a match of ours starts after it
+	size_t iStart;
+	iStart=pWindow->pRegex->FindStart(pWindow->pData,iEnd,std::max(iAnchor+1,pWindow->iFrom));
+	if (iStart>iEnd)
+		return true;
+
+	Match aMatch;
+	aMatch=rMatch;
+	aMatch.iFoundPosition=iStart;
+	return pWindow->pReport(aMatch,pWindow->pPolicy);
+}
+
+bool CRegexMatcher::AnchorReport(const Match& rMatch,
+								 void* pContext)
+{
+	AnchorScan* pScan;
+	pScan=(AnchorScan*)pContext;
+
+	//Too early
+	if (rMatch.iEndPosition<pScan->iFirst)
+		return true;
+
+	//The regex reports by end, this is the first one
+	pScan->iFound=rMatch.iEndPosition;
+	return false;
+}
+
+size_t CRegexMatcher::FindAnchor(const Window& rWindow,
+								 const unsigned char* pData,
+								 size_t iLength,
+								 size_t iFirst,
+								 size_t iLast)const
+{
+	//The anchor's own window
+	size_t iFrom;
+	iFrom=0;
+
+	if (rWindow.iAnchorWindow>=0)
+	{
+		const RuleWindow& rAnchor=m_aWindows[rWindow.iAnchorWindow].aRule;
+		iFrom=rAnchor.iOffset;
+		if (rAnchor.iDepth)
+			iLast=std::min(iLast,rAnchor.iOffset+rAnchor.iDepth-1);
+	}
+
+	if (iLast>=iLength)
+		iLast=iLength-1;
+
+	size_t iFound;
+	iFound=(size_t)-1;
+
+	if (iFirst>iLast)
+		return iFound;
+
+	//The first end of each literal
+	for (size_t iCount=0;
+		 iCount<rWindow.aAnchorLiterals.size();
+		 ++iCount)
+	{
+		const std::string& rLiteral=m_aLiterals[rWindow.aAnchorLiterals[iCount]];
+
+		for (size_t iEnd=std::max(iFirst,iFrom+rLiteral.size()-1);
+			 iEnd<=iLast && iEnd<iFound;
+			 ++iEnd)
+			if (!memcmp(pData+iEnd+1-rLiteral.size(),rLiteral.data(),rLiteral.size()))
+			{
+				iFound=iEnd;
+				break;
+			}
+	}
+
+	//The regexes, only the ends before the one we have
+	for (size_t iCount=0;
+		 iCount<rWindow.aAnchorRegexes.size();
+		 ++iCount)
+	{
+		const CRegex& rRegex=m_aRegexes[rWindow.aAnchorRegexes[iCount]];
+
+		size_t iRegexFrom;
+		iRegexFrom=iFrom;
+		if (rRegex.GetMaxLength() &&
+			iFirst+1>rRegex.GetMaxLength())
+			iRegexFrom=std::max(iRegexFrom,iFirst+1-rRegex.GetMaxLength());
+
+		AnchorScan aScan;
+		aScan.iFirst=iFirst;
+		aScan.iFound=(size_t)-1;
+		rRegex.Search(pData,std::min(iLast+1,iFound),iRegexFrom,0,false,AnchorReport,&aScan);
+
+		iFound=std::min(iFound,aScan.iFound);
+	}
+
+	//Done
+	return iFound;
+}
+
+bool CRegexMatcher::InWindow(const Window& rWindow,
+							 const unsigned char* pData,
+							 size_t iLength,
+							 size_t iStart,
+							 size_t iEnd)const
+{
+	//The offset and the depth
+	if (iStart<rWindow.aRule.iOffset ||
+		iEnd>=rWindow.iEnd)
+		return false;
+
+	if (!rWindow.aRule.iWithin)
+		return true;
+
+	//An anchor match ends before we start, at most iWithin bytes before we end
+	if (!iStart)
+		return false;
+
+	return FindAnchor(rWindow,
+					  pData,
+					  iLength,
+					  iEnd>rWindow.aRule.iWithin?iEnd-rWindow.aRule.iWithin:0,
+					  iStart-1)!=(size_t)-1;
+}
+
+bool CRegexMatcher::SearchRegex(unsigned int uiRegex,
+								const unsigned char* pData,
+								size_t iLength,
+								size_t iFrom,
+								bool bStart,
+								MatchCallback pReport,
+								void* pPolicy)const
+{
+	const CRegex& rRegex=m_aRegexes[uiRegex];
+
+	//No window
+	if (m_aRegexWindows[uiRegex]<0)
+		return rRegex.Search(pData,iLength,iFrom,m_aRegexRules[uiRegex],bStart,pReport,pPolicy);
+
+	//The matches start in the window and end before its end
+	const Window& rWindow=m_aWindows[m_aRegexWindows[uiRegex]];
+	iFrom=std::max(iFrom,rWindow.aRule.iOffset);
+	iLength=std::min(iLength,rWindow.iEnd);
+
+	if (!rWindow.aRule.iWithin)
+		return rRegex.Search(pData,iLength,iFrom,m_aRegexRules[uiRegex],bStart,pReport,pPolicy);
+
+	//The ones after an anchor, they find their own start
+	WindowContext aContext;
+	aContext.pMatcher=this;
+	aContext.pWindow=&rWindow;
+	aContext.pRegex=&rRegex;
+	aContext.pData=pData;
+	aContext.iLength=iLength;
+	aContext.iFrom=iFrom;
+	aContext.pReport=pReport;
+	aContext.pPolicy=pPolicy;
+	return rRegex.Search(pData,iLength,iFrom,m_aRegexRules[uiRegex],false,WindowReport,&aContext);
+}
+
+template<class Policy>
+bool CRegexMatcher::Search(const unsigned char* pData,
+						   size_t iLength,
+						   Policy& rPolicy,
+						   bool bStart,
+						   MatchCallback pRegexReport)const
+{
+	//The literals, and which regexes may match
+	ScanContext aScan;
+	aScan.pMatcher=this;
+	aScan.pData=pData;
+	aScan.iLength=iLength;
+	aScan.pReport=PolicyReport<Policy>;
+	aScan.pPolicy=&rPolicy;
+	aScan.iCandidates=0;
+	aScan.bOverflow=false;
+	aScan.bStopped=false;
+
+	//No window goes past the scan end, neither do the literals and the factors
+	m_aTrie.SearchBytes(pData,std::min(iLength,m_iScanEnd),ScanCallback,&aScan);
+	if (aScan.bStopped)
+		return false;
+
+	//Who gets the regex matches
+	MatchCallback pReport;
+	pReport=pRegexReport?pRegexReport:aScan.pReport;
+
+	//Too many candidates, every regex runs
+	if (aScan.bOverflow)
+	{
+		for (size_t iRegex=0;
+			 iRegex<m_aRegexes.size();
+			 ++iRegex)
+			if (!SearchRegex(iRegex,pData,iLength,0,bStart,pReport,&rPolicy) &&
+				!pRegexReport)
+				return false;
+
+		return true;
+	}
+
+	//The candidates in regex order, a match ends after the first factor, and a bounded one can't
+	//start further back than its longest match
+	std::sort(aScan.aCandidates,aScan.aCandidates+aScan.iCandidates,CandidateLess);
+
+	for (size_t iCandidate=0;
+		 iCandidate<aScan.iCandidates;
+		 ++iCandidate)
+	{
+		const Candidate& rCandidate=aScan.aCandidates[iCandidate];
+		const CRegex& rRegex=m_aRegexes[rCandidate.uiRegex];
+
+		size_t iFrom;
+		iFrom=0;
+		if (rRegex.GetMaxLength() &&
+			rCandidate.iFactorEnd+1>rRegex.GetMaxLength())
+			iFrom=rCandidate.iFactorEnd+1-rRegex.GetMaxLength();
+
+		if (!SearchRegex(rCandidate.uiRegex,pData,iLength,iFrom,bStart,pReport,&rPolicy) &&
+			!pRegexReport)
+			return false;
+	}
+
+	//The ones without a factor
+	for (size_t iCount=0;
+		 iCount<m_aUnfiltered.size();
+		 ++iCount)
+	{
+		unsigned int uiRegex;
+		uiRegex=m_aUnfiltered[iCount];
+
+		if (!SearchRegex(uiRegex,pData,iLength,0,bStart,pReport,&rPolicy) &&
+			!pRegexReport)
+			return false;
+	}
+
+	//Done
+	return true;
+}
+
+void CRegexMatcher::SearchBytes(const unsigned char* pData,
+								size_t iLength,
+								MatchCallback pCallback,
+								void* pContext)const
+{
+	CallbackPolicy aPolicy;
+	aPolicy.pCallback=pCallback;
+	aPolicy.pContext=pContext;
+	Search(pData,iLength,aPolicy,true,NULL);
+}
+
+bool CRegexMatcher::SearchExists(const unsigned char* pData,
+								 size_t iLength)const
+{
+	//Stop at the first one
+	ExistsPolicy aPolicy;
+	aPolicy.bFound=false;
+	Search(pData,iLength,aPolicy,false,NULL);
+
+	//Done
+	return aPolicy.bFound;
+}
+
+size_t CRegexMatcher::SearchCount(const unsigned char* pData,
+								  size_t iLength)const
+{
+	//Count them all
+	CountPolicy aPolicy;
+	aPolicy.iCount=0;
+	Search(pData,iLength,aPolicy,false,NULL);
+
+	//Done
+	return aPolicy.iCount;
+}
+
+void CRegexMatcher::SearchRules(const unsigned char* pData,
+								size_t iLength,
+								unsigned long long* pRules,
+								size_t iRuleWords)const
+{
+	//Set their bits, a regex stops at its first match
+	RulesPolicy aPolicy;
+	aPolicy.pRules=pRules;
+	aPolicy.iRuleWords=iRuleWords;
+	Search(pData,iLength,aPolicy,false,RuleReport);
+}
+
+CRegexMatcher::MatcherStats CRegexMatcher::GetStats()const
+{
+	//The trie tells the shape of the literals and the factors
+	MatcherStats aStats;
+	aStats=m_aTrie.GetStats();
+
+	//How far a payload is searched
+	char aScanEnd[64];
+	if (m_iScanEnd==(size_t)-1)
+		snprintf(aScanEnd,sizeof(aScanEnd),"the payloads are searched to their end");
+	else
+		snprintf(aScanEnd,sizeof(aScanEnd),"the searches stop at byte %lu",(unsigned long)m_iScanEnd);
+
+	char aReason[640];
+	snprintf(aReason,
+			 sizeof(aReason),
+			 "%lu literals and %lu regexes (%lu without a factor run on every payload), a lazy DFA per regex with %lu KB caches, %lu windows (%s), the literals and the factors: %s %s",
+			 (unsigned long)m_aLiterals.size(),
+			 (unsigned long)m_aRegexes.size(),
+			 (unsigned long)m_aUnfiltered.size(),
+			 (unsigned long)m_iCacheSize/1024,
+			 (unsigned long)m_aWindows.size(),
+			 aScanEnd,
+			 GetEngineName(aStats.eEngine),
+			 aStats.sReason.c_str());
+
+	aStats.eEngine=meRegex;
+	aStats.sReason=aReason;
+	aStats.aShape.iRules=m_aLiterals.size()+m_aRegexes.size();
+	aStats.iMemory=GetSize();
+	aStats.dBuildTime=m_dBuildTime;
+
+	//Done
+	return aStats;
+}
+
+CMatcher* CRegexMatcher::Clone()const
+{
+	return new CRegexMatcher(*this);
+}
+
+void CRegexMatcher::SetCacheSize(size_t iSize)
+{
+	m_iCacheSize=iSize;
+
+	for (size_t iRegex=0;
+		 iRegex<m_aRegexes.size();
+		 ++iRegex)
+		m_aRegexes[iRegex].SetCacheSize(iSize);
+}
+
+size_t CRegexMatcher::GetUnfiltered()const
+{
+	return m_aUnfiltered.size();
+}
+
+size_t CRegexMatcher::GetScanEnd()const
+{
+	return m_iScanEnd;
+}
+
+size_t CRegexMatcher::GetSize()const
+{
+	//The trie, our tables, the literals we keep, and the regexes
+	size_t iSize;
+	iSize=m_aTrie.GetStats().iMemory+
+		  m_aTrieRules.size()*sizeof(TrieRule)+
+		  m_aWindows.size()*sizeof(Window);
+
+	for (size_t iLiteral=0;
+		 iLiteral<m_aLiterals.size();
+		 ++iLiteral)
+		iSize+=m_aLiterals[iLiteral].size()+sizeof(int);
+
+	for (size_t iRegex=0;
+		 iRegex<m_aRegexes.size();
+		 ++iRegex)
+		iSize+=m_aRegexes[iRegex].GetSize();
+
+	//Done
+	return iSize;
+}
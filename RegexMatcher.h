@@ -0,0 +1,247 @@
+#ifndef REGEXMATCHER_H
+#define REGEXMATCHER_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Matcher.h"
+#include "SuffixTrie.h"
+#include "Regex.h"
+
+//Literal rules and regex rules (CRegex) in one matcher
+//The literals and the factor of every regex (literals one of which each of its matches has) go to
+//one trie, a regex is only searched on the payloads its factor was found in, from where the factor
+//allows, so the payloads no factor hits cost what the literals cost
+//A regex without a factor is searched on every payload
+//The literal matches are reported as the trie finds them, then the ones of the regexes (a match per
+//byte a regex match ends on)
+//A rule may have a window (where in the payload it matches), when every rule has one the searches
+//stop where the last window ends, so a payload costs at most that many bytes
+class CRegexMatcher : public CMatcher {
+
+public:
+	//Where the matches of a rule may be, the ones outside it are not reported
+	typedef struct _RuleWindow {
+		size_t	iOffset;	//The match starts this far into the payload (or further)
+		size_t	iDepth;		//It ends in the iDepth bytes from iOffset (0 has no bound)
+		size_t	iWithin;	//It starts after the end of a match of iAnchor, and ends at most iWithin
+							//bytes past it (0 for none)
+		int		iAnchor;	//The rule of iWithin
+	} RuleWindow;
+
+public:
+	//Add a literal for a rule, returns the rule id (0 if the literal is empty)
+	//With iRuleId 0 the matcher gives the next id (ids start at 1)
+	virtual int AddString(const std::string& rString,
+						  int iRuleId=0);
+
+	//Add a regex for a rule, returns the rule id (0 if the pattern is bad, pError gets why)
+	int AddRegex(const std::string& rPattern,
+				 int iRuleId=0,
+				 std::string* pError=NULL);
+
+	//Set the window of a rule (of all its literals and regexes), this is done before Compile
+	//A match of the anchor counts if it is in the offset and depth of the anchor (its within is not checked)
+	//Returns false if the window is bad (a within without an anchor, or the rule is its own anchor)
+	bool SetWindow(int iRuleId,
+				   const RuleWindow& rWindow);
+
+	//Compile the trie, this is done when all the rules were added (the regex DFAs are built as they are searched)
+	//The windows are resolved here, the anchors can't go round in a cycle (the within of every rule
+	//on one is dropped)
+	virtual void Compile();
+
+	//Search raw bytes and call pCallback for every match
+	virtual void SearchBytes(const unsigned char* pData,
+							 size_t iLength,
+							 MatchCallback pCallback,
+							 void* pContext)const;
+
+	//Did anything match? (stops at the first match)
+	virtual bool SearchExists(const unsigned char* pData,
+							  size_t iLength)const;
+
+	//How many matches
+	virtual size_t SearchCount(const unsigned char* pData,
+							   size_t iLength)const;
+
+	//Set the bit of every rule that matched (bit rule_id of pRules, it has iRuleWords words)
+	virtual void SearchRules(const unsigned char* pData,
+							 size_t iLength,
+							 unsigned long long* pRules,
+							 size_t iRuleWords)const;
+
+	//What was compiled
+	virtual MatcherStats GetStats()const;
+
+	//A copy (the regex caches start empty)
+	virtual CMatcher* Clone()const;
+
+	//Size of the DFA caches of every regex (in bytes)
+	void SetCacheSize(size_t iSize);
+
+	//How many regexes have no factor (they run on every payload)
+	size_t GetUnfiltered()const;
+
+	//Where the searches stop (the end of the last window), -1 if a rule has no window
+	size_t GetScanEnd()const;
+
+	//Drop all the rules (ids start over)
+	void Clear();
+
+	//Memory used by the trie and the regexes (in bytes)
+	size_t GetSize()const;
+
+	//Ctor and Dtor
+	CRegexMatcher();
+	virtual ~CRegexMatcher();
+private:
+	//What a trie rule is
+	typedef struct _TrieRule {
+		int	iRuleId;	//The rule of a literal
+		int	iRegex;		//The regex of a factor (-1 for a literal)
+		int	iWindow;	//The window of the rule (-1 if it has none)
+	} TrieRule;
+
+	//A window as the searches use it
+	typedef struct _Window {
+		RuleWindow					aRule;
+		size_t						iEnd;			//Past the last byte a match can end on (-1 if none)
+		int							iAnchorWindow;	//The window of the anchor (-1 if it has none)
+		std::vector<unsigned int>	aAnchorLiterals;
+		std::vector<unsigned int>	aAnchorRegexes;
+	} Window;
+
+	//A regex search of a rule with a within
+	typedef struct _WindowContext {
+		const CRegexMatcher*	pMatcher;
+		const Window*			pWindow;
+		const CRegex*			pRegex;
+		const unsigned char*	pData;
+		size_t					iLength;
+		size_t					iFrom;		//Where the search started
+		MatchCallback			pReport;
+		void*					pPolicy;
+	} WindowContext;
+
+	//A search for an anchor
+	typedef struct _AnchorScan {
+		size_t	iFirst;		//The ends before it don't count
+		size_t	iFound;		//The first end (-1 if none)
+	} AnchorScan;
+
+	//A regex whose factor was found, and where the first one ended
+	typedef struct _Candidate {
+		unsigned int	uiRegex;
+		size_t			iFactorEnd;
+	} Candidate;
+
+	//The most candidates of a payload, past it every regex runs
+	static const unsigned int CANDIDATES_MAX = 64;
+
+	//A trie scan
+	typedef struct _ScanContext {
+		const CRegexMatcher*	pMatcher;
+		const unsigned char*	pData;
+		size_t					iLength;
+		MatchCallback			pReport;		//Gets the literal matches
+		void*					pPolicy;		//Its context
+		Candidate				aCandidates[CANDIDATES_MAX];
+		size_t					iCandidates;
+		bool					bOverflow;		//Too many candidates
+		bool					bStopped;		//The policy stopped the search
+	} ScanContext;
+
+	//Gets the trie matches, reports the literals and collects the candidates
+	static bool ScanCallback(const Match& rMatch,
+							 void* pContext);
+
+	//Candidates by regex
+	static bool CandidateLess(const Candidate& rA,
+							  const Candidate& rB);
+
+	//Pass a match to a policy
+	template<class Policy>
+	static bool PolicyReport(const Match& rMatch,
+							 void* pPolicy);
+
+	//Pass a match to the rules policy, the regex has nothing more to tell
+	static bool RuleReport(const Match& rMatch,
+						   void* pPolicy);
+
+	//Pass on the regex matches that have their anchor
+	static bool WindowReport(const Match& rMatch,
+							 void* pContext);
+
+	//Stops at the first anchor match that ends late enough
+	static bool AnchorReport(const Match& rMatch,
+							 void* pContext);
+
+	//The first end of an anchor match from iFirst to iLast (in the anchor's own window), -1 if there is none
+	size_t FindAnchor(const Window& rWindow,
+					  const unsigned char* pData,
+					  size_t iLength,
+					  size_t iFirst,
+					  size_t iLast)const;
+
+	//Is a literal match in its window
+	bool InWindow(const Window& rWindow,
+				  const unsigned char* pData,
+				  size_t iLength,
+				  size_t iStart,
+				  size_t iEnd)const;
+
+	//Search a regex in its window
+	bool SearchRegex(unsigned int uiRegex,
+					 const unsigned char* pData,
+					 size_t iLength,
+					 size_t iFrom,
+					 bool bStart,
+					 MatchCallback pReport,
+					 void* pPolicy)const;
+
+	//Search the trie then the regexes it allows, returns false if the policy stopped it
+	//bStart finds where the regex matches start, pRegexReport (if given) gets the regex matches
+	//instead of the policy, and it stops only the regex it was given
+	template<class Policy>
+	bool Search(const unsigned char* pData,
+				size_t iLength,
+				Policy& rPolicy,
+				bool bStart,
+				MatchCallback pRegexReport)const;
+
+	//The literals and the factors
+	CSuffixTrie m_aTrie;
+	std::vector<TrieRule> m_aTrieRules;
+
+	//The literals and their rules (same index)
+	std::vector<std::string> m_aLiterals;
+	std::vector<int> m_aLiteralRules;
+
+	//The regexes, their rules and windows (same index)
+	std::vector<CRegex> m_aRegexes;
+	std::vector<int> m_aRegexRules;
+	std::vector<int> m_aRegexWindows;
+
+	//The windows we were given, and the ones Compile made of them
+	std::map<int,RuleWindow> m_aRuleWindows;
+	std::vector<Window> m_aWindows;
+
+	//Where the searches stop
+	size_t m_iScanEnd;
+
+	//The ones without a factor
+	std::vector<unsigned int> m_aUnfiltered;
+
+	//The last rule id we gave (or were given)
+	int m_iRuleId;
+
+	//Size of the regex caches
+	size_t m_iCacheSize;
+
+	//Time of the last build
+	double m_dBuildTime;
+};
+
+#endif
@@ -1,31 +1,439 @@
 #include "SuffixTrie.h"
+#include <algorithm>
+#include <cstring>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+//The prefilter uses vectors on x86, the widest the cpu has are picked when we run (the default
+//flags build them, each function is compiled for its own instructions)
+#if defined(__x86_64__) || defined(__i386__)
+#define PREFILTER_VECTORS
+#include <immintrin.h>
+#endif
+
+//The start of a saved image
+static const char IMAGE_MAGIC[8]="SFXTRIE";
+
+//The multipliers of the two prefilter hashes
+static const unsigned int PREFIX_HASH_FIRST = 0x9E3779B1;
+static const unsigned int PREFIX_HASH_SECOND = 0x85EBCA77;
+
+//Is a prefix hash in the prefilter bitmap? (both its halves must be set)
+static inline bool HasPrefix(const unsigned long long* pHash,
+							 unsigned int uiHash)
+{
+	unsigned int uiFirst;
+	uiFirst=uiHash>>16;
+	unsigned int uiSecond;
+	uiSecond=uiHash&0xffff;
+	return (pHash[uiFirst>>6]>>(uiFirst&63))&(pHash[uiSecond>>6]>>(uiSecond&63))&1;
+}
+
+//The prefix hash of the uiLength leading bytes at pData
+static inline unsigned int HashPrefix(const unsigned char* pData,
+									  unsigned int uiLength)
+{
+	//Pack the leading bytes
+	unsigned int uiWord;
+	uiWord=0;
+	if (uiLength==sizeof(uiWord))
+		memcpy(&uiWord,pData,sizeof(uiWord));
+	else
+		memcpy(&uiWord,pData,uiLength);
+
+	//Two multiplicative hashes, the top bits are the best
+	return ((uiWord*PREFIX_HASH_FIRST)>>16<<16)|
+		   ((uiWord*PREFIX_HASH_SECOND)>>16);
+}
+
+#ifdef PREFILTER_VECTORS
+//The vectors the prefilter can use
+typedef enum _PrefilterVectors {
+	pvNone,
+	pvSSSE3,
+	pvAVX2
+} PrefilterVectors;
+
+//The widest vectors of this cpu
+static PrefilterVectors GetCpuVectors()
+{
+	//We may run before the other constructors
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return pvAVX2;
+	else if (__builtin_cpu_supports("ssse3"))
+		return pvSSSE3;
+	else
+		return pvNone;
+}
+
+//Found once, the searches only read it
+static const PrefilterVectors PREFILTER_CPU_VECTORS = GetCpuVectors();
+
+//Which of the 32 positions at pData have their prefix hash in the bitmap (a bit per position)
+//Same hash as HashPrefix, reads 40 bytes
+__attribute__((target("avx2")))
+static inline unsigned int PrefixHits(const unsigned char* pData,
+									  const unsigned long long* pHash,
+									  unsigned int uiWordMask)
+{
+	//Where the words of 8 positions start in 16 bytes (4 in each lane)
+	const __m256i aWords=_mm256_setr_epi8(0,1,2,3,1,2,3,4,2,3,4,5,3,4,5,6,
+										  4,5,6,7,5,6,7,8,6,7,8,9,7,8,9,10);
+	const __m256i aMask=_mm256_set1_epi32(uiWordMask);
+	const __m256i aFirst=_mm256_set1_epi32(PREFIX_HASH_FIRST);
+	const __m256i aSecond=_mm256_set1_epi32(PREFIX_HASH_SECOND);
+	const __m256i aBit=_mm256_set1_epi32(31);
+	const __m256i aOne=_mm256_set1_epi32(1);
+
+	unsigned int uiHits;
+	uiHits=0;
+
+	for (unsigned int uiGroup=0; uiGroup<4; ++uiGroup)
+	{
+		//The leading bytes of 8 positions
+		__m256i aWord;
+		aWord=_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(pData+uiGroup*8)));
+		aWord=_mm256_and_si256(_mm256_shuffle_epi8(aWord,aWords),aMask);
+
+		//Both halves of the hash
+		__m256i aHashFirst;
+		aHashFirst=_mm256_srli_epi32(_mm256_mullo_epi32(aWord,aFirst),16);
+		__m256i aHashSecond;
+		aHashSecond=_mm256_srli_epi32(_mm256_mullo_epi32(aWord,aSecond),16);
+
+		//Get their bits (the bitmap as 32 bit words)
+		__m256i aHit;
+		aHit=_mm256_and_si256(_mm256_srlv_epi32(_mm256_i32gather_epi32((const int*)pHash,_mm256_srli_epi32(aHashFirst,5),4),
+												_mm256_and_si256(aHashFirst,aBit)),
+							  _mm256_srlv_epi32(_mm256_i32gather_epi32((const int*)pHash,_mm256_srli_epi32(aHashSecond,5),4),
+												_mm256_and_si256(aHashSecond,aBit)));
+		aHit=_mm256_cmpeq_epi32(_mm256_and_si256(aHit,aOne),aOne);
+
+		uiHits|=(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(aHit))<<(uiGroup*8);
+	}
+
+	return uiHits;
+}
+#endif
+
+//Monotonic time in milliseconds
+static double GetTimeMS()
+{
+	timespec aTime;
+	clock_gettime(CLOCK_MONOTONIC,&aTime);
+	return aTime.tv_sec*1000.0+aTime.tv_nsec/1000000.0;
+}
+
+//The result policy of the found vector searches (the others are in Matcher.h, the other matchers use them)
+//Adds the matches (and their strings) to a found vector
+typedef struct _FoundPolicy {
+	CSuffixTrie::DataFoundVector*		pVector;	//Where the matches go
+	const CSuffixTrie::SearchString*	pString;	//The string we search
+
+	bool Report(const CSuffixTrie::Match& rMatch)
+	{
+		//We got our data
+		CSuffixTrie::DataFound aData;
+		aData.iFoundPosition=rMatch.iFoundPosition;
+		aData.iEndPosition=rMatch.iEndPosition;
+		aData.rule_id=rMatch.rule_id;
+		aData.sDataFound=pString->substr(rMatch.iFoundPosition,
+										 rMatch.iEndPosition-rMatch.iFoundPosition+1);
+
+		//Insert it
+		pVector->push_back(aData);
+		return true;
+	}
+} FoundPolicy;
+
+//A thread of a parallel build (or search)
+typedef struct _BuildWorker {
+	void*			pJob;		//What the threads share (an InsertJob, IndexJob or ScanJob)
+	unsigned int	uiThread;	//Our number
+	unsigned int	uiThreads;	//Out of
+} BuildWorker;
+
+//The phases of a parallel build
+enum BuildPhase {
+	bpInsert,	//Insert the strings of each shard into a trie of its own
+	bpMove,		//Move the shard nodes to where the serial insert puts them
+	bpFailure,	//Find the failure/output links of a level
+	bpLists		//Build the failure lists of some keys
+};
+
+//What the threads of a parallel insert share
+typedef struct _InsertJob {
+	BuildPhase							ePhase;
+	CSuffixTrie*						pTrie;			//Where the strings go
+	const CSuffixTrie::StringsVector*	pStrings;		//The strings
+	std::vector<int>					aRuleIds;		//Their rule ids (0 if the string is empty)
+	unsigned char						aShards[256];	//Which thread takes each leading byte
+	std::vector<CSuffixTrie*>			aTries;			//The trie of each shard
+	std::vector<unsigned int>			aNewNodes;		//Nodes each string added to its shard
+	std::vector<unsigned char>			aNewWords;		//Did it add a word?
+	std::vector<unsigned int>			aNodeBase;		//Where its nodes go in our arena
+	std::vector<unsigned int>			aWordBase;		//Where its rules go
+} InsertJob;
+
+//What the threads of a parallel index share
+typedef struct _IndexJob {
+	BuildPhase												ePhase;
+	CSuffixTrie*											pTrie;		//The trie
+	std::vector<unsigned int>								aOrder;		//The nodes breadth first
+	size_t													iStart;		//The level we link
+	size_t													iEnd;
+	std::vector<unsigned long long>							aKeys;		//Failure list key of every node
+	std::vector<std::map<unsigned long long,unsigned int> >	aLists;		//The failure lists of each thread
+} IndexJob;
+
+//What the threads of a parallel search share
+typedef struct _ScanJob {
+	const CSuffixTrie*							pTrie;		//Who searches
+	const unsigned char*						pData;		//The buffer
+	size_t										iLength;
+	size_t										iOverlap;	//Bytes a chunk scans before it (longest word-1)
+	std::vector<std::vector<CMatcher::Match> >	aMatches;	//The matches of each chunk
+} ScanJob;
+
+//Keeps the matches that end in a chunk, at their offsets in the whole buffer
+typedef struct _ChunkPolicy {
+	std::vector<CMatcher::Match>*	pMatches;	//Where they go
+	size_t							iFirst;		//Matches ending before this are the previous chunk's
+	size_t							iBase;		//Offset of the scan in the buffer
+
+	bool Report(const CMatcher::Match& rMatch)
+	{
+		//Not ours
+		if (rMatch.iEndPosition<iFirst)
+			return true;
+
+		//Keep it
+		CMatcher::Match aMatch;
+		aMatch=rMatch;
+		aMatch.iFoundPosition+=iBase;
+		aMatch.iEndPosition+=iBase;
+		pMatches->push_back(aMatch);
+		return true;
+	}
+} ChunkPolicy;
+
+//Orders DFA states by how often the profile visited them, the most visited first
+typedef struct _VisitOrder {
+	const std::vector<unsigned long long>*	pVisits;
+
+	bool operator()(unsigned int uiState,
+					unsigned int uiOther)const
+	{
+		return (*pVisits)[uiState]>(*pVisits)[uiOther];
+	}
+} VisitOrder;
+
+//Number of cores we can run on
+static unsigned int GetCoreCount()
+{
+	long lCores;
+	lCores=sysconf(_SC_NPROCESSORS_ONLN);
+	return lCores>1?(unsigned int)lCores:1;
+}
+
+//Run a build function on every worker and wait for them, the first one runs on the caller
+//(and so do the ones we can't start a thread for)
+static void RunBuildWorkers(void* (*pFunction)(void*),
+							std::vector<BuildWorker>& rWorkers)
+{
+	//Start them
+	std::vector<pthread_t> aThreads(rWorkers.size());
+	std::vector<bool> aStarted(rWorkers.size(),false);
+	for (size_t iWorker=1; iWorker<rWorkers.size(); ++iWorker)
+		aStarted[iWorker]=!pthread_create(&aThreads[iWorker],NULL,pFunction,&rWorkers[iWorker]);
+
+	//Our share
+	pFunction(&rWorkers[0]);
+
+	//Wait for them
+	for (size_t iWorker=1; iWorker<rWorkers.size(); ++iWorker)
+		if (aStarted[iWorker])
+			pthread_join(aThreads[iWorker],NULL);
+		else
+			pFunction(&rWorkers[iWorker]);
+}
 
-int CSuffixTrie::string_id = 0;
+const unsigned int CSuffixTrie::DFA_FINAL;
+const unsigned int CSuffixTrie::DFA_DEEP;
+const unsigned int CSuffixTrie::DFA_STATE;
+const unsigned int CSuffixTrie::COMPACT_SORTED_MAX;
+const unsigned int CSuffixTrie::IMAGE_VERSION;
+const unsigned int CSuffixTrie::BATCH_LANES;
+const unsigned int CSuffixTrie::PARALLEL_MIN_NODES;
+const unsigned int CSuffixTrie::PARALLEL_MIN_CHUNK;
+const unsigned int CSuffixTrie::PREFIX_MAX;
+const unsigned int CSuffixTrie::PREFIX_VECTOR;
 
 CSuffixTrie::CSuffixTrie()
 {
+	//Nothing is mapped
+	m_pImage=NULL;
+	m_iImageSize=0;
+
+	//Case matters
+	SetNoCase(false);
+
+	//One thread builds
+	m_uiBuildThreads=1;
+
 	//Init the root node
-	m_aRoot.pFailureNode=NULL;
-	m_aRoot.aChar=0;
-	m_aRoot.bFinal=false;
-	m_aRoot.usDepth=0;
+	Clear();
+
+	//Nothing was built yet
+	m_dBuildTime=0;
 }
 
 CSuffixTrie::CSuffixTrie(const CSuffixTrie& rTrie)
 {
+	//Nothing is mapped
+	m_pImage=NULL;
+	m_iImageSize=0;
+
 	//Clone to here
 	rTrie.CloneTrie(*this);
 }
 
 CSuffixTrie::~CSuffixTrie()
 {
-	//Delete the tree
-	Clear();
+	//Release the image
+	UnmapImage();
 }
 
 void CSuffixTrie::Clear()
 {
-	DeleteNode(&m_aRoot);
+	//Drop the arena, keep only the root
+	m_aNodes.clear();
+	m_aFreeNodes.clear();
+	m_aFailureLists.clear();
+	memset(m_aRootChildren,0,sizeof(m_aRootChildren));
+	m_bIndexed=false;
+
+	//Init the root node
+	Node aRoot;
+	aRoot.aChar=0;
+	aRoot.bFinal=0;
+	aRoot.uiChild=0;
+	aRoot.uiNext=0;
+	aRoot.uiFailure=0;
+	aRoot.uiOutput=0;
+	aRoot.uiParent=0;
+	aRoot.uiFailPrev=0;
+	aRoot.uiFailNext=0;
+	aRoot.usDepth=0;
+	m_aNodes.push_back(aRoot);
+
+	//No rules (ids start over)
+	m_aWordRules.assign(1,RuleVector());
+	m_aFreeWordRules.clear();
+	m_iRuleId=0;
+
+	//The compiled forms are gone too
+	ClearCompiled();
+}
+
+bool CSuffixTrie::SetNoCase(bool bNoCase)
+{
+	//Too late, the strings are in
+	if (m_pImage || (!m_aNodes.empty() && m_aNodes[0].uiChild))
+		return false;
+
+	//Upper case is matched as lower case
+	m_bNoCase=bNoCase;
+	for (unsigned int uiByte=0; uiByte<256; ++uiByte)
+		m_aFold[uiByte]=bNoCase && uiByte>='A' && uiByte<='Z'?uiByte-'A'+'a':uiByte;
+
+	//Done
+	return true;
+}
+
+bool CSuffixTrie::GetNoCase()const
+{
+	return m_bNoCase;
+}
+
+bool CSuffixTrie::IsCompiled()const
+{
+	return m_bIndexed ||
+		   m_pDFA ||
+		   !m_aCompact.empty();
+}
+
+void CSuffixTrie::ClearCompiled()
+{
+	//The DFA (and the rule lists of both forms)
+	m_aDFA.clear();
+	m_aDFAVisits.clear();
+	m_uiDFAClasses=0;
+	m_aRules.clear();
+	m_sReason.clear();
+	UnmapImage();
+	SetDFATables();
+
+	//And the compact encoding
+	m_aCompact.clear();
+	m_aCompactLabels.clear();
+	m_aCompactChildren.clear();
+	m_aCompactBitmaps.clear();
+
+	//The prefilter is rebuilt with them
+	ClearPrefilter();
+}
+
+void CSuffixTrie::BuildRuleLists(std::vector<unsigned int>& rLists)
+{
+	//No word has a list yet
+	rLists.assign(m_aWordRules.size(),0);
+
+	//A mapped image keeps its lists (it has no words anyway)
+	if (m_pImage)
+		return;
+
+	//Where each list is
+	RuleListMap aLists;
+
+	//Index 0 is no list
+	m_aRules.assign(1,0);
+
+	for (size_t iWord=1; iWord<m_aWordRules.size(); ++iWord)
+	{
+		//A free slot
+		const RuleVector& rRules=m_aWordRules[iWord];
+		if (rRules.empty())
+			continue;
+
+		//Do we have it?
+		RuleListMap::const_iterator aIterator;
+		aIterator=aLists.find(rRules);
+		if (aIterator!=aLists.end())
+		{
+			rLists[iWord]=aIterator->second;
+			continue;
+		}
+
+		//Add it, the count and then the ids
+		rLists[iWord]=m_aRules.size();
+		aLists[rRules]=m_aRules.size();
+		m_aRules.push_back(rRules.size());
+		m_aRules.insert(m_aRules.end(),rRules.begin(),rRules.end());
+	}
+
+	//The searches use them
+	m_pRules=&m_aRules[0];
+	m_iRules=m_aRules.size();
 }
 
 CSuffixTrie& CSuffixTrie::operator=(const CSuffixTrie& rTrie)
@@ -43,432 +451,3140 @@ CSuffixTrie& CSuffixTrie::operator=(const CSuffixTrie& rTrie)
 
 void CSuffixTrie::CloneTrie(CSuffixTrie& rTarget)const
 {
-	//First delete the other trie
-	rTarget.Clear();
+	//The nodes link by index, so the arena is copied as is (no need to renormalize)
+	rTarget.m_aNodes=m_aNodes;
+	rTarget.m_aFreeNodes=m_aFreeNodes;
+	rTarget.m_aFailureLists=m_aFailureLists;
+	memcpy(rTarget.m_aRootChildren,m_aRootChildren,sizeof(m_aRootChildren));
+	rTarget.m_bIndexed=m_bIndexed;
+	rTarget.m_bNoCase=m_bNoCase;
+	memcpy(rTarget.m_aFold,m_aFold,sizeof(m_aFold));
+
+	//The rules (the lists from the tables, we may be an image)
+	rTarget.m_aWordRules=m_aWordRules;
+	rTarget.m_aFreeWordRules=m_aFreeWordRules;
+	rTarget.m_aRules.assign(m_pRules,m_pRules+m_iRules);
+	rTarget.m_iRuleId=m_iRuleId;
+
+	//Copy the DFA (from the tables, we may be an image)
+	rTarget.UnmapImage();
+	rTarget.m_uiDFAClasses=m_uiDFAClasses;
+	memcpy(rTarget.m_aDFAClasses,m_aDFAClasses,sizeof(m_aDFAClasses));
+	rTarget.m_aDFA.assign(m_pDFA,m_pDFA+m_iDFAStates*(m_uiDFAClasses+dcCount));
+	rTarget.m_aDFAVisits=m_aDFAVisits;
+	rTarget.SetDFATables();
+
+	//Same for the compact encoding
+	rTarget.m_aCompact=m_aCompact;
+	rTarget.m_aCompactLabels=m_aCompactLabels;
+	rTarget.m_aCompactChildren=m_aCompactChildren;
+	rTarget.m_aCompactBitmaps=m_aCompactBitmaps;
+
+	//And the prefilter
+	rTarget.m_uiPrefixLength=m_uiPrefixLength;
+	memcpy(rTarget.m_aPrefixLow,m_aPrefixLow,sizeof(m_aPrefixLow));
+	memcpy(rTarget.m_aPrefixHigh,m_aPrefixHigh,sizeof(m_aPrefixHigh));
+	memcpy(rTarget.m_aPrefixBytes,m_aPrefixBytes,sizeof(m_aPrefixBytes));
+	rTarget.m_aPrefixHash=m_aPrefixHash;
+
+	//And the stats
+	rTarget.m_dBuildTime=m_dBuildTime;
+	rTarget.m_sReason=m_sReason;
+	rTarget.m_uiBuildThreads=m_uiBuildThreads;
+}
+
+int CSuffixTrie::AddString(const SearchString& rString,
+						   int iRuleId)
+{
+	//Sanity check
+	if (iRuleId<0)
+		return 0;
 
-	//Do a clone
-	Node* pClone;
-	pClone=CloneNode(&m_aRoot);
+	//Our rule id, the next one if we don't have it (ids start at 1, 0 is not final)
+	if (!iRuleId)
+		iRuleId=m_iRuleId+1;
+	m_iRuleId=std::max(m_iRuleId,iRuleId);
 
-	//Save it
-	rTarget.m_aRoot=*pClone;
+	//An empty string is no word, but it used up its id (the ids stay the ones of the rules)
+	if (rString.empty())
+		return 0;
+
+	//The compiled forms don't have it, the node walk takes over until they are rebuilt
+	if (IsCompiled())
+		ClearCompiled();
+
+	//Walk down, building the nodes we don't have
+	NodeIndex uiNode;
+	uiNode=0;
+
+	for (size_t iCount=0;
+		 iCount<rString.length();
+		 ++iCount)
+	{
+		//Look for the next node
+		NodeIndex uiChild;
+		uiChild=FindChild(uiNode,rString[iCount]);
+
+		//Do we have it?
+		if (!uiChild)
+		{
+			//Need to build this node
+			uiChild=AddChild(uiNode,rString[iCount]);
+
+			//Keep the index normalized
+			if (m_bIndexed)
+				IndexNewNode(uiChild);
+		}
+
+		//Next level
+		uiNode=uiChild;
+	}
+
+	//Is it a new word? then the nodes that fail into us report it
+	if (m_bIndexed &&
+		!m_aNodes[uiNode].bFinal)
+		ReplaceOutput(uiNode,
+					  m_aNodes[uiNode].uiOutput,
+					  uiNode);
 
-	//Renormalize it
-	rTarget.BuildTreeIndex();
+	//Set as last, a new word takes a free slot for its rules
+	if (!m_aNodes[uiNode].bFinal && m_aFreeWordRules.empty())
+	{
+		m_aNodes[uiNode].bFinal=m_aWordRules.size();
+		m_aWordRules.push_back(RuleVector());
+	}
+	else if (!m_aNodes[uiNode].bFinal)
+	{
+		m_aNodes[uiNode].bFinal=m_aFreeWordRules.back();
+		m_aFreeWordRules.pop_back();
+	}
 
-	//And delete that node
-	delete pClone;
+	//Add the rule (once)
+	RuleVector& rRules=m_aWordRules[m_aNodes[uiNode].bFinal];
+	RuleVector::iterator aIterator;
+	aIterator=std::lower_bound(rRules.begin(),rRules.end(),iRuleId);
+	if (aIterator==rRules.end() || *aIterator!=iRuleId)
+		rRules.insert(aIterator,iRuleId);
+
+	//Done
+	return iRuleId;
 }
 
-void CSuffixTrie::AddString(const SearchString& rString)
+void CSuffixTrie::AddStrings(const StringsVector& rStrings,
+							 std::vector<int>* pRuleIds)
 {
-	//Add the string
-	AddString(rString, &m_aRoot);
-    
-    CSuffixTrie::string_id++;
-}
+	//How many of us
+	unsigned int uiThreads;
+	uiThreads=GetThreadCount();
 
-void CSuffixTrie::AddString(const SearchString& rString, Node* pNode) {
-	//Sanity check
-	if (!pNode || rString.empty())
+	//One at a time, unless we have threads and the trie is empty (the shards can't share our nodes)
+	if (uiThreads<2 || m_aNodes.size()>1 || IsCompiled())
+	{
+		for (size_t iString=0;
+			 iString<rStrings.size();
+			 ++iString)
+		{
+			int iRuleId;
+			iRuleId=AddString(rStrings[iString]);
+			if (pRuleIds)
+				pRuleIds->push_back(iRuleId);
+		}
+
+		//Done
 		return;
+	}
 
-	//The char we are looking for
-	SearchChar aChar;
-	aChar = rString[0];
+	//Our job
+	InsertJob aJob;
+	aJob.pTrie=this;
+	aJob.pStrings=&rStrings;
 
-	// Look for the next node
-	SearchMap::iterator aIterator;
-	aIterator = pNode->aMap.find(aChar); // verilen string'in ilk char'ini ariyoruz
-    // std::map::find => Searches the container for an element with x as key and returns an iterator to it if found, otherwise it returns an iterator to map::end (the element past the end of the container).
-	
-    //Our node
-	Node* pNewNode;
+	//The ids go in order, like one at a time, and so does the load of each leading byte
+	size_t aLoad[256];
+	memset(aLoad,0,sizeof(aLoad));
 
-	//Do we have it?
-	if (aIterator == pNode->aMap.end()) // nope.
+	aJob.aRuleIds.assign(rStrings.size(),0);
+	for (size_t iString=0;
+		 iString<rStrings.size();
+		 ++iString)
 	{
-		// Need to build this node
-		pNewNode = new Node;                    // WHY new ??
+		//An empty string uses up its id too
+		int iRuleId;
+		iRuleId=++m_iRuleId;
+
+		if (!rStrings[iString].empty())
+		{
+			aJob.aRuleIds[iString]=iRuleId;
+			aLoad[m_aFold[(unsigned char)rStrings[iString][0]]]+=rStrings[iString].length();
+		}
+	}
+
+	//The caller gets them now
+	if (pRuleIds)
+		pRuleIds->insert(pRuleIds->end(),aJob.aRuleIds.begin(),aJob.aRuleIds.end());
+
+	//No more threads than leading bytes
+	uiThreads=std::min(uiThreads,(unsigned int)(256-std::count(aLoad,aLoad+256,0)));
+	if (!uiThreads)
+		return;
 
-		//Reset it
-		pNewNode->pFailureNode = NULL;
-		pNewNode->aChar = aChar;
-		pNewNode->usDepth = (pNode->usDepth)+1;
-		pNewNode->bFinal = 0;
+	//The heaviest bytes first, each to the thread with the least load so far
+	std::vector<std::pair<size_t,unsigned int> > aBytes;
+	for (unsigned int uiByte=0; uiByte<256; ++uiByte)
+		aBytes.push_back(std::make_pair(aLoad[uiByte],uiByte));
+	std::sort(aBytes.rbegin(),aBytes.rend());
 
-		//Add it
-		pNode->aMap.insert(SearchMap::value_type(aChar,pNewNode));
+	std::vector<size_t> aThreadLoad(uiThreads,0);
+	for (size_t iByte=0; iByte<aBytes.size(); ++iByte)
+	{
+		unsigned int uiThread;
+		uiThread=std::min_element(aThreadLoad.begin(),aThreadLoad.end())-aThreadLoad.begin();
+		aJob.aShards[aBytes[iByte].second]=uiThread;
+		aThreadLoad[uiThread]+=aBytes[iByte].first;
 	}
-	else
-		//Take the node
-		pNewNode = aIterator->second;
 
-	//Is it the last char?
-	if (rString.length()==1)
-		//Set as last
-		pNewNode->bFinal = CSuffixTrie::string_id;
-	else
-		//Run next layer
-                                                // GODDAMN RECURSIVE
-		AddString(rString.substr(1,rString.length()-1), pNewNode);
+	//Our workers
+	std::vector<BuildWorker> aWorkers(uiThreads);
+	for (unsigned int uiThread=0; uiThread<uiThreads; ++uiThread)
+	{
+		aWorkers[uiThread].pJob=&aJob;
+		aWorkers[uiThread].uiThread=uiThread;
+		aWorkers[uiThread].uiThreads=uiThreads;
+	}
+
+	//Each shard into a trie of its own, counting what every string adds
+	aJob.ePhase=bpInsert;
+	aJob.aTries.assign(uiThreads,(CSuffixTrie*)NULL);
+	aJob.aNewNodes.assign(rStrings.size(),0);
+	aJob.aNewWords.assign(rStrings.size(),0);
+	RunBuildWorkers(InsertThread,aWorkers);
+
+	//One at a time every string appends its new nodes (and its word), so that is where they go
+	aJob.aNodeBase.assign(rStrings.size(),0);
+	aJob.aWordBase.assign(rStrings.size(),0);
+
+	size_t iNodes;
+	iNodes=m_aNodes.size();
+
+	size_t iWords;
+	iWords=m_aWordRules.size();
+
+	for (size_t iString=0;
+		 iString<rStrings.size();
+		 ++iString)
+	{
+		aJob.aNodeBase[iString]=iNodes;
+		iNodes+=aJob.aNewNodes[iString];
+
+		if (aJob.aNewWords[iString])
+			aJob.aWordBase[iString]=iWords++;
+	}
+
+	m_aNodes.resize(iNodes);
+	m_aWordRules.resize(iWords);
+
+	//Move them there
+	aJob.ePhase=bpMove;
+	RunBuildWorkers(InsertThread,aWorkers);
+
+	//The children of the root come from all the shards, link them in order
+	NodeIndex uiPrev;
+	uiPrev=0;
+
+	for (unsigned int uiByte=0; uiByte<256; ++uiByte)
+	{
+		//Do we have it?
+		NodeIndex uiChild;
+		uiChild=m_aRootChildren[uiByte];
+		if (!uiChild)
+			continue;
+
+		//Link it
+		if (uiPrev)
+			m_aNodes[uiPrev].uiNext=uiChild;
+		else
+			m_aNodes[0].uiChild=uiChild;
+		m_aNodes[uiChild].uiNext=0;
+		uiPrev=uiChild;
+	}
 }
 
-void CSuffixTrie::DeleteNode(Node* pNode)const
+void* CSuffixTrie::InsertThread(void* pContext)
 {
-	//Make sure we have it
-	if (!pNode)
-		return;
+	//Our job
+	BuildWorker* pWorker;
+	pWorker=(BuildWorker*)pContext;
 
-	//Iterate all its children
-	for (SearchMap::iterator aIterator=pNode->aMap.begin();
-		 aIterator!=pNode->aMap.end();
+	InsertJob* pJob;
+	pJob=(InsertJob*)pWorker->pJob;
+
+	//Our strings are the ones of our leading bytes
+	const StringsVector& rStrings=*pJob->pStrings;
+	const CSuffixTrie& rTrie=*pJob->pTrie;
+
+	if (pJob->ePhase==bpInsert)
+	{
+		//Our trie, it folds like the real one
+		CSuffixTrie* pShard;
+		pShard=new CSuffixTrie;
+		pShard->SetNoCase(rTrie.m_bNoCase);
+		pJob->aTries[pWorker->uiThread]=pShard;
+
+		for (size_t iString=0;
+			 iString<rStrings.size();
+			 ++iString)
+		{
+			//Is it ours?
+			if (rStrings[iString].empty() ||
+				pJob->aShards[rTrie.m_aFold[(unsigned char)rStrings[iString][0]]]!=pWorker->uiThread)
+				continue;
+
+			//Add it, and see what it took
+			size_t iNodes;
+			iNodes=pShard->m_aNodes.size();
+
+			size_t iWords;
+			iWords=pShard->m_aWordRules.size();
+
+			pShard->AddString(rStrings[iString],pJob->aRuleIds[iString]);
+			pJob->aNewNodes[iString]=pShard->m_aNodes.size()-iNodes;
+			pJob->aNewWords[iString]=pShard->m_aWordRules.size()>iWords;
+		}
+
+		//Done
+		return NULL;
+	}
+
+	//Where each node and word of our trie goes (the roots are the same)
+	CSuffixTrie* pShard;
+	pShard=pJob->aTries[pWorker->uiThread];
+
+	std::vector<NodeIndex> aNodes(pShard->m_aNodes.size(),0);
+	std::vector<int> aWords(pShard->m_aWordRules.size(),0);
+
+	NodeIndex uiNode;
+	uiNode=1;
+
+	int iWord;
+	iWord=1;
+
+	for (size_t iString=0;
+		 iString<rStrings.size();
+		 ++iString)
+	{
+		//Is it ours?
+		if (rStrings[iString].empty() ||
+			pJob->aShards[rTrie.m_aFold[(unsigned char)rStrings[iString][0]]]!=pWorker->uiThread)
+			continue;
+
+		//Its nodes are in the same order in both
+		for (unsigned int uiCount=0; uiCount<pJob->aNewNodes[iString]; ++uiCount)
+			aNodes[uiNode++]=pJob->aNodeBase[iString]+uiCount;
+
+		if (pJob->aNewWords[iString])
+			aWords[iWord++]=pJob->aWordBase[iString];
+	}
+
+	//Move them, with their links
+	CSuffixTrie& rTarget=*pJob->pTrie;
+	for (NodeIndex uiCount=1; uiCount<pShard->m_aNodes.size(); ++uiCount)
+	{
+		Node aNode;
+		aNode=pShard->m_aNodes[uiCount];
+		aNode.uiChild=aNodes[aNode.uiChild];
+		aNode.uiNext=aNodes[aNode.uiNext];
+		aNode.uiParent=aNodes[aNode.uiParent];
+		aNode.bFinal=aWords[aNode.bFinal];
+		rTarget.m_aNodes[aNodes[uiCount]]=aNode;
+	}
+
+	for (size_t iCount=1; iCount<pShard->m_aWordRules.size(); ++iCount)
+		rTarget.m_aWordRules[aWords[iCount]].swap(pShard->m_aWordRules[iCount]);
+
+	//And our children of the root
+	for (unsigned int uiByte=0; uiByte<256; ++uiByte)
+		if (pShard->m_aRootChildren[uiByte])
+			rTarget.m_aRootChildren[uiByte]=aNodes[pShard->m_aRootChildren[uiByte]];
+
+	//Done with it
+	delete pShard;
+	return NULL;
+}
+
+void CSuffixTrie::IndexNewNode(NodeIndex uiNode)
+{
+	//Our node
+	Node& rNode=m_aNodes[uiNode];
+
+	//Where do we fail to?
+	NodeIndex uiFailure;
+	uiFailure=FindFailure(rNode.uiParent,rNode.aChar);
+
+	//Save it
+	rNode.uiFailure=uiFailure;
+	rNode.uiOutput=m_aNodes[uiFailure].bFinal?uiFailure:m_aNodes[uiFailure].uiOutput;
+
+	//Nodes with our char that failed to the same node, and that end with our string, now fail to us
+	//(they can't fail deeper, that node was the longest suffix they had)
+	std::vector<NodeIndex> aMove;
+
+	//Below the first level they also share our parent char
+	FailureMap::const_iterator aIterator;
+	FailureMap::const_iterator aEnd;
+	if (rNode.usDepth>1)
+	{
+		aIterator=m_aFailureLists.find(FailureKey(uiFailure,rNode.aChar,m_aNodes[rNode.uiParent].aChar));
+		aEnd=aIterator;
+		if (aEnd!=m_aFailureLists.end())
+			++aEnd;
+	}
+	else
+	{
+		aIterator=m_aFailureLists.lower_bound(FailureKey(uiFailure,rNode.aChar,0));
+		aEnd=m_aFailureLists.upper_bound(FailureKey(uiFailure,rNode.aChar,(SearchChar)0xff));
+	}
+
+	for (;
+		 aIterator!=aEnd;
 		 ++aIterator)
+		for (NodeIndex uiOther=aIterator->second;
+			 uiOther;
+			 uiOther=m_aNodes[uiOther].uiFailNext)
+			if (EndsWith(uiOther,uiNode))
+				aMove.push_back(uiOther);
+
+	//Move them (their output stays, it was ours already)
+	for (size_t iCount=0;
+		 iCount<aMove.size();
+		 ++iCount)
 	{
-		//Send it to deletion
-		DeleteNode(aIterator->second);
+		UnlinkFailure(aMove[iCount]);
+		m_aNodes[aMove[iCount]].uiFailure=uiNode;
+		LinkFailure(aMove[iCount]);
+	}
+
+	//Add ourselves to the list
+	LinkFailure(uiNode);
+}
 
-		//We can assume all the children have been deleted, then delete it
-		delete aIterator->second;
+bool CSuffixTrie::EndsWith(NodeIndex uiNode,
+						   NodeIndex uiSuffix)const
+{
+	//Compare the chars going up
+	while (uiSuffix)
+	{
+		//Too short or different
+		if (!uiNode ||
+			m_aNodes[uiNode].aChar!=m_aNodes[uiSuffix].aChar)
+			return false;
+
+		//Up one level
+		uiNode=m_aNodes[uiNode].uiParent;
+		uiSuffix=m_aNodes[uiSuffix].uiParent;
 	}
+
+	//All matched
+	return true;
 }
 
-void CSuffixTrie::BuildTreeIndex() {
-	//Build index on the root
-	BuildIndex("", &m_aRoot);
+void CSuffixTrie::ReplaceOutput(NodeIndex uiNode,
+								NodeIndex uiOld,
+								NodeIndex uiNew)
+{
+	//Walk the nodes that fail into us, a final node hides whatever is below it
+	std::vector<NodeIndex> aStack;
+	aStack.push_back(uiNode);
+
+	while (!aStack.empty())
+	{
+		//Take the node
+		NodeIndex uiFailure;
+		uiFailure=aStack.back();
+		aStack.pop_back();
+
+		//All the lists of nodes that fail to it
+		for (FailureMap::const_iterator aIterator=m_aFailureLists.lower_bound(FailureKey(uiFailure,0,0));
+			 aIterator!=m_aFailureLists.end() && aIterator->first<FailureKey(uiFailure+1,0,0);
+			 ++aIterator)
+			for (NodeIndex uiChild=aIterator->second;
+				 uiChild;
+				 uiChild=m_aNodes[uiChild].uiFailNext)
+			{
+				//Replace it
+				if (m_aNodes[uiChild].uiOutput==uiOld)
+					m_aNodes[uiChild].uiOutput=uiNew;
+
+				//Go deeper if we are still its closest word
+				if (!m_aNodes[uiChild].bFinal)
+					aStack.push_back(uiChild);
+			}
+	}
 }
 
-CSuffixTrie::Node* CSuffixTrie::SearchNode(const SearchString& rString,
-										   Node* pNode)
+void CSuffixTrie::LinkFailure(NodeIndex uiNode)
 {
-	//Sanity check
-	if (!pNode || rString.empty())
-		return NULL;
+	LinkFailure(uiNode,m_aFailureLists);
+}
+
+void CSuffixTrie::LinkFailure(NodeIndex uiNode,
+							  FailureMap& rLists)
+{
+	//Our list
+	NodeIndex& rHead=rLists[FailureKey(uiNode)];
+
+	//Put us first
+	m_aNodes[uiNode].uiFailPrev=0;
+	m_aNodes[uiNode].uiFailNext=rHead;
+	if (rHead)
+		m_aNodes[rHead].uiFailPrev=uiNode;
+	rHead=uiNode;
+}
 
-	//The char we are looking for
-	SearchChar aChar;
-	aChar=rString[0];
+void CSuffixTrie::UnlinkFailure(NodeIndex uiNode)
+{
+	//Our node
+	Node& rNode=m_aNodes[uiNode];
 
-	//Look for the next node
-	SearchMap::iterator aIterator;
-	aIterator=pNode->aMap.find(aChar);
+	//Fix the next one
+	if (rNode.uiFailNext)
+		m_aNodes[rNode.uiFailNext].uiFailPrev=rNode.uiFailPrev;
 
-	//Do we have it?
-	if (aIterator!=pNode->aMap.end()) {
-		//Is it the last char?
-		if (rString.length()==1)
-			//We found our string
-			return aIterator->second;
+	//Fix the previous one (or the head)
+	if (rNode.uiFailPrev)
+		m_aNodes[rNode.uiFailPrev].uiFailNext=rNode.uiFailNext;
+	else
+	{
+		//We are the head
+		FailureMap::iterator aIterator;
+		aIterator=m_aFailureLists.find(FailureKey(uiNode));
+
+		if (rNode.uiFailNext)
+			aIterator->second=rNode.uiFailNext;
 		else
-			//Search again
-			return SearchNode(rString.substr(1,rString.length()-1),
-							  aIterator->second);
+			m_aFailureLists.erase(aIterator);
+	}
+
+	//Reset us
+	rNode.uiFailPrev=0;
+	rNode.uiFailNext=0;
+}
+
+unsigned long long CSuffixTrie::FailureKey(NodeIndex uiFailure,
+										   SearchChar aChar,
+										   SearchChar aParentChar)
+{
+	return ((unsigned long long)uiFailure<<16)|((unsigned char)aChar<<8)|(unsigned char)aParentChar;
+}
+
+unsigned long long CSuffixTrie::FailureKey(NodeIndex uiNode)const
+{
+	return FailureKey(m_aNodes[uiNode].uiFailure,
+					  m_aNodes[uiNode].aChar,
+					  m_aNodes[m_aNodes[uiNode].uiParent].aChar);
+}
+
+CSuffixTrie::NodeIndex CSuffixTrie::FindChild(NodeIndex uiNode,
+											  SearchChar aChar)const
+{
+	//The nodes have the folded chars
+	aChar=(SearchChar)m_aFold[(unsigned char)aChar];
+
+	//The root has a direct table
+	if (!uiNode)
+		return m_aRootChildren[(unsigned char)aChar];
+
+	//Walk the children, they are sorted
+	for (NodeIndex uiChild=m_aNodes[uiNode].uiChild;
+		 uiChild;
+		 uiChild=m_aNodes[uiChild].uiNext)
+		if (m_aNodes[uiChild].aChar==aChar)
+			return uiChild;
+		else if ((unsigned char)m_aNodes[uiChild].aChar>(unsigned char)aChar)
+			break;
+
+	//Not found
+	return 0;
+}
+
+CSuffixTrie::NodeIndex CSuffixTrie::AddChild(NodeIndex uiNode,
+											 SearchChar aChar)
+{
+	//We keep the folded char
+	aChar=(SearchChar)m_aFold[(unsigned char)aChar];
+
+	//Our new node
+	Node aNewNode;
+	aNewNode.aChar=aChar;
+	aNewNode.bFinal=0;
+	aNewNode.uiChild=0;
+	aNewNode.uiNext=0;
+	aNewNode.uiFailure=0;
+	aNewNode.uiOutput=0;
+	aNewNode.uiParent=uiNode;
+	aNewNode.uiFailPrev=0;
+	aNewNode.uiFailNext=0;
+	aNewNode.usDepth=m_aNodes[uiNode].usDepth+1;
+
+	//Reuse a deleted node if we have one
+	NodeIndex uiNewNode;
+	if (!m_aFreeNodes.empty())
+	{
+		uiNewNode=m_aFreeNodes.back();
+		m_aFreeNodes.pop_back();
+		m_aNodes[uiNewNode]=aNewNode;
 	}
 	else
-		//Not found
-		return NULL;
+	{
+		uiNewNode=m_aNodes.size();
+		m_aNodes.push_back(aNewNode);
+	}
+
+	//Find our place among the siblings (sorted by char)
+	NodeIndex uiPrev;
+	uiPrev=0;
+
+	NodeIndex uiNext;
+	uiNext=m_aNodes[uiNode].uiChild;
+
+	while (uiNext &&
+		   (unsigned char)m_aNodes[uiNext].aChar<(unsigned char)aChar)
+	{
+		uiPrev=uiNext;
+		uiNext=m_aNodes[uiNext].uiNext;
+	}
+
+	//Link it
+	m_aNodes[uiNewNode].uiNext=uiNext;
+	if (uiPrev)
+		m_aNodes[uiPrev].uiNext=uiNewNode;
+	else
+		m_aNodes[uiNode].uiChild=uiNewNode;
+
+	//Keep the root table
+	if (!uiNode)
+		m_aRootChildren[(unsigned char)aChar]=uiNewNode;
+
+	//Done
+	return uiNewNode;
+}
+
+void CSuffixTrie::RemoveChild(NodeIndex uiNode,
+							  NodeIndex uiChild)
+{
+	//Find it among the siblings
+	NodeIndex uiPrev;
+	uiPrev=0;
+
+	NodeIndex uiNext;
+	uiNext=m_aNodes[uiNode].uiChild;
+
+	while (uiNext &&
+		   uiNext!=uiChild)
+	{
+		uiPrev=uiNext;
+		uiNext=m_aNodes[uiNext].uiNext;
+	}
+
+	//Did we get it?
+	if (!uiNext)
+		return;
+
+	//Unlink it
+	if (uiPrev)
+		m_aNodes[uiPrev].uiNext=m_aNodes[uiChild].uiNext;
+	else
+		m_aNodes[uiNode].uiChild=m_aNodes[uiChild].uiNext;
+
+	//Keep the root table
+	if (!uiNode)
+		m_aRootChildren[(unsigned char)m_aNodes[uiChild].aChar]=0;
+
+	//It can be reused
+	m_aFreeNodes.push_back(uiChild);
+}
+
+void CSuffixTrie::BuildTreeIndex() {
+	//Time the build
+	double dStart;
+	dStart=GetTimeMS();
+
+	//Link the nodes, with many threads if we may
+	unsigned int uiThreads;
+	uiThreads=GetThreadCount();
+	if (uiThreads>1)
+		BuildLinksParallel(uiThreads);
+	else
+		BuildLinks();
+
+	//From now on we keep it normalized
+	m_bIndexed=true;
+
+	//The searches can skip now
+	BuildPrefilter();
+
+	//Done
+	m_dBuildTime=GetTimeMS()-dStart;
+}
+
+void CSuffixTrie::BuildLinks()
+{
+	//We go breadth first, so the failure node of our parent is always ready
+	std::deque<NodeIndex> aQueue;
+
+	//The lists of who fails where are rebuilt as we go
+	m_aFailureLists.clear();
+
+	//The root and its children fail to the root
+	m_aNodes[0].uiFailure=0;
+	m_aNodes[0].uiOutput=0;
+	for (NodeIndex uiChild=m_aNodes[0].uiChild;
+		 uiChild;
+		 uiChild=m_aNodes[uiChild].uiNext)
+	{
+		m_aNodes[uiChild].uiFailure=0;
+		m_aNodes[uiChild].uiOutput=0;
+		LinkFailure(uiChild);
+		aQueue.push_back(uiChild);
+	}
+
+	while (!aQueue.empty())
+	{
+		//Take the node
+		NodeIndex uiNode;
+		uiNode=aQueue.front();
+		aQueue.pop_front();
+
+		//Iterate all its children
+		for (NodeIndex uiChild=m_aNodes[uiNode].uiChild;
+			 uiChild;
+			 uiChild=m_aNodes[uiChild].uiNext)
+		{
+			//Save it
+			m_aNodes[uiChild].uiFailure=FindFailure(uiNode,m_aNodes[uiChild].aChar);
+
+			//The next word on the failure chain (dictionary link)
+			const Node& rFailure=m_aNodes[m_aNodes[uiChild].uiFailure];
+			m_aNodes[uiChild].uiOutput=rFailure.bFinal?m_aNodes[uiChild].uiFailure:rFailure.uiOutput;
+			LinkFailure(uiChild);
+
+			//Process it later
+			aQueue.push_back(uiChild);
+		}
+	}
+}
+
+void CSuffixTrie::BuildLinksParallel(unsigned int uiThreads)
+{
+	//Our job
+	IndexJob aJob;
+	aJob.pTrie=this;
+
+	//The root fails to itself
+	m_aNodes[0].uiFailure=0;
+	m_aNodes[0].uiOutput=0;
+
+	//The nodes breadth first (without the root), a level is a range of them
+	std::vector<size_t> aLevels(1,0);
+	aJob.aOrder.reserve(m_aNodes.size());
+
+	for (NodeIndex uiChild=m_aNodes[0].uiChild;
+		 uiChild;
+		 uiChild=m_aNodes[uiChild].uiNext)
+		aJob.aOrder.push_back(uiChild);
+
+	while (aLevels.back()<aJob.aOrder.size())
+	{
+		//The next level is the children of this one
+		size_t iStart;
+		iStart=aLevels.back();
+		aLevels.push_back(aJob.aOrder.size());
+
+		for (size_t iNode=iStart; iNode<aLevels.back(); ++iNode)
+			for (NodeIndex uiChild=m_aNodes[aJob.aOrder[iNode]].uiChild;
+				 uiChild;
+				 uiChild=m_aNodes[uiChild].uiNext)
+				aJob.aOrder.push_back(uiChild);
+	}
+
+	//Our workers, and one for the levels that are too small to share
+	std::vector<BuildWorker> aWorkers(uiThreads);
+	for (unsigned int uiThread=0; uiThread<uiThreads; ++uiThread)
+	{
+		aWorkers[uiThread].pJob=&aJob;
+		aWorkers[uiThread].uiThread=uiThread;
+		aWorkers[uiThread].uiThreads=uiThreads;
+	}
+
+	std::vector<BuildWorker> aSingle(1,aWorkers[0]);
+	aSingle[0].uiThreads=1;
+
+	//A level at a time, the failure nodes are shallower so they are linked by then
+	aJob.ePhase=bpFailure;
+	aJob.aKeys.resize(aJob.aOrder.size());
+
+	for (size_t iLevel=0; iLevel+1<aLevels.size(); ++iLevel)
+	{
+		aJob.iStart=aLevels[iLevel];
+		aJob.iEnd=aLevels[iLevel+1];
+		RunBuildWorkers(IndexThread,aJob.iEnd-aJob.iStart<PARALLEL_MIN_NODES?aSingle:aWorkers);
+	}
+
+	//The failure lists, each thread takes some of the keys
+	aJob.ePhase=bpLists;
+	aJob.aLists.resize(uiThreads);
+	RunBuildWorkers(IndexThread,aWorkers);
+
+	//Merge them, they are sorted so every key goes at the end
+	m_aFailureLists.clear();
+
+	std::vector<FailureMap::const_iterator> aNext;
+	for (unsigned int uiThread=0; uiThread<uiThreads; ++uiThread)
+		aNext.push_back(aJob.aLists[uiThread].begin());
+
+	while (1)
+	{
+		//The lowest key left
+		int iLowest;
+		iLowest=-1;
+
+		for (unsigned int uiThread=0; uiThread<uiThreads; ++uiThread)
+			if (aNext[uiThread]!=aJob.aLists[uiThread].end() &&
+				(iLowest<0 || aNext[uiThread]->first<aNext[iLowest]->first))
+				iLowest=uiThread;
+
+		//All done
+		if (iLowest<0)
+			break;
+
+		m_aFailureLists.insert(m_aFailureLists.end(),*aNext[iLowest]);
+		++aNext[iLowest];
+	}
+}
+
+void* CSuffixTrie::IndexThread(void* pContext)
+{
+	//Our job
+	BuildWorker* pWorker;
+	pWorker=(BuildWorker*)pContext;
+
+	IndexJob* pJob;
+	pJob=(IndexJob*)pWorker->pJob;
+
+	CSuffixTrie& rTrie=*pJob->pTrie;
+
+	if (pJob->ePhase==bpFailure)
+	{
+		//Our part of the level
+		size_t iStart;
+		iStart=pJob->iStart+(pJob->iEnd-pJob->iStart)*pWorker->uiThread/pWorker->uiThreads;
+
+		size_t iEnd;
+		iEnd=pJob->iStart+(pJob->iEnd-pJob->iStart)*(pWorker->uiThread+1)/pWorker->uiThreads;
+
+		for (size_t iNode=iStart; iNode<iEnd; ++iNode)
+		{
+			//Where we fail to (the children of the root fail to the root)
+			Node& rNode=rTrie.m_aNodes[pJob->aOrder[iNode]];
+			rNode.uiFailure=rTrie.FindFailure(rNode.uiParent,rNode.aChar);
+
+			//The next word on the failure chain (dictionary link)
+			const Node& rFailure=rTrie.m_aNodes[rNode.uiFailure];
+			rNode.uiOutput=rFailure.bFinal?rNode.uiFailure:rFailure.uiOutput;
+
+			//Our failure list
+			pJob->aKeys[iNode]=rTrie.FailureKey(pJob->aOrder[iNode]);
+		}
+
+		//Done
+		return NULL;
+	}
+
+	//Our keys, linked breadth first like the serial build does
+	FailureMap& rLists=pJob->aLists[pWorker->uiThread];
+	for (size_t iNode=0; iNode<pJob->aOrder.size(); ++iNode)
+		if ((unsigned int)((pJob->aKeys[iNode]*0x9E3779B97F4A7C15ULL)>>40)%pWorker->uiThreads==pWorker->uiThread)
+			rTrie.LinkFailure(pJob->aOrder[iNode],rLists);
+
+	//Done
+	return NULL;
+}
+
+CSuffixTrie::NodeIndex CSuffixTrie::FindFailure(NodeIndex uiParent,
+												SearchChar aChar)const
+{
+	//The children of the root fail to the root
+	if (!uiParent)
+		return 0;
+
+	//Walk the failure chain of our parent until someone can take this char
+	NodeIndex uiFailure;
+	uiFailure=m_aNodes[uiParent].uiFailure;
+
+	while (1)
+	{
+		//Do we have it?
+		NodeIndex uiFound;
+		uiFound=FindChild(uiFailure,aChar);
+		if (uiFound)
+			return uiFound;
+
+		//Nobody has it
+		if (!uiFailure)
+			return 0;
+
+		//Next one
+		uiFailure=m_aNodes[uiFailure].uiFailure;
+	}
+}
+
+void CSuffixTrie::SetBuildThreads(unsigned int uiThreads)
+{
+	m_uiBuildThreads=uiThreads;
+}
+
+unsigned int CSuffixTrie::GetBuildThreads()const
+{
+	return m_uiBuildThreads;
+}
+
+unsigned int CSuffixTrie::GetThreadCount()const
+{
+	//Asked for
+	if (m_uiBuildThreads)
+		return m_uiBuildThreads;
+
+	//One per core
+	return GetCoreCount();
+}
+
+double CSuffixTrie::GetBuildTime()const
+{
+	return m_dBuildTime;
+}
+
+void CSuffixTrie::Compile()
+{
+	//Time the build
+	double dStart;
+	dStart=GetTimeMS();
+
+	//Start over, the engine may not be the one we had
+	ClearCompiled();
+	BuildTreeIndex();
+
+	//Pick it
+	MatcherShape aShape;
+	aShape=GetShape();
+
+	std::string sReason;
+	MatcherEngine eEngine;
+	eEngine=SelectEngine(aShape,sReason);
+
+	//Wu-Manber is another matcher (Build makes it), we take the best of ours
+	if (eEngine==meWuManber)
+	{
+		std::string sTrieReason;
+		eEngine=SelectTrieEngine(aShape,sTrieReason);
+		sReason+=", as a trie "+sTrieReason;
+	}
+
+	if (eEngine==meDFA)
+	{
+		//The states don't fit the marks, the compact encoding has no limit
+		if (!BuildDFA())
+		{
+			eEngine=meCompact;
+			sReason+=", but the states don't fit the DFA marks";
+		}
+	}
+
+	if (eEngine==meCompact)
+		BuildCompact();
+
+	//Done
+	m_sReason=sReason;
+	m_dBuildTime=GetTimeMS()-dStart;
+}
+
+CSuffixTrie::MatcherShape CSuffixTrie::GetShape()const
+{
+	//Our shape
+	MatcherShape aShape;
+	aShape.iPatterns=0;
+	aShape.iRules=0;
+	aShape.iMinLength=0;
+	aShape.iMaxLength=0;
+	aShape.iLongPatterns=0;
+	aShape.iTotalLength=0;
+	aShape.uiAlphabet=0;
+	aShape.iStates=0;
+
+	//Which bytes the words have
+	bool aUsed[256];
+	memset(aUsed,0,sizeof(aUsed));
+
+	std::vector<NodeIndex> aStack(1,0);
+	while (!aStack.empty())
+	{
+		//Take the node
+		NodeIndex uiNode;
+		uiNode=aStack.back();
+		aStack.pop_back();
+		++aShape.iStates;
+
+		//A word ends here
+		const Node& rNode=m_aNodes[uiNode];
+		if (rNode.bFinal)
+		{
+			++aShape.iPatterns;
+			aShape.iRules+=m_aWordRules[rNode.bFinal].size();
+			aShape.iTotalLength+=rNode.usDepth;
+			aShape.iMaxLength=std::max(aShape.iMaxLength,(size_t)rNode.usDepth);
+			aShape.iMinLength=aShape.iPatterns==1?rNode.usDepth:std::min(aShape.iMinLength,(size_t)rNode.usDepth);
+			aShape.iLongPatterns+=rNode.usDepth>=LONG_PATTERN;
+		}
+
+		for (NodeIndex uiChild=rNode.uiChild;
+			 uiChild;
+			 uiChild=m_aNodes[uiChild].uiNext)
+		{
+			aUsed[(unsigned char)m_aNodes[uiChild].aChar]=true;
+			aStack.push_back(uiChild);
+		}
+	}
+
+	aShape.uiAlphabet=std::count(aUsed,aUsed+256,true);
+
+	//Done
+	return aShape;
+}
+
+CSuffixTrie::MatcherStats CSuffixTrie::GetStats()const
+{
+	//What we search with
+	MatcherStats aStats;
+	if (m_pDFA)
+		aStats.eEngine=meDFA;
+	else if (!m_aCompact.empty())
+		aStats.eEngine=meCompact;
+	else
+		aStats.eEngine=meTrie;
+
+	//And why
+	if (!m_sReason.empty())
+		aStats.sReason=m_sReason;
+	else if (aStats.eEngine==meTrie)
+		aStats.sReason="nothing was compiled";
+	else
+		aStats.sReason="built by the caller";
+
+	//The rest
+	aStats.aShape=GetShape();
+	aStats.iMemory=GetTrieSize()+
+				   (aStats.eEngine==meDFA?GetDFASize():0)+
+				   (aStats.eEngine==meCompact?GetCompactSize():0);
+	aStats.dBuildTime=m_dBuildTime;
+
+	//Done
+	return aStats;
+}
+
+CMatcher* CSuffixTrie::Clone()const
+{
+	return new CSuffixTrie(*this);
+}
+
+CSuffixTrie::NodeIndex CSuffixTrie::SearchNode(const SearchString& rString)const
+{
+	//Sanity check
+	if (rString.empty())
+		return 0;
+
+	//Walk down
+	NodeIndex uiNode;
+	uiNode=0;
+
+	for (size_t iCount=0;
+		 iCount<rString.length() && (!iCount || uiNode);
+		 ++iCount)
+		uiNode=FindChild(uiNode,rString[iCount]);
+
+	//Done (0 is not found)
+	return uiNode;
+}
+
+CSuffixTrie::DataFound CSuffixTrie::SearchAhoCorasik(const SearchString& rString)const {
+	//Our data found
+	DataFound aData;
+	aData.iFoundPosition=0;
+	aData.iEndPosition=0;
+	aData.rule_id=0;
+
+	//Only the first match is kept, we stop there
+	Match aMatch;
+	if (SearchFirst((const unsigned char*)rString.data(),
+					rString.length(),
+					aMatch))
+	{
+		//We got our data
+		aData.iFoundPosition=aMatch.iFoundPosition;
+		aData.iEndPosition=aMatch.iEndPosition;
+		aData.rule_id=aMatch.rule_id;
+		aData.sDataFound=rString.substr(aMatch.iFoundPosition,
+										aMatch.iEndPosition-aMatch.iFoundPosition+1);
+	}
+
+	//Done
+	return aData;
+}
+
+CSuffixTrie::DataFoundVector CSuffixTrie::SearchAhoCorasikMultiple(const SearchString& rString)const {
+	//Our vector of data found
+	DataFoundVector aVec;
+
+	//The current string we match
+	SearchString sMatchedString;
+
+	//Our node position
+	const Node* pNode;
+	pNode = &m_aNodes[0];
+
+	//Iterate the string
+	for (int iCount=0; iCount < rString.length(); ++iCount) {
+		//Did we switch node already
+		bool bSwitch;
+		bSwitch = false;
+
+		//Loop while we got something
+		while (1) {
+			//Look for the char
+			NodeIndex uiChild;
+			uiChild = FindChild(pNode-&m_aNodes[0], rString[iCount]);
+
+			//Do we have it?
+			if (!uiChild) {
+				//No, check if we have failure node
+				if (!pNode->uiFailure) {
+					//No failure node, start at root again
+					pNode=&m_aNodes[0];
+
+					//Reset search string
+					sMatchedString = "";
+
+					//Did we do a switch?
+					if (bSwitch)
+						//We need to do this over
+						--iCount;
+
+					//Exit this loop
+					break;
+				}
+				else {
+					//What is the depth difference?
+					unsigned short usDepth;
+					usDepth=pNode->usDepth-m_aNodes[pNode->uiFailure].usDepth-1;
+
+					//This is how many chars to remove
+					sMatchedString=sMatchedString.substr(usDepth,sMatchedString.length()-usDepth);
+
+					//Go to the failure node
+					pNode=&m_aNodes[pNode->uiFailure];
+
+					//Set to switch
+					bSwitch=true;
+				}
+			}
+            else {
+				//Add the char
+				sMatchedString += rString[iCount];
+
+				//Save the new node
+				pNode=&m_aNodes[uiChild];
+
+				//Exit the loop
+				break;
+			}
+		}
+
+		//Is this a final node?
+		if ((pNode->bFinal)>0) {
+			//We got our data, once per rule
+			const RuleVector& rRules=m_aWordRules[pNode->bFinal];
+
+			for (size_t iRule=0; iRule<rRules.size(); ++iRule) {
+				DataFound aData;
+//				aData.iFoundPosition = iCount-sMatchedString.length()+1;
+				aData.rule_id = rRules[iRule];
+				aData.sDataFound = sMatchedString;
+
+				//Insert it
+				aVec.push_back(aData);
+			}
+
+			//Go back
+			iCount-=sMatchedString.length()-1;
+
+			//Reset the data
+			sMatchedString = "";
+		}
+	}
+
+	//Done
+	return aVec;
+}
+
+CSuffixTrie::DataFoundVector CSuffixTrie::SearchAhoCorasikAll(const SearchString& rString)const
+{
+	//Our vector of data found
+	DataFoundVector aVec;
+
+	//Search it
+	FoundPolicy aPolicy;
+	aPolicy.pVector=&aVec;
+	aPolicy.pString=&rString;
+	StreamState aStream;
+	ResetStream(aStream);
+	SearchNodes(aStream,
+				(const unsigned char*)rString.data(),
+				rString.length(),
+				aPolicy);
+
+	//Done
+	return aVec;
+}
+
+template<class Policy>
+void CSuffixTrie::SearchNodes(StreamState& rStream,
+							  const unsigned char* pData,
+							  size_t iLength,
+							  Policy& rPolicy)const
+{
+	//Continue from where the stream is
+	NodeIndex uiNode;
+	uiNode=rStream.uiState;
+
+	//Where to prefilter from (never if we don't have it)
+	size_t iScanned;
+	iScanned=m_uiPrefixLength?0:iLength;
+
+	//Iterate the data, we never go back
+	for (size_t iCount=0; iCount<iLength; ++iCount)
+	{
+		//Skip the bytes no word starts at
+		if (iCount>=iScanned &&
+			SkipToCandidate(pData,iLength,m_aNodes[uiNode].usDepth,iCount,iScanned))
+		{
+			//We start over at the root
+			uiNode=0;
+			if (iCount==iLength)
+				break;
+		}
+
+		//Follow the failure nodes until we can move
+		while (1)
+		{
+			//Look for the char
+			NodeIndex uiChild;
+			uiChild=FindChild(uiNode,(SearchChar)pData[iCount]);
+
+			//Do we have it?
+			if (uiChild)
+			{
+				uiNode=uiChild;
+				break;
+			}
+
+			//At the root we stay at the root
+			if (!uiNode)
+				break;
+
+			//Go to the failure node
+			uiNode=m_aNodes[uiNode].uiFailure;
+		}
+
+		//Report us and then the dictionary chain
+		for (NodeIndex uiOutput=m_aNodes[uiNode].bFinal?uiNode:m_aNodes[uiNode].uiOutput;
+			 uiOutput;
+			 uiOutput=m_aNodes[uiOutput].uiOutput)
+		{
+			//A match per rule of the word
+			const RuleVector& rRules=m_aWordRules[m_aNodes[uiOutput].bFinal];
+
+			for (size_t iRule=0; iRule<rRules.size(); ++iRule)
+			{
+				//Our match
+				Match aMatch;
+				aMatch.rule_id=rRules[iRule];
+				aMatch.iFoundPosition=rStream.iOffset+iCount+1-m_aNodes[uiOutput].usDepth;
+				aMatch.iEndPosition=rStream.iOffset+iCount;
+
+				//Tell the policy, can stop us
+				if (!rPolicy.Report(aMatch))
+				{
+					//Save where we stopped
+					rStream.uiState=uiNode;
+					rStream.iOffset+=iCount+1;
+					return;
+				}
+			}
+		}
+	}
+
+	//Save where we are
+	rStream.uiState=uiNode;
+	rStream.iOffset+=iLength;
+}
+
+void CSuffixTrie::SearchBytes(const unsigned char* pData,
+							  size_t iLength,
+							  MatchCallback pCallback,
+							  void* pContext)const
+{
+	//A stream of one chunk
+	StreamState aStream;
+	ResetStream(aStream);
+	SearchStream(aStream,pData,iLength,pCallback,pContext);
+}
+
+size_t CSuffixTrie::SearchParallel(const unsigned char* pData,
+								  size_t iLength,
+								  std::vector<Match>& rMatches,
+								  unsigned int uiThreads)const
+{
+	//No threads for the small chunks
+	if (!uiThreads)
+		uiThreads=GetCoreCount();
+	uiThreads=(unsigned int)std::max<size_t>(1,std::min<size_t>(uiThreads,iLength/PARALLEL_MIN_CHUNK));
+
+	//Our job
+	ScanJob aJob;
+	aJob.pTrie=this;
+	aJob.pData=pData;
+	aJob.iLength=iLength;
+	aJob.aMatches.resize(uiThreads);
+
+	//A match ending in a chunk starts at most the longest word-1 bytes before it, from there on
+	//the automaton is in the state the serial scan has
+	aJob.iOverlap=uiThreads>1?std::max(GetMaxDepth(),(unsigned short)1)-1:0;
+
+	//Our workers
+	std::vector<BuildWorker> aWorkers(uiThreads);
+	for (unsigned int uiThread=0; uiThread<uiThreads; ++uiThread)
+	{
+		aWorkers[uiThread].pJob=&aJob;
+		aWorkers[uiThread].uiThread=uiThread;
+		aWorkers[uiThread].uiThreads=uiThreads;
+	}
+
+	RunBuildWorkers(ScanThread,aWorkers);
+
+	//The chunks are in order, and so are the matches of each
+	rMatches.clear();
+	for (unsigned int uiThread=0; uiThread<uiThreads; ++uiThread)
+		rMatches.insert(rMatches.end(),
+						aJob.aMatches[uiThread].begin(),
+						aJob.aMatches[uiThread].end());
+
+	//Done
+	return rMatches.size();
+}
+
+void* CSuffixTrie::ScanThread(void* pContext)
+{
+	//Our job
+	BuildWorker* pWorker;
+	pWorker=(BuildWorker*)pContext;
+
+	ScanJob* pJob;
+	pJob=(ScanJob*)pWorker->pJob;
+
+	//Our chunk
+	size_t iStart;
+	iStart=pJob->iLength*pWorker->uiThread/pWorker->uiThreads;
+
+	size_t iEnd;
+	iEnd=pJob->iLength*(pWorker->uiThread+1)/pWorker->uiThreads;
+
+	//We scan from the overlap before it
+	size_t iScan;
+	iScan=iStart>pJob->iOverlap?iStart-pJob->iOverlap:0;
+
+	ChunkPolicy aPolicy;
+	aPolicy.pMatches=&pJob->aMatches[pWorker->uiThread];
+	aPolicy.iFirst=iStart-iScan;
+	aPolicy.iBase=iScan;
+
+	StreamState aStream;
+	ResetStream(aStream);
+	pJob->pTrie->SearchKernel(aStream,pJob->pData+iScan,iEnd-iScan,aPolicy);
+
+	//Done
+	return NULL;
+}
+
+unsigned short CSuffixTrie::GetMaxDepth()const
+{
+	//The deepest state of what SearchKernel uses
+	unsigned short usDepth;
+	usDepth=0;
+
+	if (m_pDFA)
+		for (size_t iState=0; iState<m_iDFAStates; ++iState)
+			usDepth=std::max(usDepth,(unsigned short)m_pDFA[iState*(m_uiDFAClasses+dcCount)+m_uiDFAClasses+dcDepth]);
+	else if (!m_aCompact.empty())
+		for (size_t iState=0; iState<m_aCompact.size(); ++iState)
+			usDepth=std::max(usDepth,m_aCompact[iState].usDepth);
+	else
+		for (size_t iNode=0; iNode<m_aNodes.size(); ++iNode)
+			usDepth=std::max(usDepth,m_aNodes[iNode].usDepth);
+
+	//Done
+	return usDepth;
+}
+
+void CSuffixTrie::ResetStream(StreamState& rStream)
+{
+	//Start at the root
+	rStream.uiState=0;
+	rStream.iOffset=0;
+}
+
+void CSuffixTrie::SearchStream(StreamState& rStream,
+							   const unsigned char* pData,
+							   size_t iLength,
+							   MatchCallback pCallback,
+							   void* pContext)const
+{
+	//Call the caller back
+	CallbackPolicy aPolicy;
+	aPolicy.pCallback=pCallback;
+	aPolicy.pContext=pContext;
+	SearchKernel(rStream,pData,iLength,aPolicy);
+}
+
+template<class Policy>
+void CSuffixTrie::SearchKernel(StreamState& rStream,
+							   const unsigned char* pData,
+							   size_t iLength,
+							   Policy& rPolicy)const
+{
+	//Use the best compiled form we have
+	if (m_pDFA)
+		SearchDFA(rStream,pData,iLength,rPolicy);
+	else if (!m_aCompact.empty())
+		SearchCompact(rStream,pData,iLength,rPolicy);
+	else
+		SearchNodes(rStream,pData,iLength,rPolicy);
+}
+
+size_t CSuffixTrie::SearchBytes(const unsigned char* pData,
+								size_t iLength,
+								Match* pMatches,
+								size_t iMaxMatches)const
+{
+	//Sanity check
+	if (!iMaxMatches)
+		return 0;
+
+	//Fill the caller buffer
+	BufferPolicy aPolicy;
+	aPolicy.pMatches=pMatches;
+	aPolicy.iMaxMatches=iMaxMatches;
+	aPolicy.iCount=0;
+	StreamState aStream;
+	ResetStream(aStream);
+	SearchKernel(aStream,pData,iLength,aPolicy);
+
+	//Done
+	return aPolicy.iCount;
+}
+
+bool CSuffixTrie::SearchExists(const unsigned char* pData,
+							   size_t iLength)const
+{
+	//Stop at the first word
+	ExistsPolicy aPolicy;
+	aPolicy.bFound=false;
+	StreamState aStream;
+	ResetStream(aStream);
+	SearchKernel(aStream,pData,iLength,aPolicy);
+
+	//Done
+	return aPolicy.bFound;
+}
+
+bool CSuffixTrie::SearchFirst(const unsigned char* pData,
+							  size_t iLength,
+							  Match& rMatch)const
+{
+	//Keep the first one
+	FirstPolicy aPolicy;
+	aPolicy.pMatch=&rMatch;
+	aPolicy.bFound=false;
+	StreamState aStream;
+	ResetStream(aStream);
+	SearchKernel(aStream,pData,iLength,aPolicy);
+
+	//Done
+	return aPolicy.bFound;
+}
+
+size_t CSuffixTrie::SearchCount(const unsigned char* pData,
+								size_t iLength)const
+{
+	//Count them all
+	CountPolicy aPolicy;
+	aPolicy.iCount=0;
+	StreamState aStream;
+	ResetStream(aStream);
+	SearchKernel(aStream,pData,iLength,aPolicy);
+
+	//Done
+	return aPolicy.iCount;
+}
+
+void CSuffixTrie::SearchRules(const unsigned char* pData,
+							  size_t iLength,
+							  unsigned long long* pRules,
+							  size_t iRuleWords)const
+{
+	//Set their bits
+	RulesPolicy aPolicy;
+	aPolicy.pRules=pRules;
+	aPolicy.iRuleWords=iRuleWords;
+	StreamState aStream;
+	ResetStream(aStream);
+	SearchKernel(aStream,pData,iLength,aPolicy);
+}
+
+bool CSuffixTrie::BuildDFA()
+{
+	//Time the build
+	double dStart;
+	dStart=GetTimeMS();
+
+	//Reset the tables (built by hand unless Compile says why)
+	m_aDFA.clear();
+	m_aDFAVisits.clear();
+	m_sReason.clear();
+	UnmapImage();
+
+	//Which bytes the words have (they are folded already)
+	bool aUsed[256];
+	memset(aUsed,0,sizeof(aUsed));
+
+	size_t iNodes;
+	iNodes=0;
+
+	std::vector<NodeIndex> aStack(1,0);
+	while (!aStack.empty())
+	{
+		//Take the node
+		NodeIndex uiNode;
+		uiNode=aStack.back();
+		aStack.pop_back();
+		++iNodes;
+
+		for (NodeIndex uiChild=m_aNodes[uiNode].uiChild;
+			 uiChild;
+			 uiChild=m_aNodes[uiChild].uiNext)
+		{
+			aUsed[(unsigned char)m_aNodes[uiChild].aChar]=true;
+			aStack.push_back(uiChild);
+		}
+	}
+
+	//Every byte the words have is a class, the rest share class 0 (from anywhere they go
+	//where the root goes), the bytes that fold to the same byte share its class
+	unsigned char aClasses[256];
+	m_uiDFAClasses=std::count(aUsed,aUsed+256,false)?1:0;
+	for (unsigned int uiByte=0; uiByte<256; ++uiByte)
+		aClasses[uiByte]=aUsed[uiByte]?m_uiDFAClasses++:0;
+	for (unsigned int uiByte=0; uiByte<256; ++uiByte)
+		m_aDFAClasses[uiByte]=aClasses[m_aFold[uiByte]];
+
+	//The row size, the states must fit below the marks
+	size_t iStride;
+	iStride=m_uiDFAClasses+dcCount;
+	if (iNodes*iStride>DFA_STATE)
+	{
+		SetDFATables();
+		return false;
+	}
+	m_aDFA.reserve(iNodes*iStride);
+
+	//The prefilter goes in front of it (it may have been dropped by an update)
+	//We need its length to mark the deep states
+	BuildPrefilter();
+
+	//The rule list of every word
+	std::vector<unsigned int> aLists;
+	BuildRuleLists(aLists);
+
+	//The DFA state (row offset) of every node
+	std::vector<unsigned int> aStates(m_aNodes.size(),0);
+
+	//We go breadth first, so a failure state is always built before us
+	std::deque<NodeIndex> aQueue;
+
+	//Start at the root
+	aQueue.push_back(0);
+
+	//Next state to give
+	unsigned int uiStates;
+	uiStates=iStride;
+
+	while (!aQueue.empty())
+	{
+		//Take the node
+		NodeIndex uiNode;
+		uiNode=aQueue.front();
+		aQueue.pop_front();
+
+		//Our row (states are given in the order we pop them)
+		size_t iRow;
+		iRow=m_aDFA.size();
+		m_aDFA.resize(iRow+iStride,0);
+
+		//Anything we don't have goes where our failure node goes
+		if (uiNode)
+		{
+			//Copy the failure transitions (the root fails to itself)
+			size_t iFailureRow;
+			iFailureRow=aStates[m_aNodes[uiNode].uiFailure];
+
+			std::copy(m_aDFA.begin()+iFailureRow,
+					  m_aDFA.begin()+iFailureRow+m_uiDFAClasses,
+					  m_aDFA.begin()+iRow);
+		}
+
+		//Now our own children
+		for (NodeIndex uiChild=m_aNodes[uiNode].uiChild;
+			 uiChild;
+			 uiChild=m_aNodes[uiChild].uiNext)
+		{
+			//Give it a state
+			const Node& rChild=m_aNodes[uiChild];
+			aStates[uiChild]=uiStates;
+			uiStates+=iStride;
+
+			//Set the transition
+			m_aDFA[iRow+m_aDFAClasses[(unsigned char)rChild.aChar]]=aStates[uiChild]|
+																	 (rChild.bFinal || rChild.uiOutput?DFA_FINAL:0)|
+																	 (rChild.usDepth>=m_uiPrefixLength?DFA_DEEP:0);
+
+			//Process it later
+			aQueue.push_back(uiChild);
+		}
+
+		//Save the state data (output nodes are shallower, so they have a state by now)
+		m_aDFA[iRow+m_uiDFAClasses+dcDepth]=m_aNodes[uiNode].usDepth;
+		m_aDFA[iRow+m_uiDFAClasses+dcFinal]=aLists[m_aNodes[uiNode].bFinal];
+		m_aDFA[iRow+m_uiDFAClasses+dcOutput]=aStates[m_aNodes[uiNode].uiOutput];
+	}
+
+	//Search from it
+	SetDFATables();
+
+	//Done
+	m_dBuildTime=GetTimeMS()-dStart;
+	return true;
+}
+
+CSuffixTrie::DataFoundVector CSuffixTrie::SearchDFAMultiple(const SearchString& rString)const
+{
+	//Our vector of data found
+	DataFoundVector aVec;
+
+	//Search it
+	FoundPolicy aPolicy;
+	aPolicy.pVector=&aVec;
+	aPolicy.pString=&rString;
+	StreamState aStream;
+	ResetStream(aStream);
+	SearchDFA(aStream,
+			  (const unsigned char*)rString.data(),
+			  rString.length(),
+			  aPolicy);
+
+	//Done
+	return aVec;
+}
+
+template<class Policy>
+void CSuffixTrie::SearchDFA(StreamState& rStream,
+							const unsigned char* pData,
+							size_t iLength,
+							Policy& rPolicy)const
+{
+	//Do we have a DFA?
+	if (!m_pDFA)
+		return;
+
+	//The tables
+	const unsigned int* pDFA;
+	pDFA=m_pDFA;
+	const unsigned char* pClasses;
+	pClasses=m_aDFAClasses;
+
+	//Where the state data is in a row
+	unsigned int uiData;
+	uiData=m_uiDFAClasses;
+
+	//Continue from where the stream is
+	unsigned int uiState;
+	uiState=rStream.uiState;
+
+	//Where to prefilter from (never if we don't have it)
+	size_t iScanned;
+	iScanned=m_uiPrefixLength?0:iLength;
+
+	//Iterate the data
+	for (size_t iCount=0; iCount<iLength; ++iCount)
+	{
+		//Skip the bytes no word starts at (deep states have a candidate where they start)
+		if (iCount>=iScanned &&
+			!(uiState&DFA_DEEP) &&
+			SkipToCandidate(pData,iLength,pDFA[uiState+uiData+dcDepth],iCount,iScanned))
+		{
+			//We start over at the root
+			uiState=0;
+			if (iCount==iLength)
+				break;
+		}
+
+		//One load per byte (the class load doesn't wait for the state)
+		uiState=pDFA[(uiState&DFA_STATE)+pClasses[pData[iCount]]];
+
+		//Do we have words here?
+		if (uiState&DFA_FINAL)
+		{
+			//Remove the mark
+			uiState&=~DFA_FINAL;
+
+			//Our row
+			unsigned int uiRow;
+			uiRow=uiState&DFA_STATE;
+
+			//Report us and then the dictionary chain
+			for (unsigned int uiOutput=pDFA[uiRow+uiData+dcFinal]?uiRow:pDFA[uiRow+uiData+dcOutput];
+				 uiOutput;
+				 uiOutput=pDFA[uiOutput+uiData+dcOutput])
+			{
+				//A match per rule of the word
+				const int* pRules;
+				pRules=m_pRules+pDFA[uiOutput+uiData+dcFinal];
+
+				for (int iRule=1; iRule<=pRules[0]; ++iRule)
+				{
+					//Our match
+					Match aMatch;
+					aMatch.rule_id=pRules[iRule];
+					aMatch.iFoundPosition=rStream.iOffset+iCount+1-pDFA[uiOutput+uiData+dcDepth];
+					aMatch.iEndPosition=rStream.iOffset+iCount;
+
+					//Tell the policy, can stop us
+					if (!rPolicy.Report(aMatch))
+					{
+						//Save where we stopped
+						rStream.uiState=uiState;
+						rStream.iOffset+=iCount+1;
+						return;
+					}
+				}
+			}
+		}
+	}
+
+	//Save where we are (without the final mark)
+	rStream.uiState=uiState&~DFA_FINAL;
+	rStream.iOffset+=iLength;
+}
+
+void CSuffixTrie::ProfileDFA(const unsigned char* pData,
+							 size_t iLength)
+{
+	//Sanity check
+	if (!m_pDFA)
+		return;
+
+	//A new profile
+	if (m_aDFAVisits.empty())
+		m_aDFAVisits.assign(m_iDFAStates,0);
+
+	//Walk every byte (no prefilter, it would hide where the DFA goes)
+	size_t iStride;
+	iStride=m_uiDFAClasses+dcCount;
+
+	unsigned int uiState;
+	uiState=0;
+
+	for (size_t iCount=0; iCount<iLength; ++iCount)
+	{
+		uiState=m_pDFA[uiState+m_aDFAClasses[pData[iCount]]]&DFA_STATE;
+		++m_aDFAVisits[uiState/iStride];
+	}
+}
+
+bool CSuffixTrie::LayoutDFA()
+{
+	//We need a profile, and a DFA we can rewrite
+	if (!m_pDFA || m_pImage || m_aDFAVisits.empty())
+		return false;
+
+	size_t iStride;
+	iStride=m_uiDFAClasses+dcCount;
+
+	//The new order, the root stays first, the rest by visits (ties keep their order, so the cold
+	//states stay breadth first)
+	std::vector<unsigned int> aOrder(m_iDFAStates);
+	for (size_t iState=0; iState<m_iDFAStates; ++iState)
+		aOrder[iState]=iState;
+
+	VisitOrder aVisitOrder;
+	aVisitOrder.pVisits=&m_aDFAVisits;
+	std::stable_sort(aOrder.begin()+1,aOrder.end(),aVisitOrder);
+
+	//The new row of every state
+	std::vector<unsigned int> aStates(m_iDFAStates);
+	for (size_t iState=0; iState<m_iDFAStates; ++iState)
+		aStates[aOrder[iState]]=iState*iStride;
+
+	//Copy the rows there, moving the transitions (with their marks) and the output links
+	DFAVector aDFA(m_aDFA.size());
+	for (size_t iState=0; iState<m_iDFAStates; ++iState)
+	{
+		const unsigned int* pRow;
+		pRow=&m_aDFA[aOrder[iState]*iStride];
+
+		unsigned int* pNewRow;
+		pNewRow=&aDFA[iState*iStride];
+
+		for (unsigned int uiClass=0; uiClass<m_uiDFAClasses; ++uiClass)
+			pNewRow[uiClass]=aStates[(pRow[uiClass]&DFA_STATE)/iStride]|(pRow[uiClass]&~DFA_STATE);
+
+		pNewRow[m_uiDFAClasses+dcDepth]=pRow[m_uiDFAClasses+dcDepth];
+		pNewRow[m_uiDFAClasses+dcFinal]=pRow[m_uiDFAClasses+dcFinal];
+		pNewRow[m_uiDFAClasses+dcOutput]=aStates[pRow[m_uiDFAClasses+dcOutput]/iStride];
+	}
+
+	//The profile moves with them
+	std::vector<unsigned long long> aVisits(m_iDFAStates);
+	for (size_t iState=0; iState<m_iDFAStates; ++iState)
+		aVisits[iState]=m_aDFAVisits[aOrder[iState]];
+
+	//Search from it
+	m_aDFA.swap(aDFA);
+	m_aDFAVisits.swap(aVisits);
+	SetDFATables();
+
+	//Done
+	return true;
+}
+
+void CSuffixTrie::SetDFATables()
+{
+	//Our rule lists (none without a compiled form)
+	if (m_aRules.empty())
+		m_aRules.assign(1,0);
+	m_pRules=&m_aRules[0];
+	m_iRules=m_aRules.size();
+
+	//Our vector (none if it is empty)
+	if (m_aDFA.empty())
+	{
+		m_pDFA=NULL;
+		m_iDFAStates=0;
+		return;
+	}
+
+	m_pDFA=&m_aDFA[0];
+	m_iDFAStates=m_aDFA.size()/(m_uiDFAClasses+dcCount);
+}
+
+void CSuffixTrie::UnmapImage()
+{
+	//Do we have it?
+	if (!m_pImage)
+		return;
+
+	munmap(m_pImage,m_iImageSize);
+	m_pImage=NULL;
+	m_iImageSize=0;
+
+	//The tables were in it
+	SetDFATables();
+}
+
+unsigned long long CSuffixTrie::ImageChecksum(const unsigned char* pData,
+											  size_t iSize)
+{
+	//FNV-1a, a word at a time
+	unsigned long long ullChecksum;
+	ullChecksum=0xcbf29ce484222325ULL;
+
+	for (size_t iCount=0; iCount<iSize; iCount+=sizeof(unsigned long long))
+	{
+		unsigned long long ullWord;
+		memcpy(&ullWord,pData+iCount,sizeof(ullWord));
+		ullChecksum=(ullChecksum^ullWord)*0x100000001b3ULL;
+	}
+
+	return ullChecksum;
+}
+
+bool CSuffixTrie::SaveImage(const char* pFileName)const
+{
+	//Do we have a DFA?
+	if (!m_pDFA)
+		return false;
+
+	//Where the tables are
+	const void* aTables[itCount];
+	ImageHeader aHeader;
+	memset(&aHeader,0,sizeof(aHeader));
+
+	aTables[itDFA]=m_pDFA;
+	aHeader.aSizes[itDFA]=m_iDFAStates*(m_uiDFAClasses+dcCount)*sizeof(unsigned int);
+	aTables[itClasses]=m_aDFAClasses;
+	aHeader.aSizes[itClasses]=sizeof(m_aDFAClasses);
+	aTables[itRules]=m_pRules;
+	aHeader.aSizes[itRules]=m_iRules*sizeof(int);
+	aTables[itPrefixLow]=m_aPrefixLow;
+	aHeader.aSizes[itPrefixLow]=sizeof(m_aPrefixLow);
+	aTables[itPrefixHigh]=m_aPrefixHigh;
+	aHeader.aSizes[itPrefixHigh]=sizeof(m_aPrefixHigh);
+	aTables[itPrefixBytes]=m_aPrefixBytes;
+	aHeader.aSizes[itPrefixBytes]=sizeof(m_aPrefixBytes);
+	aTables[itPrefixHash]=m_aPrefixHash.empty()?NULL:&m_aPrefixHash[0];
+	aHeader.aSizes[itPrefixHash]=m_aPrefixHash.size()*sizeof(unsigned long long);
+
+	//Lay them out after the header, 64 byte aligned
+	unsigned long long ullOffset;
+	ullOffset=(sizeof(ImageHeader)+63)&~63ULL;
+	for (unsigned int uiTable=0; uiTable<itCount; ++uiTable)
+	{
+		aHeader.aOffsets[uiTable]=ullOffset;
+		ullOffset=(ullOffset+aHeader.aSizes[uiTable]+63)&~63ULL;
+	}
+
+	//Build it in memory (we need the checksum first)
+	std::vector<unsigned char> aImage(ullOffset,0);
+	for (unsigned int uiTable=0; uiTable<itCount; ++uiTable)
+		if (aHeader.aSizes[uiTable])
+			memcpy(&aImage[aHeader.aOffsets[uiTable]],aTables[uiTable],aHeader.aSizes[uiTable]);
+
+	//The header
+	size_t iBody;
+	iBody=aHeader.aOffsets[0];
+	memcpy(aHeader.aMagic,IMAGE_MAGIC,sizeof(aHeader.aMagic));
+	aHeader.uiVersion=IMAGE_VERSION;
+	aHeader.uiByteOrder=0x01020304;
+	aHeader.ullSize=ullOffset;
+	aHeader.ullChecksum=ImageChecksum(&aImage[iBody],aImage.size()-iBody);
+	aHeader.uiStates=m_iDFAStates;
+	aHeader.uiClasses=m_uiDFAClasses;
+	aHeader.uiRules=m_iRules;
+	aHeader.uiPrefixLength=m_uiPrefixLength;
+	aHeader.uiMaxDepth=GetMaxDepth();
+	aHeader.uiFlags=m_bNoCase?ifNoCase:0;
+	memcpy(&aImage[0],&aHeader,sizeof(aHeader));
+
+	//Write it
+	FILE* pFile;
+	pFile=fopen(pFileName,"wb");
+	if (!pFile)
+		return false;
+
+	bool bWritten;
+	bWritten=fwrite(&aImage[0],1,aImage.size(),pFile)==aImage.size();
+	if (fclose(pFile))
+		bWritten=false;
+
+	//Done
+	return bWritten;
+}
+
+bool CSuffixTrie::SaveHeader(const char* pFileName,
+							 const char* pName)const
+{
+	//Do we have a DFA?
+	if (!m_pDFA)
+		return false;
+
+	//The name is the namespace (and the include guard)
+	if (!pName ||
+		!(isalpha((unsigned char)*pName) || *pName=='_'))
+		return false;
+
+	std::string sGuard;
+	for (const char* pChar=pName; *pChar; ++pChar)
+	{
+		if (!isalnum((unsigned char)*pChar) && *pChar!='_')
+			return false;
+
+		sGuard+=(char)toupper((unsigned char)*pChar);
+	}
+	sGuard+="_H";
+
+	//Write it
+	FILE* pFile;
+	pFile=fopen(pFileName,"w");
+	if (!pFile)
+		return false;
+
+	//Row size
+	size_t iStride;
+	iStride=m_uiDFAClasses+dcCount;
+
+	fprintf(pFile,
+			"//Built rule set %s, written by CSuffixTrie::SaveHeader, don't edit\n"
+			"//%lu states, %u byte classes, %lu bytes of tables\n"
+			"#ifndef %s\n"
+			"#define %s\n"
+			"\n"
+			"#include <stddef.h>\n"
+			"\n"
+			"//The tables are constant data, constexpr where the compiler has it\n"
+			"#ifndef SUFFIXTRIE_CONSTEXPR\n"
+			"#if __cplusplus>=201103L\n"
+			"#define SUFFIXTRIE_CONSTEXPR constexpr\n"
+			"#else\n"
+			"#define SUFFIXTRIE_CONSTEXPR const\n"
+			"#endif\n"
+			"#endif\n"
+			"\n"
+			"namespace %s {\n"
+			"\n"
+			"//A match\n"
+			"typedef struct _Match {\n"
+			"\tint\t\trule_id;\n"
+			"\tsize_t\tiFoundPosition;\t//First char of the match\n"
+			"\tsize_t\tiEndPosition;\t//Last char of the match\n"
+			"} Match;\n"
+			"\n"
+			"//A row per state with a transition per byte class, then the depth, rule list and output columns\n"
+			"//States are the offsets of their rows (the root is 0)\n"
+			"static SUFFIXTRIE_CONSTEXPR unsigned int CLASSES = %u;\n"
+			"static SUFFIXTRIE_CONSTEXPR unsigned int STATES = %lu;\n"
+			"static SUFFIXTRIE_CONSTEXPR unsigned int COLUMN_DEPTH = %u;\n"
+			"static SUFFIXTRIE_CONSTEXPR unsigned int COLUMN_FINAL = %u;\n"
+			"static SUFFIXTRIE_CONSTEXPR unsigned int COLUMN_OUTPUT = %u;\n"
+			"\n"
+			"//Set on a transition when the target state has words to report, and the state without the marks\n"
+			"static SUFFIXTRIE_CONSTEXPR unsigned int DFA_FINAL = 0x%08x;\n"
+			"static SUFFIXTRIE_CONSTEXPR unsigned int DFA_STATE = 0x%08x;\n"
+			"\n"
+			"//The byte class of each byte\n"
+			"static SUFFIXTRIE_CONSTEXPR unsigned char aClasses[256] = {",
+			pName,
+			(unsigned long)m_iDFAStates,
+			m_uiDFAClasses,
+			(unsigned long)GetDFASize(),
+			sGuard.c_str(),
+			sGuard.c_str(),
+			pName,
+			m_uiDFAClasses,
+			(unsigned long)m_iDFAStates,
+			m_uiDFAClasses+dcDepth,
+			m_uiDFAClasses+dcFinal,
+			m_uiDFAClasses+dcOutput,
+			DFA_FINAL,
+			DFA_STATE);
+
+	for (unsigned int uiByte=0; uiByte<256; ++uiByte)
+		fprintf(pFile,
+				"%s%u%s",
+				uiByte%16?"":"\n\t",
+				m_aDFAClasses[uiByte],
+				uiByte<255?",":"");
+
+	fprintf(pFile,
+			"\n};\n"
+			"\n"
+			"//The DFA\n"
+			"static SUFFIXTRIE_CONSTEXPR unsigned int aDFA[%lu] = {",
+			(unsigned long)(m_iDFAStates*iStride));
+
+	//A row per line (wrapped)
+	size_t iSize;
+	iSize=m_iDFAStates*iStride;
+	for (size_t iCount=0; iCount<iSize; ++iCount)
+		fprintf(pFile,
+				"%s0x%x%s",
+				iCount%iStride && iCount%iStride%16?"":"\n\t",
+				m_pDFA[iCount],
+				iCount+1<iSize?",":"");
+
+	fprintf(pFile,
+			"\n};\n"
+			"\n"
+			"//The rule lists of the words, each is its count and then its ids\n"
+			"static SUFFIXTRIE_CONSTEXPR int aRules[%lu] = {",
+			(unsigned long)m_iRules);
+
+	for (size_t iCount=0; iCount<m_iRules; ++iCount)
+		fprintf(pFile,
+				"%s%d%s",
+				iCount%16?"":"\n\t",
+				m_pRules[iCount],
+				iCount+1<m_iRules?",":"");
+
+	fprintf(pFile,
+			"\n};\n"
+			"\n"
+			"//Search the data, rCallback(rMatch) is called for every match, return false from it to stop\n"
+			"//It is a function or a functor (taken by value, like the std algorithms), both are inlined\n"
+			"template<class Callback>\n"
+			"inline void Search(const unsigned char* pData,\n"
+			"\t\t\t\t   size_t iLength,\n"
+			"\t\t\t\t   Callback rCallback)\n"
+			"{\n"
+			"\tunsigned int uiState;\n"
+			"\tuiState=0;\n"
+			"\n"
+			"\tfor (size_t iCount=0; iCount<iLength; ++iCount)\n"
+			"\t{\n"
+			"\t\t//One load per byte\n"
+			"\t\tuiState=aDFA[(uiState&DFA_STATE)+aClasses[pData[iCount]]];\n"
+			"\n"
+			"\t\t//Do we have words here?\n"
+			"\t\tif (uiState&DFA_FINAL)\n"
+			"\t\t{\n"
+			"\t\t\tunsigned int uiRow;\n"
+			"\t\t\tuiRow=uiState&DFA_STATE;\n"
+			"\n"
+			"\t\t\t//Report us and then the dictionary chain\n"
+			"\t\t\tfor (unsigned int uiOutput=aDFA[uiRow+COLUMN_FINAL]?uiRow:aDFA[uiRow+COLUMN_OUTPUT];\n"
+			"\t\t\t\t uiOutput;\n"
+			"\t\t\t\t uiOutput=aDFA[uiOutput+COLUMN_OUTPUT])\n"
+			"\t\t\t{\n"
+			"\t\t\t\t//A match per rule of the word\n"
+			"\t\t\t\tconst int* pRules;\n"
+			"\t\t\t\tpRules=aRules+aDFA[uiOutput+COLUMN_FINAL];\n"
+			"\n"
+			"\t\t\t\tfor (int iRule=1; iRule<=pRules[0]; ++iRule)\n"
+			"\t\t\t\t{\n"
+			"\t\t\t\t\tMatch aMatch;\n"
+			"\t\t\t\t\taMatch.rule_id=pRules[iRule];\n"
+			"\t\t\t\t\taMatch.iFoundPosition=iCount+1-aDFA[uiOutput+COLUMN_DEPTH];\n"
+			"\t\t\t\t\taMatch.iEndPosition=iCount;\n"
+			"\n"
+			"\t\t\t\t\tif (!rCallback(aMatch))\n"
+			"\t\t\t\t\t\treturn;\n"
+			"\t\t\t\t}\n"
+			"\t\t\t}\n"
+			"\t\t}\n"
+			"\t}\n"
+			"}\n"
+			"\n"
+			"}\n"
+			"\n"
+			"#endif\n");
+
+	bool bWritten;
+	bWritten=!ferror(pFile);
+	if (fclose(pFile))
+		bWritten=false;
+
+	//Done
+	return bWritten;
+}
+
+bool CSuffixTrie::LoadImage(const char* pFileName,
+							bool bVerify)
+{
+	//Time the load
+	double dStart;
+	dStart=GetTimeMS();
+
+	//Open it
+	int iFile;
+	iFile=open(pFileName,O_RDONLY);
+	if (iFile<0)
+		return false;
+
+	//Map it all
+	struct stat aStat;
+	void* pImage;
+	pImage=MAP_FAILED;
+	if (!fstat(iFile,&aStat) &&
+		aStat.st_size>=(off_t)sizeof(ImageHeader))
+		pImage=mmap(NULL,aStat.st_size,PROT_READ,MAP_SHARED,iFile,0);
+
+	//The mapping stays after the close
+	close(iFile);
+
+	if (pImage==MAP_FAILED)
+		return false;
+
+	const unsigned char* pData;
+	pData=(const unsigned char*)pImage;
+	size_t iSize;
+	iSize=aStat.st_size;
+
+	//Is it ours?
+	ImageHeader aHeader;
+	memcpy(&aHeader,pData,sizeof(aHeader));
+
+	bool bValid;
+	bValid=!memcmp(aHeader.aMagic,IMAGE_MAGIC,sizeof(aHeader.aMagic)) &&
+		   aHeader.uiVersion==IMAGE_VERSION &&
+		   aHeader.uiByteOrder==0x01020304 &&
+		   aHeader.ullSize==iSize &&
+		   aHeader.uiStates &&
+		   aHeader.uiClasses &&
+		   aHeader.uiClasses<=256 &&
+		   aHeader.uiRules &&
+		   aHeader.uiPrefixLength<=PREFIX_MAX &&
+		   aHeader.uiMaxDepth<=USHRT_MAX &&
+		   !(aHeader.uiFlags&~ifNoCase);
+
+	//Row size
+	size_t iStride;
+	iStride=aHeader.uiClasses+dcCount;
+
+	//The tables must be where they should and as big as they should
+	unsigned long long aExpected[itCount];
+	aExpected[itDFA]=(unsigned long long)aHeader.uiStates*iStride*sizeof(unsigned int);
+	aExpected[itClasses]=sizeof(m_aDFAClasses);
+	aExpected[itRules]=(unsigned long long)aHeader.uiRules*sizeof(int);
+	aExpected[itPrefixLow]=sizeof(m_aPrefixLow);
+	aExpected[itPrefixHigh]=sizeof(m_aPrefixHigh);
+	aExpected[itPrefixBytes]=sizeof(m_aPrefixBytes);
+	aExpected[itPrefixHash]=aHeader.uiPrefixLength?0x10000/8:0;
+
+	for (unsigned int uiTable=0; bValid && uiTable<itCount; ++uiTable)
+		bValid=aHeader.aSizes[uiTable]==aExpected[uiTable] &&
+			   !(aHeader.aOffsets[uiTable]&63) &&
+			   aHeader.aOffsets[uiTable]>=sizeof(ImageHeader) &&
+			   aHeader.aOffsets[uiTable]<=iSize &&
+			   aHeader.aSizes[uiTable]<=iSize-aHeader.aOffsets[uiTable];
+
+	//Nothing changed on the way
+	size_t iBody;
+	iBody=aHeader.aOffsets[0];
+	bValid=bValid &&
+		   !(iSize&7) &&
+		   (!bVerify || ImageChecksum(pData+iBody,iSize-iBody)==aHeader.ullChecksum);
+
+	//The states and classes must stay in the tables (the searches don't check)
+	const unsigned int* pDFA;
+	pDFA=(const unsigned int*)(pData+aHeader.aOffsets[itDFA]);
+	const unsigned char* pClasses;
+	pClasses=pData+aHeader.aOffsets[itClasses];
+	const int* pRules;
+	pRules=(const int*)(pData+aHeader.aOffsets[itRules]);
+
+	for (unsigned int uiByte=0; bValid && uiByte<256; ++uiByte)
+		bValid=pClasses[uiByte]<aHeader.uiClasses;
+
+	//The root is at depth 0
+	size_t iSizeDFA;
+	iSizeDFA=(size_t)aHeader.uiStates*iStride;
+	bValid=bValid &&
+		   (!bVerify || !pDFA[aHeader.uiClasses+dcDepth]);
+
+	for (size_t iRow=0; bValid && bVerify && iRow<iSizeDFA; iRow+=iStride)
+	{
+		//The rule list must be in its table
+		unsigned int uiList;
+		uiList=pDFA[iRow+aHeader.uiClasses+dcFinal];
+		bValid=uiList<aHeader.uiRules &&
+			   pRules[uiList]>=0 &&
+			   (unsigned int)pRules[uiList]<aHeader.uiRules-uiList;
+
+		//A match starts depth-1 bytes before its end, so no state is deeper than the header says
+		unsigned int uiDepth;
+		uiDepth=pDFA[iRow+aHeader.uiClasses+dcDepth];
+		bValid=bValid && uiDepth<=aHeader.uiMaxDepth;
+
+		for (size_t iColumn=0; bValid && iColumn<=aHeader.uiClasses+dcOutput; ++iColumn)
+		{
+			//The transitions and the output link are states
+			if (iColumn>=aHeader.uiClasses && iColumn!=aHeader.uiClasses+dcOutput)
+				continue;
+
+			unsigned int uiState;
+			uiState=pDFA[iRow+iColumn]&DFA_STATE;
+			bValid=uiState<iSizeDFA && !(uiState%iStride);
+
+			//A byte takes us at most one deeper (no match starts before the data), the output
+			//link goes to a shorter final state, so its chain ends
+			unsigned int uiNextDepth;
+			uiNextDepth=bValid?pDFA[uiState+aHeader.uiClasses+dcDepth]:0;
+
+			if (bValid && iColumn<aHeader.uiClasses)
+				bValid=uiNextDepth<=uiDepth+1;
+			else if (bValid && uiState)
+				bValid=uiNextDepth<uiDepth &&
+					   pDFA[uiState+aHeader.uiClasses+dcFinal];
+		}
+	}
+
+	if (!bValid)
+	{
+		munmap(pImage,iSize);
+		return false;
+	}
+
+	//We are only the image now (with the case it was built with)
+	Clear();
+	SetNoCase((aHeader.uiFlags&ifNoCase)!=0);
+	m_pImage=pImage;
+	m_iImageSize=iSize;
+	m_sReason="mapped from an image";
+
+	//Search from it (the classes are small, take a copy)
+	m_iDFAStates=aHeader.uiStates;
+	m_pDFA=pDFA;
+	m_uiDFAClasses=aHeader.uiClasses;
+	memcpy(m_aDFAClasses,pClasses,sizeof(m_aDFAClasses));
+	m_pRules=pRules;
+	m_iRules=aHeader.uiRules;
+
+	//The prefilter is small, take a copy
+	m_uiPrefixLength=aHeader.uiPrefixLength;
+	memcpy(m_aPrefixLow,pData+aHeader.aOffsets[itPrefixLow],sizeof(m_aPrefixLow));
+	memcpy(m_aPrefixHigh,pData+aHeader.aOffsets[itPrefixHigh],sizeof(m_aPrefixHigh));
+	memcpy(m_aPrefixBytes,pData+aHeader.aOffsets[itPrefixBytes],sizeof(m_aPrefixBytes));
+	m_aPrefixHash.assign((const unsigned long long*)(pData+aHeader.aOffsets[itPrefixHash]),
+						 (const unsigned long long*)(pData+aHeader.aOffsets[itPrefixHash]+aHeader.aSizes[itPrefixHash]));
+
+	//Done
+	m_dBuildTime=GetTimeMS()-dStart;
+	return true;
+}
+
+void CSuffixTrie::SearchBatch(const Payload* pPayloads,
+							  size_t iPayloads,
+							  MatchCallback pCallback)const
+{
+	//Without the DFA there is nothing to interleave, search them one by one
+	if (!m_pDFA)
+	{
+		for (size_t iPayload=0; iPayload<iPayloads; ++iPayload)
+			SearchBytes(pPayloads[iPayload].pData,
+						pPayloads[iPayload].iLength,
+						pCallback,
+						pPayloads[iPayload].pContext);
+		return;
+	}
+
+	//The payloads we walk
+	BatchLane aLanes[BATCH_LANES];
+	unsigned int uiLanes;
+	uiLanes=0;
+
+	//Next payload to take
+	size_t iPayload;
+	iPayload=0;
+
+	while (1)
+	{
+		//Keep the lanes full
+		for (; uiLanes<BATCH_LANES && iPayload<iPayloads; ++iPayload)
+			if (pPayloads[iPayload].iLength)
+			{
+				BatchLane& rLane=aLanes[uiLanes++];
+				rLane.pPayload=pPayloads+iPayload;
+				rLane.iCount=0;
+				rLane.iScanned=m_uiPrefixLength?0:rLane.pPayload->iLength;
+				rLane.uiState=0;
+			}
+
+		//All done?
+		if (!uiLanes)
+			break;
+
+		//A byte of each, a finished lane takes the place of the last one
+		for (unsigned int uiLane=0; uiLane<uiLanes;)
+			if (SearchBatchStep(aLanes[uiLane],pCallback))
+				++uiLane;
+			else
+				aLanes[uiLane]=aLanes[--uiLanes];
+	}
+}
+
+bool CSuffixTrie::SearchBatchStep(BatchLane& rLane,
+								  MatchCallback pCallback)const
+{
+	//Our payload
+	const unsigned char* pData;
+	pData=rLane.pPayload->pData;
+	size_t iLength;
+	iLength=rLane.pPayload->iLength;
+
+	//The tables
+	const unsigned int* pDFA;
+	pDFA=m_pDFA;
+	const unsigned char* pClasses;
+	pClasses=m_aDFAClasses;
+
+	//Where the state data is in a row
+	unsigned int uiData;
+	uiData=m_uiDFAClasses;
+
+	//Skip the bytes no word starts at
+	if (rLane.iCount>=rLane.iScanned &&
+		!(rLane.uiState&DFA_DEEP) &&
+		SkipToCandidate(pData,iLength,pDFA[rLane.uiState+uiData+dcDepth],rLane.iCount,rLane.iScanned))
+	{
+		//We start over at the root
+		rLane.uiState=0;
+		if (rLane.iCount==iLength)
+			return false;
+	}
+
+	//Move
+	unsigned int uiState;
+	uiState=pDFA[(rLane.uiState&DFA_STATE)+pClasses[pData[rLane.iCount++]]];
+
+	//Ask for our next transition now, it loads while the other lanes move
+	if (rLane.iCount<iLength)
+		__builtin_prefetch(&pDFA[(uiState&DFA_STATE)+pClasses[pData[rLane.iCount]]]);
+
+	//Do we have words here?
+	if (uiState&DFA_FINAL)
+	{
+		//Remove the mark
+		uiState&=~DFA_FINAL;
+
+		//Our row
+		unsigned int uiRow;
+		uiRow=uiState&DFA_STATE;
+
+		//Report us and then the dictionary chain
+		for (unsigned int uiOutput=pDFA[uiRow+uiData+dcFinal]?uiRow:pDFA[uiRow+uiData+dcOutput];
+			 uiOutput;
+			 uiOutput=pDFA[uiOutput+uiData+dcOutput])
+		{
+			//A match per rule of the word
+			const int* pRules;
+			pRules=m_pRules+pDFA[uiOutput+uiData+dcFinal];
+
+			for (int iRule=1; iRule<=pRules[0]; ++iRule)
+			{
+				//Our match
+				Match aMatch;
+				aMatch.rule_id=pRules[iRule];
+				aMatch.iFoundPosition=rLane.iCount-pDFA[uiOutput+uiData+dcDepth];
+				aMatch.iEndPosition=rLane.iCount-1;
+
+				//Tell the caller, can stop this payload
+				if (!pCallback(aMatch,rLane.pPayload->pContext))
+					return false;
+			}
+		}
+	}
+
+	//Save where we are
+	rLane.uiState=uiState;
+	return rLane.iCount<iLength;
+}
+
+void CSuffixTrie::BuildCompact()
+{
+	//Time the build
+	double dStart;
+	dStart=GetTimeMS();
+
+	//Reset the tables (built by hand unless Compile says why)
+	m_aCompact.clear();
+	m_sReason.clear();
+	m_aCompactLabels.clear();
+	m_aCompactChildren.clear();
+	m_aCompactBitmaps.clear();
+
+	//The rule list of every word
+	std::vector<unsigned int> aLists;
+	BuildRuleLists(aLists);
+
+	//Number the nodes in pre order, this puts a single child right after its parent
+	std::vector<unsigned int> aStates(m_aNodes.size(),0);
+	std::vector<NodeIndex> aNodes;
+	std::vector<NodeIndex> aStack;
+	aStack.push_back(0);
+
+	while (!aStack.empty())
+	{
+		//Take the node
+		NodeIndex uiNode;
+		uiNode=aStack.back();
+		aStack.pop_back();
+
+		//Give it a state
+		aStates[uiNode]=aNodes.size();
+		aNodes.push_back(uiNode);
+
+		//Push the children, the last one pushed (the first child) comes out next
+		size_t iFirst;
+		iFirst=aStack.size();
+
+		for (NodeIndex uiChild=m_aNodes[uiNode].uiChild;
+			 uiChild;
+			 uiChild=m_aNodes[uiChild].uiNext)
+			aStack.push_back(uiChild);
+
+		std::reverse(aStack.begin()+iFirst,aStack.end());
+	}
+
+	//Now build the states
+	m_aCompact.resize(aNodes.size());
+
+	for (size_t iCount=0;
+		 iCount<aNodes.size();
+		 ++iCount)
+	{
+		//Our node
+		const Node& rNode=m_aNodes[aNodes[iCount]];
+
+		//Fill the state
+		CompactState& rState=m_aCompact[iCount];
+		rState.uiFailure=aStates[rNode.uiFailure];
+		rState.uiOutput=aStates[rNode.uiOutput];
+		rState.bFinal=aLists[rNode.bFinal];
+		rState.usDepth=rNode.usDepth;
+		rState.ucCount=0;
+		rState.uiChildren=0;
+
+		//Collect the children, they are sorted by byte value already
+		std::vector<std::pair<unsigned char,unsigned int> > aChildren;
+		for (NodeIndex uiChild=rNode.uiChild;
+			 uiChild;
+			 uiChild=m_aNodes[uiChild].uiNext)
+			aChildren.push_back(std::make_pair((unsigned char)m_aNodes[uiChild].aChar,
+											   aStates[uiChild]));
+
+		//How do we keep them?
+		if (aChildren.empty())
+			rState.ucType=ctLeaf;
+		else if (aChildren.size()==1)
+		{
+			//The child is the next state, keep only the label
+			rState.ucType=ctChain;
+			rState.uiChildren=aChildren[0].first;
+		}
+		else if (aChildren.size()<=COMPACT_SORTED_MAX)
+		{
+			//Small sorted arrays
+			rState.ucType=ctSorted;
+			rState.ucCount=aChildren.size();
+			rState.uiChildren=m_aCompactChildren.size();
+
+			for (size_t iChild=0;
+				 iChild<aChildren.size();
+				 ++iChild)
+			{
+				m_aCompactLabels.push_back(aChildren[iChild].first);
+				m_aCompactChildren.push_back(aChildren[iChild].second);
+			}
+		}
+		else
+		{
+			//Bitmap, the children are ordered by byte value so the rank is the index
+			CompactBitmap aBitmap;
+			memset(aBitmap.aBits,0,sizeof(aBitmap.aBits));
+			aBitmap.uiChildren=m_aCompactChildren.size();
+
+			for (size_t iChild=0;
+				 iChild<aChildren.size();
+				 ++iChild)
+			{
+				aBitmap.aBits[aChildren[iChild].first>>6]|=1ULL<<(aChildren[iChild].first&63);
+				m_aCompactLabels.push_back(aChildren[iChild].first);
+				m_aCompactChildren.push_back(aChildren[iChild].second);
+			}
+
+			//Save it
+			rState.ucType=ctBitmap;
+			rState.uiChildren=m_aCompactBitmaps.size();
+			m_aCompactBitmaps.push_back(aBitmap);
+		}
+	}
+
+	//The prefilter goes in front of it (it may have been dropped by an update)
+	BuildPrefilter();
+
+	//Done
+	m_dBuildTime=GetTimeMS()-dStart;
+}
+
+unsigned int CSuffixTrie::CompactChild(unsigned int uiState,
+									   unsigned char ucChar)const
+{
+	//The labels have the folded chars
+	ucChar=m_aFold[ucChar];
+
+	//Our state
+	const CompactState& rState=m_aCompact[uiState];
+
+	switch (rState.ucType)
+	{
+	case ctChain:
+		//The child is right after us
+		return rState.uiChildren==ucChar?uiState+1:0;
+	case ctSorted:
+		{
+			//Scan the labels
+			const unsigned char* pLabels;
+			pLabels=&m_aCompactLabels[rState.uiChildren];
+
+			for (unsigned int uiCount=0;
+				 uiCount<rState.ucCount && pLabels[uiCount]<=ucChar;
+				 ++uiCount)
+				if (pLabels[uiCount]==ucChar)
+					return m_aCompactChildren[rState.uiChildren+uiCount];
+
+			//Not found
+			return 0;
+		}
+	case ctBitmap:
+		{
+			//Do we have it?
+			const CompactBitmap& rBitmap=m_aCompactBitmaps[rState.uiChildren];
+			unsigned long long ullWord;
+			ullWord=rBitmap.aBits[ucChar>>6];
+			if (!(ullWord&(1ULL<<(ucChar&63))))
+				return 0;
+
+			//Count the children before it
+			unsigned int uiRank;
+			uiRank=__builtin_popcountll(ullWord&((1ULL<<(ucChar&63))-1));
+			for (unsigned int uiWord=0;
+				 uiWord<(unsigned int)(ucChar>>6);
+				 ++uiWord)
+				uiRank+=__builtin_popcountll(rBitmap.aBits[uiWord]);
+
+			//Done
+			return m_aCompactChildren[rBitmap.uiChildren+uiRank];
+		}
+	default:
+		//A leaf
+		return 0;
+	}
 }
 
-const CSuffixTrie::Node* CSuffixTrie::SearchNode(const SearchString& rString,
-												 const Node* pNode)const
+CSuffixTrie::DataFoundVector CSuffixTrie::SearchCompactMultiple(const SearchString& rString)const
 {
-	//Sanity check
-	if (!pNode ||
-		rString.empty())
-		return NULL;
-
-	//The char we are looking for
-	SearchChar aChar;
-	aChar=rString[0];
+	//Our vector of data found
+	DataFoundVector aVec;
 
-	//Look for the next node
-	SearchMap::const_iterator aIterator;
-	aIterator=pNode->aMap.find(aChar);
+	//Search it
+	FoundPolicy aPolicy;
+	aPolicy.pVector=&aVec;
+	aPolicy.pString=&rString;
+	StreamState aStream;
+	ResetStream(aStream);
+	SearchCompact(aStream,
+				  (const unsigned char*)rString.data(),
+				  rString.length(),
+				  aPolicy);
 
-	//Do we have it?
-	if (aIterator!=pNode->aMap.end())
-	{
-		//Is it the last char?
-		if (rString.length()==1)
-			//We found our string
-			return aIterator->second;
-		else
-			//Search again
-			return SearchNode(rString.substr(1,rString.length()-1),
-							  aIterator->second);
-	}
-	else
-		//Not found
-		return NULL;
+	//Done
+	return aVec;
 }
 
-void CSuffixTrie::BuildIndex(const SearchString& rString,
-							 Node* pNode)
+template<class Policy>
+void CSuffixTrie::SearchCompact(StreamState& rStream,
+								const unsigned char* pData,
+								size_t iLength,
+								Policy& rPolicy)const
 {
-	//Sanity
-	if (!pNode)
+	//Do we have it?
+	if (m_aCompact.empty())
 		return;
 
-	//Do we need to process this node?
-	if (pNode->usDepth>1)
-	{
-		//Clear the node first
-		pNode->pFailureNode = NULL;
+	//Continue from where the stream is
+	unsigned int uiState;
+	uiState=rStream.uiState;
 
-		//We need to start and look for suffix/prefix
-		for (int iCount=1; iCount<rString.length(); ++iCount) {
-			//Build the sub string
-			SearchString sString;
-			sString=rString.substr(iCount,rString.length()-iCount);
+	//Where to prefilter from (never if we don't have it)
+	size_t iScanned;
+	iScanned=m_uiPrefixLength?0:iLength;
 
-			//And search
-			Node* pFoundNode;
-			pFoundNode = SearchNode(sString, &m_aRoot);
+	//Iterate the data
+	for (size_t iCount=0; iCount<iLength; ++iCount)
+	{
+		//Skip the bytes no word starts at
+		if (iCount>=iScanned &&
+			SkipToCandidate(pData,iLength,m_aCompact[uiState].usDepth,iCount,iScanned))
+		{
+			//We start over at the root
+			uiState=0;
+			if (iCount==iLength)
+				break;
+		}
 
-			//Did we get it?
-			if (pFoundNode) {
-				//Save it
-				pNode->pFailureNode = pFoundNode;
+		//Follow the failure states until we can move
+		while (1)
+		{
+			//Look for the char
+			unsigned int uiChild;
+			uiChild=CompactChild(uiState,pData[iCount]);
 
-				//Exit from this loop
+			//Do we have it?
+			if (uiChild)
+			{
+				uiState=uiChild;
 				break;
 			}
-		}	
-	}
-
-	//Build the next string
-	SearchString sString(rString);
-
-	//Iterate all its children
-	for (SearchMap::iterator aIterator=pNode->aMap.begin();
-		 aIterator!=pNode->aMap.end();
-		 ++aIterator)
-		//Build the index
-		BuildIndex(rString+aIterator->first,
-				   aIterator->second);
-}
-
-CSuffixTrie::DataFound CSuffixTrie::SearchAhoCorasik(const SearchString& rString)const {
-	//Our data found
-	DataFound aData;
-	aData.iFoundPosition=0;
 
-	//The current string we match
-	SearchString sMatchedString;
-
-	//Our node position
-	const Node* pNode;
-	pNode=&m_aRoot;
+			//At the root we stay at the root
+			if (!uiState)
+				break;
 
-	//Iterate the string
-	for (int iCount=0;
-		 iCount<rString.length();
-		 ++iCount)
-	{
-		//Did we switch node already
-		bool bSwitch;
-		bSwitch=false;
+			//Go to the failure state
+			uiState=m_aCompact[uiState].uiFailure;
+		}
 
-		//Loop while we got something
-		while (1)
+		//Report us and then the dictionary chain
+		for (unsigned int uiOutput=m_aCompact[uiState].bFinal?uiState:m_aCompact[uiState].uiOutput;
+			 uiOutput;
+			 uiOutput=m_aCompact[uiOutput].uiOutput)
 		{
-			//Look for the char
-			SearchMap::const_iterator aIterator;
-			aIterator=pNode->aMap.find(rString[iCount]);
+			//A match per rule of the word
+			const int* pRules;
+			pRules=m_pRules+m_aCompact[uiOutput].bFinal;
 
-			//Do we have it?
-			if (aIterator==pNode->aMap.end())
-				//No, check if we have failure node
-				if (!pNode->pFailureNode)
+			for (int iRule=1; iRule<=pRules[0]; ++iRule)
+			{
+				//Our match
+				Match aMatch;
+				aMatch.rule_id=pRules[iRule];
+				aMatch.iFoundPosition=rStream.iOffset+iCount+1-m_aCompact[uiOutput].usDepth;
+				aMatch.iEndPosition=rStream.iOffset+iCount;
+
+				//Tell the policy, can stop us
+				if (!rPolicy.Report(aMatch))
 				{
-					//No failure node, start at root again
-					pNode=&m_aRoot;
+					//Save where we stopped
+					rStream.uiState=uiState;
+					rStream.iOffset+=iCount+1;
+					return;
+				}
+			}
+		}
+	}
 
-					//Reset search string
-					sMatchedString = "";
+	//Save where we are
+	rStream.uiState=uiState;
+	rStream.iOffset+=iLength;
+}
 
-					//Did we do a switch?
-					if (bSwitch)
-						//We need to do this over
-						--iCount;
+void CSuffixTrie::ClearPrefilter()
+{
+	//Nothing to check
+	m_uiPrefixLength=0;
+	memset(m_aPrefixLow,0,sizeof(m_aPrefixLow));
+	memset(m_aPrefixHigh,0,sizeof(m_aPrefixHigh));
+	memset(m_aPrefixBytes,0,sizeof(m_aPrefixBytes));
+	m_aPrefixHash.clear();
+}
 
-					//Exit this loop
-					break;
-				}
-				else
-				{
-					//What is the depth difference?
-					unsigned short usDepth;
-					usDepth=pNode->usDepth-pNode->pFailureNode->usDepth-1;
+void CSuffixTrie::BuildPrefilter()
+{
+	//Start over
+	ClearPrefilter();
 
-					//This is how many chars to remove
-					sMatchedString=sMatchedString.substr(usDepth,sMatchedString.length()-usDepth);
+	//No words, nothing to skip to
+	if (!m_aNodes[0].uiChild)
+		return;
 
-					//Go to the failure node
-					pNode=pNode->pFailureNode;
+	//We check as many leading bytes as the shortest word has (up to PREFIX_MAX)
+	unsigned int uiLength;
+	uiLength=PREFIX_MAX;
 
-					//Set to switch
-					bSwitch=true;
-				}
-			else
-			{
-				//Add the char
-				sMatchedString+=rString[iCount];
+	std::vector<NodeIndex> aStack(1,0);
+	while (!aStack.empty())
+	{
+		//Take the node
+		NodeIndex uiNode;
+		uiNode=aStack.back();
+		aStack.pop_back();
+
+		//A word ends here
+		if (m_aNodes[uiNode].bFinal && m_aNodes[uiNode].usDepth<uiLength)
+			uiLength=m_aNodes[uiNode].usDepth;
+
+		//Go down while a shorter word can be there
+		if (m_aNodes[uiNode].usDepth+1u<uiLength)
+			for (NodeIndex uiChild=m_aNodes[uiNode].uiChild;
+				 uiChild;
+				 uiChild=m_aNodes[uiChild].uiNext)
+				aStack.push_back(uiChild);
+	}
 
-				//Save the new node
-				pNode=aIterator->second;
+	m_uiPrefixLength=uiLength;
+	m_aPrefixHash.resize(0x10000/64,0);
 
-				//Exit the loop
-				break;
-			}
+	//Every node at that depth holds the leading bytes of some words
+	aStack.push_back(0);
+	while (!aStack.empty())
+	{
+		//Take the node
+		NodeIndex uiNode;
+		uiNode=aStack.back();
+		aStack.pop_back();
+
+		//Not deep enough yet
+		if (m_aNodes[uiNode].usDepth<uiLength)
+		{
+			for (NodeIndex uiChild=m_aNodes[uiNode].uiChild;
+				 uiChild;
+				 uiChild=m_aNodes[uiChild].uiNext)
+				aStack.push_back(uiChild);
+			continue;
 		}
 
-		//Is this a final node?
-		if (pNode->bFinal)
+		//Our leading bytes (walk up to the root)
+		unsigned char aPrefix[PREFIX_MAX];
+		for (NodeIndex uiUp=uiNode;
+			 uiUp;
+			 uiUp=m_aNodes[uiUp].uiParent)
+			aPrefix[m_aNodes[uiUp].usDepth-1]=(unsigned char)m_aNodes[uiUp].aChar;
+
+		//Mark the bytes
+		for (unsigned int uiCount=0; uiCount<uiLength; ++uiCount)
+			m_aPrefixBytes[aPrefix[uiCount]]|=1<<uiCount;
+
+		//The bytes that fold to ours (just ours if case matters)
+		std::vector<unsigned char> aVariants[PREFIX_MAX];
+		for (unsigned int uiCount=0; uiCount<uiLength; ++uiCount)
+			for (unsigned int uiByte=0; uiByte<256; ++uiByte)
+				if (m_aFold[uiByte]==aPrefix[uiCount])
+					aVariants[uiCount].push_back(uiByte);
+
+		//Hash every spelling of the prefix (two bits each), the data isn't folded
+		unsigned int aVariant[PREFIX_MAX]={0};
+		while (1)
 		{
-			//We got our data
-			aData.iFoundPosition=iCount-sMatchedString.length()+1;
-			aData.sDataFound=sMatchedString;
+			unsigned char aSpelling[PREFIX_MAX];
+			for (unsigned int uiCount=0; uiCount<uiLength; ++uiCount)
+				aSpelling[uiCount]=aVariants[uiCount][aVariant[uiCount]];
+
+			unsigned int uiHash;
+			uiHash=PrefixHash(aSpelling);
+			unsigned int uiFirst;
+			uiFirst=uiHash>>16;
+			unsigned int uiSecond;
+			uiSecond=uiHash&0xffff;
+			m_aPrefixHash[uiFirst>>6]|=1ULL<<(uiFirst&63);
+			m_aPrefixHash[uiSecond>>6]|=1ULL<<(uiSecond&63);
+
+			//Next spelling
+			unsigned int uiCount;
+			for (uiCount=0; uiCount<uiLength; ++uiCount)
+				if (++aVariant[uiCount]<aVariants[uiCount].size())
+					break;
+				else
+					aVariant[uiCount]=0;
 
-			//Exit
-			return aData;
+			if (uiCount==uiLength)
+				break;
 		}
 	}
 
-	//Nothing found
-	return aData;
-}
+	//The bytes that fold to a leading byte are leading bytes
+	for (unsigned int uiByte=0; uiByte<256; ++uiByte)
+		m_aPrefixBytes[uiByte]|=m_aPrefixBytes[m_aFold[uiByte]];
 
-CSuffixTrie::DataFoundVector CSuffixTrie::SearchAhoCorasikMultiple(const SearchString& rString)const {
-	//Our vector of data found
-	DataFoundVector aVec;
+	//The positions we don't check let every byte pass
+	for (unsigned int uiByte=0; uiByte<256; ++uiByte)
+		m_aPrefixBytes[uiByte]|=(1<<PREFIX_MAX)-(1<<uiLength);
 
-	//The current string we match
-	SearchString sMatchedString;
+	//The nibble tables, a byte is there if its low and high nibble share a bit
+	for (unsigned int uiPosition=0; uiPosition<PREFIX_VECTOR; ++uiPosition)
+	{
+		//Positions we don't check let everything pass
+		if (uiPosition>=uiLength)
+		{
+			memset(m_aPrefixLow[uiPosition],0xff,16);
+			memset(m_aPrefixHigh[uiPosition],0xff,16);
+			continue;
+		}
 
-	//Our node position
-	const Node* pNode;
-	pNode = &m_aRoot;
+		//Group the high nibbles by their low nibbles, one bit per group (the last takes the rest)
+		unsigned short aGroups[8];
+		unsigned int uiGroups;
+		uiGroups=0;
 
-	//Iterate the string
-	for (int iCount=0; iCount < rString.length(); ++iCount) {
-		//Did we switch node already
-		bool bSwitch;
-		bSwitch = false;
+		for (unsigned int uiHigh=0; uiHigh<16; ++uiHigh)
+		{
+			//The low nibbles we have with this high nibble
+			unsigned short usLow;
+			usLow=0;
+			for (unsigned int uiLow=0; uiLow<16; ++uiLow)
+				if (m_aPrefixBytes[(uiHigh<<4)|uiLow]&(1<<uiPosition))
+					usLow|=1<<uiLow;
+
+			if (!usLow)
+				continue;
+
+			//Find our group
+			unsigned int uiGroup;
+			for (uiGroup=0; uiGroup<uiGroups && aGroups[uiGroup]!=usLow; ++uiGroup)
+				;
+
+			if (uiGroup==uiGroups)
+			{
+				//A new one, or merge into the last (we may let more bytes pass then)
+				if (uiGroups<8)
+					aGroups[uiGroups++]=usLow;
+				else
+					aGroups[uiGroup=7]|=usLow;
+			}
 
-		//Loop while we got something
-		while (1) {
-			//Look for the char
-			SearchMap::const_iterator aIterator;
-			aIterator = pNode->aMap.find(rString[iCount]);
+			m_aPrefixHigh[uiPosition][uiHigh]|=1<<uiGroup;
+		}
 
-			//Do we have it?
-			if (aIterator == pNode->aMap.end()) {
-				//No, check if we have failure node
-				if (!pNode->pFailureNode) {
-					//No failure node, start at root again
-					pNode=&m_aRoot;
+		for (unsigned int uiGroup=0; uiGroup<uiGroups; ++uiGroup)
+			for (unsigned int uiLow=0; uiLow<16; ++uiLow)
+				if (aGroups[uiGroup]&(1<<uiLow))
+					m_aPrefixLow[uiPosition][uiLow]|=1<<uiGroup;
+	}
+}
 
-					//Reset search string
-					sMatchedString = "";
+unsigned int CSuffixTrie::PrefixHash(const unsigned char* pData)const
+{
+	return HashPrefix(pData,m_uiPrefixLength);
+}
 
-					//Did we do a switch?
-					if (bSwitch)
-						//We need to do this over
-						--iCount;
+#ifdef PREFILTER_VECTORS
+__attribute__((target("avx2")))
+bool CSuffixTrie::NextCandidateAVX2(const unsigned char* pData,
+									size_t iLast,
+									size_t iLength,
+									size_t& rCount)const
+{
+	//The nibble tables (same in both lanes)
+	__m256i aLow[PREFIX_VECTOR];
+	__m256i aHigh[PREFIX_VECTOR];
+	for (unsigned int uiPosition=0; uiPosition<PREFIX_VECTOR; ++uiPosition)
+	{
+		aLow[uiPosition]=_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)m_aPrefixLow[uiPosition]));
+		aHigh[uiPosition]=_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)m_aPrefixHigh[uiPosition]));
+	}
+	const __m256i aMask=_mm256_set1_epi8(0x0f);
 
-					//Exit this loop
-					break;
-				}
-				else {
-					//What is the depth difference?
-					unsigned short usDepth;
-					usDepth=pNode->usDepth-pNode->pFailureNode->usDepth-1;
+	//The hash bitmap
+	const unsigned long long* pHash;
+	pHash=&m_aPrefixHash[0];
 
-					//This is how many chars to remove
-					sMatchedString=sMatchedString.substr(usDepth,sMatchedString.length()-usDepth);
+	//The leading bytes we hash
+	unsigned int uiWordMask;
+	uiWordMask=m_uiPrefixLength==PREFIX_MAX?0xffffffff:(1u<<(m_uiPrefixLength*8))-1;
 
-					//Go to the failure node
-					pNode=pNode->pFailureNode;
+	//32 positions at a time (hashing them reads 8 more bytes)
+	while (rCount+32<=iLast+1 &&
+		   rCount+32+8<=iLength)
+	{
+		//A position misses if any of its leading bytes is not there
+		unsigned int uiMissing;
+		uiMissing=0;
+		for (unsigned int uiPosition=0; uiPosition<PREFIX_VECTOR; ++uiPosition)
+		{
+			__m256i aData;
+			aData=_mm256_loadu_si256((const __m256i*)(pData+rCount+uiPosition));
+			__m256i aBits;
+			aBits=_mm256_and_si256(_mm256_shuffle_epi8(aLow[uiPosition],_mm256_and_si256(aData,aMask)),
+								   _mm256_shuffle_epi8(aHigh[uiPosition],_mm256_and_si256(_mm256_srli_epi16(aData,4),aMask)));
+			uiMissing|=(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(aBits,_mm256_setzero_si256()));
+		}
 
-					//Set to switch
-					bSwitch=true;
+		unsigned int uiCandidates;
+		uiCandidates=~uiMissing;
+
+		//Many of them (text), hash all the positions at once
+		if (__builtin_popcount(uiCandidates)>2)
+		{
+			uiCandidates&=PrefixHits(pData+rCount,pHash,uiWordMask);
+			if (uiCandidates)
+			{
+				rCount+=__builtin_ctz(uiCandidates);
+				return true;
+			}
+		}
+		else
+			//Check the hash of the rest
+			for (;
+				 uiCandidates;
+				 uiCandidates&=uiCandidates-1)
+			{
+				if (HasPrefix(pHash,HashPrefix(pData+rCount+__builtin_ctz(uiCandidates),m_uiPrefixLength)))
+				{
+					rCount+=__builtin_ctz(uiCandidates);
+					return true;
 				}
 			}
-            else {
-				//Add the char
-				sMatchedString += rString[iCount];
 
-				//Save the new node
-				pNode=aIterator->second;
+		rCount+=32;
+	}
 
-				//Exit the loop
-				break;
-			}
-		}
+	//Nothing yet
+	return false;
+}
 
-		//Is this a final node?
-		if ((pNode->bFinal)>0) {
-			//We got our data
-			DataFound aData;
-//			aData.iFoundPosition = iCount-sMatchedString.length()+1;
-            aData.rule_id = pNode->bFinal;
-			aData.sDataFound = sMatchedString;
+__attribute__((target("ssse3")))
+bool CSuffixTrie::NextCandidateSSSE3(const unsigned char* pData,
+									 size_t iLast,
+									 size_t iLength,
+									 size_t& rCount)const
+{
+	//The nibble tables
+	__m128i aLow[PREFIX_VECTOR];
+	__m128i aHigh[PREFIX_VECTOR];
+	for (unsigned int uiPosition=0; uiPosition<PREFIX_VECTOR; ++uiPosition)
+	{
+		aLow[uiPosition]=_mm_loadu_si128((const __m128i*)m_aPrefixLow[uiPosition]);
+		aHigh[uiPosition]=_mm_loadu_si128((const __m128i*)m_aPrefixHigh[uiPosition]);
+	}
+	const __m128i aMask=_mm_set1_epi8(0x0f);
 
-			//Insert it
-			aVec.push_back(aData);
+	//The hash bitmap
+	const unsigned long long* pHash;
+	pHash=&m_aPrefixHash[0];
 
-			//Go back
-			iCount-=sMatchedString.length()-1;
+	//16 positions at a time
+	while (rCount+16<=iLast+1 &&
+		   rCount+16+PREFIX_VECTOR-1<=iLength)
+	{
+		//A position misses if any of its leading bytes is not there
+		unsigned int uiMissing;
+		uiMissing=0;
+		for (unsigned int uiPosition=0; uiPosition<PREFIX_VECTOR; ++uiPosition)
+		{
+			__m128i aData;
+			aData=_mm_loadu_si128((const __m128i*)(pData+rCount+uiPosition));
+			__m128i aBits;
+			aBits=_mm_and_si128(_mm_shuffle_epi8(aLow[uiPosition],_mm_and_si128(aData,aMask)),
+								_mm_shuffle_epi8(aHigh[uiPosition],_mm_and_si128(_mm_srli_epi16(aData,4),aMask)));
+			uiMissing|=(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(aBits,_mm_setzero_si128()));
+		}
 
-			//Reset the data
-			sMatchedString = "";
+		//Check the hash of the rest
+		for (unsigned int uiCandidates=~uiMissing&0xffff;
+			 uiCandidates;
+			 uiCandidates&=uiCandidates-1)
+		{
+			if (HasPrefix(pHash,HashPrefix(pData+rCount+__builtin_ctz(uiCandidates),m_uiPrefixLength)))
+			{
+				rCount+=__builtin_ctz(uiCandidates);
+				return true;
+			}
 		}
+
+		rCount+=16;
 	}
 
-	//Done
-	return aVec;
+	//Nothing yet
+	return false;
 }
+#endif
 
-CSuffixTrie::Node* CSuffixTrie::CloneNode(const Node* pNode)const
+size_t CSuffixTrie::NextCandidate(const unsigned char* pData,
+								  size_t iStart,
+								  size_t iLength)const
 {
-	//Sanity check
-	if (!pNode)
-		return NULL;
+	//Too short to check anything
+	if (iLength<m_uiPrefixLength)
+		return iStart;
 
-	//Create the new node
-	Node* pNewNode;
-	pNewNode=new Node;
+	//Last position we can check
+	size_t iLast;
+	iLast=iLength-m_uiPrefixLength;
 
-	//Copy the data
-	pNewNode->aChar=pNode->aChar;
-	pNewNode->bFinal=pNode->bFinal;
-	pNewNode->pFailureNode=NULL;
-	pNewNode->usDepth=pNode->usDepth;
+	//The hash bitmap
+	const unsigned long long* pHash;
+	pHash=&m_aPrefixHash[0];
 
-	//Now clone the sub nodes
-	for (SearchMap::const_iterator aIterator=pNode->aMap.begin();
-		 aIterator!=pNode->aMap.end();
-		 ++aIterator)
-	{
-		//Clone this sub node
-		Node* pSubNode;
-		pSubNode=CloneNode(aIterator->second);
+	size_t iCount;
+	iCount=iStart;
 
-		//Did we get it?
-		if (pSubNode)
-			//Insert it
-			pNewNode->aMap.insert(SearchMap::value_type(aIterator->first,pSubNode));
+#ifdef PREFILTER_VECTORS
+	//The widest vectors the cpu has, the narrower ones go on from where they stopped
+	if (PREFILTER_CPU_VECTORS>=pvAVX2 &&
+		NextCandidateAVX2(pData,iLast,iLength,iCount))
+		return iCount;
+
+	if (PREFILTER_CPU_VECTORS>=pvSSSE3 &&
+		NextCandidateSSSE3(pData,iLast,iLength,iCount))
+		return iCount;
+#endif
+
+	//One at a time (the rest, or all of it without vectors)
+	const unsigned char* pBytes;
+	pBytes=m_aPrefixBytes;
+
+	for (; iCount<=iLast; ++iCount)
+	{
+		//Are all the leading bytes there? (positions we don't check let everything pass)
+		//Near the end we go straight to the hash
+		if (iCount+PREFIX_MAX<=iLength &&
+			!(pBytes[pData[iCount]]&
+			  (pBytes[pData[iCount+1]]>>1)&
+			  (pBytes[pData[iCount+2]]>>2)&
+			  (pBytes[pData[iCount+3]]>>3)&1))
+			continue;
+
+		//And the hash
+		if (HasPrefix(pHash,PrefixHash(pData+iCount)))
+			return iCount;
 	}
 
-	//Done
-	return pNewNode;
+	//Only the positions we can't check are left
+	return iCount;
+}
+
+bool CSuffixTrie::SkipToCandidate(const unsigned char* pData,
+								  size_t iLength,
+								  unsigned short usDepth,
+								  size_t& rCount,
+								  size_t& rScanned)const
+{
+	//A state this deep has a candidate where its string starts, and a stream state
+	//may have started in the last chunk
+	if (usDepth>=m_uiPrefixLength || rCount<usDepth)
+		return false;
+
+	//Our string started at a position that wasn't checked yet, nothing started before it
+	size_t iStart;
+	iStart=rCount-usDepth;
+	if (iStart<rScanned)
+		return false;
+
+	//Find the next candidate, we check from after it next time
+	size_t iCandidate;
+	iCandidate=NextCandidate(pData,iStart,iLength);
+	rScanned=iCandidate+1;
+
+	//It overlaps what we walked, keep walking
+	if (iCandidate<rCount)
+		return false;
+
+	//Nothing starts before it
+	rCount=iCandidate;
+	return true;
+}
+
+size_t CSuffixTrie::GetDFASize()const
+{
+	return m_iDFAStates*(m_uiDFAClasses+dcCount)*sizeof(unsigned int)+
+		   sizeof(m_aDFAClasses)+
+		   m_iRules*sizeof(int);
+}
+
+size_t CSuffixTrie::GetCompactSize()const
+{
+	return m_aCompact.size()*sizeof(CompactState)+
+		   m_aCompactLabels.size()*sizeof(unsigned char)+
+		   m_aCompactChildren.size()*sizeof(unsigned int)+
+		   m_aCompactBitmaps.size()*sizeof(CompactBitmap);
 }
 
 bool CSuffixTrie::FindString(const SearchString& rString)const
 {
-	return SearchNode(rString,
-					  &m_aRoot)!=NULL;
+	return SearchNode(rString)!=0;
 }
 
 CSuffixTrie::StringsVector CSuffixTrie::GetAllStringsVector()const
@@ -477,7 +3593,7 @@ CSuffixTrie::StringsVector CSuffixTrie::GetAllStringsVector()const
 	StringsVector aVector;
 
 	//Start to build the trie
-	BuildStrings(aVector, "", &m_aRoot);
+	BuildStrings(aVector, "", 0);
 
 	//Done
 	return aVector;
@@ -504,78 +3620,131 @@ CSuffixTrie::StringsSet CSuffixTrie::GetAllStringsSet()const
 
 void CSuffixTrie::BuildStrings(StringsVector& rVector,
 							   const SearchString& rString,
-							   const Node* pNode)const
+							   NodeIndex uiNode)const
 {
-	//Sanity check
-	if (!pNode)
-		return;
-
 	//Is this a final node?
-	if (pNode->bFinal)
+	if (m_aNodes[uiNode].bFinal)
 		//Add to the vector
 		rVector.push_back(rString);
 
 	//Iterate all its children
-	for (SearchMap::const_iterator aIterator=pNode->aMap.begin();
-		 aIterator!=pNode->aMap.end();
-		 ++aIterator)
+	for (NodeIndex uiChild=m_aNodes[uiNode].uiChild;
+		 uiChild;
+		 uiChild=m_aNodes[uiChild].uiNext)
 		//Send it to next level
 		BuildStrings(rVector,
-					 rString+aIterator->first,
-					 aIterator->second);
+					 rString+m_aNodes[uiChild].aChar,
+					 uiChild);
 }
 
 void CSuffixTrie::DeleteString(const SearchString& rString)
 {
-	//Our prev node
-	Node* pPrevNode;
-	pPrevNode=NULL;
+	//Sanity check
+	if (rString.empty())
+		return;
 
-	//Start to find the nodes
-	for (int iCount=0;
+	//Find the nodes of the string
+	std::vector<NodeIndex> aPath;
+	aPath.push_back(0);
+
+	for (size_t iCount=0;
 		 iCount<rString.length();
 		 ++iCount)
 	{
-		//Find the node
-		Node* pNode;
-		pNode=SearchNode(rString.substr(iCount,rString.length()-iCount),
-						 &m_aRoot);
-
-		//Do we have a previous node?
-		if (pPrevNode &&
-			pNode)
-		{
-			//We need to delete it
-			pNode->aMap.erase(pPrevNode->aChar);
-			
-			//And delete the node
-			delete pPrevNode;
-			pPrevNode=NULL;
-		}
-
-		//Did we get it?
-		if (pNode)
-			//What stage are we?
-			if (!iCount)
-				//Does it have children?
-				if (pNode->aMap.empty())
-					//We can delete it
-					pPrevNode=pNode;
-				else
-				{
-					//Can't be final
-					pNode->bFinal=false;
+		//Look for the next node
+		NodeIndex uiChild;
+		uiChild=FindChild(aPath.back(),rString[iCount]);
 
-					//Exit
-					return;
-				}
-			//Do we have children
-			else if (pNode->aMap.empty())
-				//We can delete it
-				pPrevNode=pNode;
-			else
-				//Exit
-				return;
+		//Not there
+		if (!uiChild)
+			return;
+
+		//Next level
+		aPath.push_back(uiChild);
+	}
+
+	//Is it a word at all?
+	if (!m_aNodes[aPath.back()].bFinal)
+		return;
+
+	//Can't be final, its rules are gone
+	m_aWordRules[m_aNodes[aPath.back()].bFinal].clear();
+	m_aFreeWordRules.push_back(m_aNodes[aPath.back()].bFinal);
+	m_aNodes[aPath.back()].bFinal=0;
+
+	//The compiled forms still have it, the node walk takes over until they are rebuilt
+	if (IsCompiled())
+		ClearCompiled();
+
+	//Keep the index normalized
+	if (m_bIndexed)
+	{
+		//The nodes that reported us report our next word
+		ReplaceOutput(aPath.back(),
+					  aPath.back(),
+					  m_aNodes[aPath.back()].uiOutput);
+	}
+
+	//Delete the nodes that lead nowhere now, from the bottom up
+	while (aPath.size()>1 &&
+		   !m_aNodes[aPath.back()].uiChild &&
+		   !m_aNodes[aPath.back()].bFinal)
+	{
+		//Take it
+		NodeIndex uiNode;
+		uiNode=aPath.back();
+		aPath.pop_back();
+
+		//The nodes that failed to it fail where it failed (the next longest suffix)
+		if (m_bIndexed)
+			UnindexNode(uiNode);
+
+		//Unlink it from its parent
+		RemoveChild(aPath.back(),uiNode);
 	}
 }
-				
\ No newline at end of file
+
+void CSuffixTrie::UnindexNode(NodeIndex uiNode)
+{
+	//Leave our list
+	UnlinkFailure(uiNode);
+
+	//Where we fail to
+	NodeIndex uiFailure;
+	uiFailure=m_aNodes[uiNode].uiFailure;
+
+	//Collect the nodes failing to us (their output stays, we are not final)
+	std::vector<NodeIndex> aMove;
+
+	FailureMap::iterator aIterator;
+	aIterator=m_aFailureLists.lower_bound(FailureKey(uiNode,0,0));
+
+	while (aIterator!=m_aFailureLists.end() &&
+		   aIterator->first<FailureKey(uiNode+1,0,0))
+	{
+		//Take the list
+		for (NodeIndex uiChild=aIterator->second;
+			 uiChild;
+			 uiChild=m_aNodes[uiChild].uiFailNext)
+			aMove.push_back(uiChild);
+
+		//The list is gone
+		m_aFailureLists.erase(aIterator++);
+	}
+
+	//Move them
+	for (size_t iCount=0;
+		 iCount<aMove.size();
+		 ++iCount)
+	{
+		m_aNodes[aMove[iCount]].uiFailure=uiFailure;
+		LinkFailure(aMove[iCount]);
+	}
+}
+
+size_t CSuffixTrie::GetTrieSize()const
+{
+	return m_aNodes.capacity()*sizeof(Node)+
+		   m_aFreeNodes.capacity()*sizeof(NodeIndex)+
+		   m_aWordRules.capacity()*sizeof(RuleVector);
+}
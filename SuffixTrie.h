@@ -1,19 +1,24 @@
-#include <map>
+#ifndef SUFFIXTRIE_H
+#define SUFFIXTRIE_H
+
 #include <string>
 #include <vector>
 #include <set>
+#include <deque>
+#include <map>
+
+#include "Matcher.h"
 
-class CSuffixTrie {
+class CSuffixTrie : public CMatcher {
 
 public:
 	//Our string type
     typedef std::string SearchString;
 
-    static int string_id;
-    
     //Data returned from our search
 	typedef struct _DataFound {
 		int				iFoundPosition;
+		int				iEndPosition;	//Last char of the match
         int             rule_id;
 		SearchString	sDataFound;
 	} DataFound;
@@ -21,6 +26,20 @@ public:
 	//Our vector of data found
 	typedef std::vector<DataFound> DataFoundVector;
 
+	//Where a stream search is, lets the next chunk continue from here
+	//Copy it to fork the stream, it is only valid for the trie (and compiled form) that made it
+	typedef struct _StreamState {
+		unsigned int	uiState;	//Node/DFA/compact state
+		size_t			iOffset;	//Stream offset of the next chunk
+	} StreamState;
+
+	//A payload of a batch search
+	typedef struct _Payload {
+		const unsigned char*	pData;
+		size_t					iLength;
+		void*					pContext;	//Passed to the callback with the matches of this payload
+	} Payload;
+
 	//All the strings vector
 	typedef std::vector<SearchString> StringsVector;
 
@@ -35,28 +54,185 @@ public:
 	//Set format
 	StringsSet GetAllStringsSet()const;
 
-	//Clear the trie
+	//Clear the trie (keeps the case setting)
 	void Clear();
 
+	//Match the words regardless of (ASCII) case, this is set before adding strings
+	//The case is folded into the transitions, the searches cost the same and don't copy the data
+	//The strings are kept in lower case, returns false if the trie already has strings
+	bool SetNoCase(bool bNoCase);
+	bool GetNoCase()const;
+
 	//Build the tree index for Aho-Corasick
-	//This is done when all the strings has been added
+	//This is done when all the strings has been added (linear in the total strings length)
+	//It also builds the prefilter, the searches then skip the bytes no word can start at
+	//With build threads the failure links are found a level at a time, each thread takes part of it
 	void BuildTreeIndex();
 
-	//Add a string (will destroy normalization, caller is reponsible for this part)
-	void AddString(const SearchString& rString);
+	//Build with this many threads (0 is one per core, the default is 1)
+	//AddStrings and BuildTreeIndex (so Compile too) spread their work over them, the trie they
+	//build is the same one thread builds, node for node
+	void SetBuildThreads(unsigned int uiThreads);
+	unsigned int GetBuildThreads()const;
+
+	//Time the last build (tree index, DFA or compact) took, in milliseconds
+	double GetBuildTime()const;
+
+	//Add a string for a rule, returns the rule id (0 if the string is empty)
+	//With iRuleId 0 the trie gives the next id (ids start at 1 in every trie), an empty string
+	//uses up its id too, so the ids follow the rules
+	//A string added for many rules is one word, its matches report every rule it has
+	//Once BuildTreeIndex was called the index is repaired in place, only the links the string
+	//changes are touched (the DFA/compact forms are dropped until they are rebuilt)
+	virtual int AddString(const SearchString& rString,
+						  int iRuleId=0);
+
+	//Add many strings, each for the next rule id (like AddString on each of them in order)
+	//Into an empty trie the build threads insert them, each takes the strings of some leading bytes
+	//pRuleIds gets the rule id of every string (0 if the string is empty)
+	void AddStrings(const StringsVector& rStrings,
+					std::vector<int>* pRuleIds=NULL);
+
+	//Build the index and compile it to the engine the shape of the strings needs
+	//(the DFA while it fits the budget, else the compact encoding), GetStats tells which and why
+	virtual void Compile();
+
+	//What was compiled and why
+	virtual MatcherStats GetStats()const;
+
+	//A copy (a mapped image is copied to our own tables)
+	virtual CMatcher* Clone()const;
 
 	//Get string (is the string there?)
 	bool FindString(const SearchString& rString)const;
 
-	//Delete a string (will destroy normalization, caller is reponsible for this part)
+	//Delete a string, with all its rules (the index is repaired like in AddString)
 	void DeleteString(const SearchString& rString);
 
-	//Do an actual find for the first match
+	//Do an actual find for the first match (the one that ends first, the search stops there)
 	DataFound SearchAhoCorasik(const SearchString& rString)const;
 
 	//Do an actual find for all the matches
 	DataFoundVector SearchAhoCorasikMultiple(const SearchString& rString)const;
 
+	//Find every match (including words ending inside other words) in one forward pass
+	DataFoundVector SearchAhoCorasikAll(const SearchString& rString)const;
+
+	//Compile the trie into a dense DFA (goto table with the failure transitions folded in)
+	//This is done after BuildTreeIndex, each input byte then costs one table load
+	//The rows have a transition per byte class, not per byte (the bytes no word has are one class)
+	//Returns false if the trie has more states than a DFA can number (there is no DFA then)
+	bool BuildDFA();
+
+	//Do a find for all the matches using the DFA
+	DataFoundVector SearchDFAMultiple(const SearchString& rString)const;
+
+	//Profile guided layout of the DFA, this is done after BuildDFA (and before SaveImage/SaveHeader)
+	//Count the states a sample of real traffic visits, the counts add up over the calls
+	void ProfileDFA(const unsigned char* pData,
+					size_t iLength);
+
+	//Renumber the states by the profile, the visited ones first (hottest first) so they share
+	//cache lines and pages, then the cold ones (the deep chains) in the order they had
+	//The matches don't change, returns false if there is no profile or the DFA is a mapped image
+	bool LayoutDFA();
+
+	//Save the DFA (and the prefilter) as a binary image, this is done after BuildDFA
+	//The image has no pointers, any process (with the same byte order) can map it
+	bool SaveImage(const char* pFileName)const;
+
+	//Map a saved image and search straight from it, processes mapping the same file share its pages
+	//The trie then has only the DFA, no strings (updating it drops the image), and the case of the
+	//trie that saved it
+	//Returns false if the image is not there, is from another version or is corrupt
+	//Checking the whole image reads all of it (the checksum, then every state and link, so a bad
+	//image can't walk out of the tables or loop), bVerify=false only checks the header (for images
+	//you trust), the load then takes no time at all
+	bool LoadImage(const char* pFileName,
+				   bool bVerify=true);
+
+	//Write the DFA as a C++ header, for rule sets that are built into the program
+	//The tables are constant data (constexpr where the compiler has it) in namespace pName,
+	//with a search function for them, the header needs nothing of ours
+	//This is done after BuildDFA, returns false if there is no DFA or pName is not a name
+	bool SaveHeader(const char* pFileName,
+					const char* pName)const;
+
+	//Compile the trie into the compact sparse encoding (for very large rule sets)
+	//This is done after BuildTreeIndex, it needs a fraction of the DFA memory
+	void BuildCompact();
+
+	//Do a find for all the matches using the compact encoding
+	DataFoundVector SearchCompactMultiple(const SearchString& rString)const;
+
+	//Search raw bytes (a capture buffer) and call pCallback for every match
+	//Uses the DFA or the compact encoding if built, no allocations are done
+	virtual void SearchBytes(const unsigned char* pData,
+							 size_t iLength,
+							 MatchCallback pCallback,
+							 void* pContext)const;
+
+	//Search raw bytes into a caller owned buffer, stops when it is full
+	//Returns the number of matches saved
+	size_t SearchBytes(const unsigned char* pData,
+					   size_t iLength,
+					   Match* pMatches,
+					   size_t iMaxMatches)const;
+
+	//Searches that keep only what they return, each one compiles to its own loop
+	//Did anything match? (stops at the first word)
+	virtual bool SearchExists(const unsigned char* pData,
+							  size_t iLength)const;
+
+	//The first match (the one that ends first), returns false if there is none
+	bool SearchFirst(const unsigned char* pData,
+					 size_t iLength,
+					 Match& rMatch)const;
+
+	//How many matches
+	virtual size_t SearchCount(const unsigned char* pData,
+							   size_t iLength)const;
+
+	//Set the bit of every rule that matched (bit rule_id of pRules, it has iRuleWords words)
+	//Bits are only set, so one buffer can collect many searches, ids past the buffer are ignored
+	virtual void SearchRules(const unsigned char* pData,
+							 size_t iLength,
+							 unsigned long long* pRules,
+							 size_t iRuleWords)const;
+
+	//Search many (small) payloads, like a burst of packets
+	//With the DFA the payloads are walked together, a byte of each in turn, so the table
+	//loads of one hide behind the others. Matches are the same as SearchBytes on each one,
+	//returning false from the callback stops only that payload
+	void SearchBatch(const Payload* pPayloads,
+					 size_t iPayloads,
+					 MatchCallback pCallback)const;
+
+	//Search one large buffer (a capture dump, a reassembled object) with many threads
+	//(0 is one per core), each scans a chunk starting the longest word-1 bytes before it and keeps
+	//the matches that end in it. rMatches gets the matches SearchBytes finds, in the same order
+	//Returns the number of matches
+	size_t SearchParallel(const unsigned char* pData,
+						  size_t iLength,
+						  std::vector<Match>& rMatches,
+						  unsigned int uiThreads=0)const;
+
+	//Start a new stream
+	static void ResetStream(StreamState& rStream);
+
+	//Search the next chunk of a stream, matches can span chunks
+	//Offsets are relative to the start of the stream
+	void SearchStream(StreamState& rStream,
+					  const unsigned char* pData,
+					  size_t iLength,
+					  MatchCallback pCallback,
+					  void* pContext)const;
+
+	//Memory used by the trie and the compiled tables (in bytes)
+	size_t GetTrieSize()const;
+	size_t GetDFASize()const;
+	size_t GetCompactSize()const;
+
 	//Assigmnet operator
 	CSuffixTrie& operator=(const CSuffixTrie& rTrie);
 
@@ -69,42 +245,303 @@ private:
 //	typedef wchar_t SearchChar; //********************************************************************
     typedef char SearchChar;
 
-	//Forward declare the node
-	struct _Node;
-
-	//Our map
-	typedef std::map <SearchChar,_Node*> SearchMap;
+	//Index of a node in the arena, 0 is the root (and "none" for the links)
+	typedef unsigned int NodeIndex;
 
-	//Our node
+	//Our node, nodes live in one arena and link by index
 	typedef struct _Node
 	{
-		SearchChar		aChar;	//Our character
-		int             bFinal; //Do we have a word here
-		SearchMap		aMap;	//Our next nodes
-		_Node*			pFailureNode;	//Where we go incase of failure
+		int             bFinal; //Our rules in the word rules (0 if no word ends here)
+		NodeIndex		uiChild;	//Our first child (children are sorted by char)
+		NodeIndex		uiNext;		//Our next sibling
+		NodeIndex		uiFailure;	//Where we go incase of failure
+		NodeIndex		uiOutput;	//Next final node on our failure chain
+		NodeIndex		uiParent;	//Our parent
+		NodeIndex		uiFailPrev;	//Previous/next node in our failure list
+		NodeIndex		uiFailNext;
 		unsigned short	usDepth;	//Depth of this level
+		SearchChar		aChar;	//Our character
 	} Node;
+
+	//The node arena
+	typedef std::vector<Node> NodeVector;
+
+	//The rules of a word (sorted)
+	typedef std::vector<int> RuleVector;
+
+	//Where each rule list of the compiled forms is
+	typedef std::map<RuleVector,unsigned int> RuleListMap;
+
+	//Heads of the lists of nodes with the same failure node, char and parent char
+	//(key is failure<<16|char<<8|parent char)
+	typedef std::map<unsigned long long,NodeIndex> FailureMap;
+
+	//Dense DFA, a row per state with a transition per byte class, then the state data
+	//States are the offsets of their rows (the root is 0), so a move is one add and one load
+	typedef std::vector<unsigned int> DFAVector;
+
+	//The state data after the transitions of a DFA row
+	enum DFAColumn {
+		dcDepth,	//Depth of the state
+		dcFinal,	//Rule list (0 if no word ends here)
+		dcOutput,	//Next final state on the failure chain (0 if none)
+		dcCount
+	};
+
+	//Set on a DFA transition when the target state has words to report
+	static const unsigned int DFA_FINAL = 0x80000000;
+
+	//Set on a DFA transition when the target state is as deep as the prefilter (it can't skip there)
+	static const unsigned int DFA_DEEP = 0x40000000;
+
+	//The state without the marks
+	static const unsigned int DFA_STATE = 0x3fffffff;
+
+	//How the children of a compact state are kept
+	enum CompactType {
+		ctLeaf,		//No children
+		ctChain,	//One child, it is the next state
+		ctSorted,	//Few children, sorted label/child arrays
+		ctBitmap	//Many children, bitmap and popcount into the child array
+	};
+
+	//Nodes with more children than this use a bitmap
+	static const unsigned int COMPACT_SORTED_MAX = 8;
+
+	//A compact state (20 bytes)
+	typedef struct _CompactState {
+		unsigned int	uiFailure;	//Where we go incase of failure
+		unsigned int	uiOutput;	//Next final state on our failure chain
+		int				bFinal;		//Our rule list (0 if no word ends here)
+		unsigned int	uiChildren;	//Chain: the label, sorted: first child index, bitmap: bitmap index
+		unsigned char	ucType;		//The CompactType
+		unsigned char	ucCount;	//Number of sorted children
+		unsigned short	usDepth;	//Depth of this level
+	} CompactState;
+
+	//A bitmap for a dense compact state
+	typedef struct _CompactBitmap {
+		unsigned long long	aBits[4];	//Which bytes we have a child for
+		unsigned int		uiChildren;	//First child index
+	} CompactBitmap;
+
+	//The tables of a saved image
+	enum ImageTable {
+		itDFA,			//The DFA rows
+		itClasses,		//Byte classes
+		itRules,		//Rule lists
+		itPrefixLow,	//The prefilter
+		itPrefixHigh,
+		itPrefixBytes,
+		itPrefixHash,
+		itCount
+	};
+
+	//Version of the image format, bump it when the layout changes
+	static const unsigned int IMAGE_VERSION = 4;
+
+	//What an image was built with
+	enum ImageFlag {
+		ifNoCase=1		//Case-insensitive (the folding is in the byte classes)
+	};
+
+	//Header of a saved image, the tables follow it (64 byte aligned)
+	typedef struct _ImageHeader {
+		char				aMagic[8];			//"SFXTRIE"
+		unsigned int		uiVersion;			//IMAGE_VERSION
+		unsigned int		uiByteOrder;		//0x01020304 as the writer stored it
+		unsigned long long	ullSize;			//Of the whole image
+		unsigned long long	ullChecksum;		//Of everything after the header
+		unsigned int		uiStates;			//DFA states
+		unsigned int		uiClasses;			//Byte classes
+		unsigned int		uiPrefixLength;		//Leading bytes the prefilter checks (0 if none)
+		unsigned int		uiRules;			//Size of the rule lists (in ids)
+		unsigned int		uiMaxDepth;			//Of the deepest state
+		unsigned int		uiFlags;			//ImageFlag bits
+		unsigned long long	aOffsets[itCount];	//Where each table starts (from the image start)
+		unsigned long long	aSizes[itCount];	//And its size in bytes
+	} ImageHeader;
+
+	//How many payloads a batch search walks together
+	static const unsigned int BATCH_LANES = 8;
+
+	//A payload being walked by a batch search
+	typedef struct _BatchLane {
+		const Payload*	pPayload;
+		size_t			iCount;		//Next byte
+		size_t			iScanned;	//Where to prefilter from
+		unsigned int	uiState;	//DFA state
+	} BatchLane;
+
+	//Levels with fewer nodes are linked by one thread, the others are not worth starting
+	static const unsigned int PARALLEL_MIN_NODES = 4096;
+
+	//A parallel search gives no thread a smaller chunk than this (bytes)
+	static const unsigned int PARALLEL_MIN_CHUNK = 256*1024;
+
+	//Most leading bytes the prefilter hashes, and how many of them it checks with vectors
+	static const unsigned int PREFIX_MAX = 4;
+	static const unsigned int PREFIX_VECTOR = 3;
 private:
-	//Add a string to a node
-	void AddString(const SearchString& rString,
-				   Node* pNode);
+	//Find the child of a node (0 if none)
+	NodeIndex FindChild(NodeIndex uiNode,
+						SearchChar aChar)const;
+
+	//Add a child to a node (sorted by char)
+	NodeIndex AddChild(NodeIndex uiNode,
+					   SearchChar aChar);
+
+	//Unlink a child and free it
+	void RemoveChild(NodeIndex uiNode,
+					 NodeIndex uiChild);
+
+	//Where a child with this char of this node fails to
+	NodeIndex FindFailure(NodeIndex uiParent,
+						  SearchChar aChar)const;
+
+	//Drop the compiled forms
+	void ClearCompiled();
+
+	//Do we have a compiled form (or an index) a new string would make stale?
+	//A copy of an image has its DFA but no index
+	bool IsCompiled()const;
+
+	//Build the rule lists of the compiled forms, rLists gets the list of every word
+	void BuildRuleLists(std::vector<unsigned int>& rLists);
+
+	//The shape of our strings
+	MatcherShape GetShape()const;
+
+	//How many threads we build with
+	unsigned int GetThreadCount()const;
+
+	//Set the failure/output links of every node, with one thread or many
+	void BuildLinks();
+	void BuildLinksParallel(unsigned int uiThreads);
+
+	//The threads of the parallel builds, pContext is their worker (see SuffixTrie.cpp)
+	static void* InsertThread(void* pContext);
+	static void* IndexThread(void* pContext);
+
+	//The thread of a parallel search, pContext is its worker
+	static void* ScanThread(void* pContext);
+
+	//Depth of the deepest state of the form we search with (no word is longer)
+	unsigned short GetMaxDepth()const;
+
+	//Set the failure/output links of a new node, and move the nodes that now fail to it
+	void IndexNewNode(NodeIndex uiNode);
+
+	//Move the nodes that fail to a node we are deleting
+	void UnindexNode(NodeIndex uiNode);
+
+	//Does the string of a node end with the string of another?
+	bool EndsWith(NodeIndex uiNode,
+				  NodeIndex uiSuffix)const;
+
+	//Replace the output link of the nodes failing (directly or through non final nodes) into a node
+	void ReplaceOutput(NodeIndex uiNode,
+					   NodeIndex uiOld,
+					   NodeIndex uiNew);
+
+	//Add/remove a node from its failure list
+	void LinkFailure(NodeIndex uiNode);
+	void LinkFailure(NodeIndex uiNode,
+					 FailureMap& rLists);
+	void UnlinkFailure(NodeIndex uiNode);
+
+	//Key of a failure list
+	static unsigned long long FailureKey(NodeIndex uiFailure,
+										 SearchChar aChar,
+										 SearchChar aParentChar);
+	unsigned long long FailureKey(NodeIndex uiNode)const;
+
+	//Search for a non final string
+	//If not found then it will get the root node (0)
+	NodeIndex SearchNode(const SearchString& rString)const;
+
+	//The search kernels (node walk, DFA and compact encoding)
+	//They are compiled for each result policy (see SuffixTrie.cpp), rPolicy.Report(rMatch) gets
+	//every match and returns false to stop, so a kernel only does what its policy keeps
+	template<class Policy>
+	void SearchNodes(StreamState& rStream,
+					 const unsigned char* pData,
+					 size_t iLength,
+					 Policy& rPolicy)const;
+	template<class Policy>
+	void SearchDFA(StreamState& rStream,
+				   const unsigned char* pData,
+				   size_t iLength,
+				   Policy& rPolicy)const;
+	template<class Policy>
+	void SearchCompact(StreamState& rStream,
+					   const unsigned char* pData,
+					   size_t iLength,
+					   Policy& rPolicy)const;
+
+	//Search with the best compiled form we have
+	template<class Policy>
+	void SearchKernel(StreamState& rStream,
+					  const unsigned char* pData,
+					  size_t iLength,
+					  Policy& rPolicy)const;
+
+	//Point the DFA (and the rule lists) at our vectors
+	void SetDFATables();
+
+	//Drop the mapped image (if we have one)
+	void UnmapImage();
+
+	//Checksum of an image body (a multiple of 8 bytes)
+	static unsigned long long ImageChecksum(const unsigned char* pData,
+											size_t iSize);
+
+	//Walk one byte of a batch payload with the DFA, returns false when the payload is done
+	bool SearchBatchStep(BatchLane& rLane,
+						 MatchCallback pCallback)const;
 
-	//Search for a non final string (this is to build the index)
-	//If not found then it will get the root node
-	const Node* SearchNode(const SearchString& rString,
-						   const Node* pNode)const;
-	Node* SearchNode(const SearchString& rString,
-					 Node* pNode);
+	//Build/drop the prefilter
+	void BuildPrefilter();
+	void ClearPrefilter();
 
-	//Build the node index
-	void BuildIndex(const SearchString& rString,
-					Node* pNode);
+	//Hash of the leading bytes at a position (there must be m_uiPrefixLength bytes)
+	//Each 16 bit half is a bit of the hash bitmap
+	unsigned int PrefixHash(const unsigned char* pData)const;
 
-	//Delete a node
-	void DeleteNode(Node* pNode)const;
+	//First position from iStart some word may start at (iLength if none)
+	//The last m_uiPrefixLength-1 positions can't be checked, they are always candidates
+	size_t NextCandidate(const unsigned char* pData,
+						 size_t iStart,
+						 size_t iLength)const;
 
-	//Clone a node
-	Node* CloneNode(const Node* pNode)const;
+#if defined(__x86_64__) || defined(__i386__)
+	//The vector loops of NextCandidate, each for the cpus that have its instructions
+	//From rCount on while the vectors fit, true if they found a candidate (at rCount), else
+	//rCount is where they stopped
+	__attribute__((target("avx2")))
+	bool NextCandidateAVX2(const unsigned char* pData,
+						   size_t iLast,
+						   size_t iLength,
+						   size_t& rCount)const;
+	__attribute__((target("ssse3")))
+	bool NextCandidateSSSE3(const unsigned char* pData,
+							size_t iLast,
+							size_t iLength,
+							size_t& rCount)const;
+#endif
+
+	//Called by the kernels at every position, with the depth of the state we are at
+	//If no word can start before the next candidate, moves rCount to it and returns true (go to the root)
+	//rScanned is where the kernel should prefilter from next, start it at 0
+	bool SkipToCandidate(const unsigned char* pData,
+						 size_t iLength,
+						 unsigned short usDepth,
+						 size_t& rCount,
+						 size_t& rScanned)const;
+
+	//Find the child of a compact state (0 if none)
+	unsigned int CompactChild(unsigned int uiState,
+							  unsigned char ucChar)const;
 
 	//Clone the entire trie
 	void CloneTrie(CSuffixTrie& rTarget)const;
@@ -112,8 +549,93 @@ private:
 	//Insert a string into a vector
 	void BuildStrings(StringsVector& rVector,
 				      const SearchString& rString,
-					  const Node* pNode)const;
+					  NodeIndex uiNode)const;
+
+	//Our nodes, the root is the first
+	NodeVector m_aNodes;
+
+	//Deleted nodes we can reuse
+	std::vector<NodeIndex> m_aFreeNodes;
+
+	//The children of the root by char (it has the most)
+	NodeIndex m_aRootChildren[256];
+
+	//Who fails where, for the incremental updates
+	FailureMap m_aFailureLists;
+
+	//The rules of every word (0 is not a word), and the ones we can reuse
+	std::vector<RuleVector> m_aWordRules;
+	std::vector<int> m_aFreeWordRules;
+
+	//The rule lists of the compiled forms, each is its count and then its ids
+	//Words with the same rules share a list (index 0 is no list)
+	std::vector<int> m_aRules;
+
+	//The rule lists the compiled searches use, our vector or a mapped image
+	const int* m_pRules;
+	size_t m_iRules;
+
+	//The last rule id we gave (or were given)
+	int m_iRuleId;
+
+	//Was the index built? (then we keep it normalized)
+	bool m_bIndexed;
+
+	//Do we ignore case?
+	bool m_bNoCase;
+
+	//What each byte is matched as (itself, or its lower case with no case)
+	unsigned char m_aFold[256];
+
+	//The DFA, state 0 is the root
+	DFAVector m_aDFA;
 
-	//Our root node
-	Node m_aRoot;
+	//The DFA the searches use, our vector or a mapped image (NULL if there is no DFA)
+	const unsigned int* m_pDFA;
+	size_t m_iDFAStates;
+
+	//How often the profile visited each DFA state (empty if there is no profile)
+	std::vector<unsigned long long> m_aDFAVisits;
+
+	//The byte class of each byte, and how many there are (the rows have a transition per class)
+	unsigned char m_aDFAClasses[256];
+	unsigned int m_uiDFAClasses;
+
+	//The mapped image (NULL if none)
+	void* m_pImage;
+	size_t m_iImageSize;
+
+	//The compact encoding, state 0 is the root and a chain child is always the next state
+	std::vector<CompactState> m_aCompact;
+
+	//Children of the sorted and bitmap states (labels and states, same index)
+	std::vector<unsigned char> m_aCompactLabels;
+	std::vector<unsigned int> m_aCompactChildren;
+
+	//Bitmaps of the dense states
+	std::vector<CompactBitmap> m_aCompactBitmaps;
+
+	//How many leading bytes of every word the prefilter checks (0 if there is no prefilter)
+	unsigned int m_uiPrefixLength;
+
+	//Nibble tables of the leading bytes we check with vectors (a bit per group of high nibbles)
+	unsigned char m_aPrefixLow[PREFIX_VECTOR][16];
+	unsigned char m_aPrefixHigh[PREFIX_VECTOR][16];
+
+	//Which bytes are leading bytes (a bit per position)
+	unsigned char m_aPrefixBytes[256];
+
+	//Hash bitmap of the leading bytes of the words (64K bits, each hash sets the bits of its two halves)
+	std::vector<unsigned long long> m_aPrefixHash;
+
+	//Time of the last build
+	double m_dBuildTime;
+
+	//Threads to build with (0 is one per core)
+	unsigned int m_uiBuildThreads;
+
+	//Why the compiled form we have was picked (empty if it was built by hand)
+	std::string m_sReason;
 };
+
+#endif
@@ -16,5 +16,12 @@ int main(int argc, char* argv[])
 	for (int iCount=0; iCount<aDataFound.size(); ++iCount)
 		printf("%s %i\n",aDataFound[iCount].sDataFound.c_str(),aDataFound[iCount].iFoundPosition);
 
+	//All the matches, the words inside other words too
+	printf("All matches:\n");
+	aDataFound=aTree.SearchAhoCorasikAll("1236h6h6barakoo6arakoo123");
+
+	for (size_t iCount=0; iCount<aDataFound.size(); ++iCount)
+		printf("%s %i\n",aDataFound[iCount].sDataFound.c_str(),aDataFound[iCount].iFoundPosition);
+
 return 0;
 }
@@ -0,0 +1,177 @@
+//Built rule set TestHeader, written by CSuffixTrie::SaveHeader, don't edit
+//31 states, 15 byte classes, 2568 bytes of tables
+#ifndef TESTHEADER_H
+#define TESTHEADER_H
+
+#include <stddef.h>
+
+//The tables are constant data, constexpr where the compiler has it
+#ifndef SUFFIXTRIE_CONSTEXPR
+#if __cplusplus>=201103L
+#define SUFFIXTRIE_CONSTEXPR constexpr
+#else
+#define SUFFIXTRIE_CONSTEXPR const
+#endif
+#endif
+
+namespace TestHeader {
+
+//A match
+typedef struct _Match {
+	int		rule_id;
+	size_t	iFoundPosition;	//First char of the match
+	size_t	iEndPosition;	//Last char of the match
+} Match;
+
+//A row per state with a transition per byte class, then the depth, rule list and output columns
+//States are the offsets of their rows (the root is 0)
+static SUFFIXTRIE_CONSTEXPR unsigned int CLASSES = 15;
+static SUFFIXTRIE_CONSTEXPR unsigned int STATES = 31;
+static SUFFIXTRIE_CONSTEXPR unsigned int COLUMN_DEPTH = 15;
+static SUFFIXTRIE_CONSTEXPR unsigned int COLUMN_FINAL = 16;
+static SUFFIXTRIE_CONSTEXPR unsigned int COLUMN_OUTPUT = 17;
+
+//Set on a transition when the target state has words to report, and the state without the marks
+static SUFFIXTRIE_CONSTEXPR unsigned int DFA_FINAL = 0x80000000;
+static SUFFIXTRIE_CONSTEXPR unsigned int DFA_STATE = 0x3fffffff;
+
+//The byte class of each byte
+static SUFFIXTRIE_CONSTEXPR unsigned char aClasses[256] = {
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,2,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,3,0,4,0,0,0,0,0,0,0,0,
+	0,0,0,0,5,0,0,0,0,0,0,0,0,0,0,0,
+	0,6,7,0,0,8,0,0,9,10,0,11,0,0,0,12,
+	0,0,13,14,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+};
+
+//The DFA
+static SUFFIXTRIE_CONSTEXPR unsigned int aDFA[558] = {
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0x6c,0x0,
+	0x0,0x0,
+	0x0,0x0,0x0,0x4000007e,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0x6c,0x1,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x40000090,0x6c,0x1,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x400000a2,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0x6c,0x1,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x400000b4,0x6c,0x1,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0xc00000c6,0x5a,0x400000d8,0x0,0x0,0x0,0x6c,0x1,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x400000ea,0x0,0x0,0x0,0x0,0x6c,0x1,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x400000fc,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0x6c,0x2,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x4000010e,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0x6c,0x2,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x40000120,0x6c,0x2,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0xc0000132,0x2,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x40000144,0x6c,0x2,
+	0x1,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0xc0000156,0x2,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0xc0000168,0x5a,0x400000d8,0x0,0x0,0x0,0x6c,0x2,
+	0x0,0x0,
+	0x0,0x4000017a,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0x6c,0x3,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x4000018c,0x0,0x40000090,0x6c,0x3,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x4000019e,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0x6c,0x3,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x400000ea,0x0,0x0,0x0,0x0,0x6c,0x3,
+	0x12,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0xc00001b0,0x3,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x400000ea,0x0,0x0,0x0,0x0,0x6c,0x3,
+	0x6,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x40000144,0x6c,0x3,
+	0x3,0xc6,
+	0x0,0x0,0xc00001c2,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0x6c,0x4,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x400001d4,0x0,0x6c,0x4,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0xc00001e6,0x0,0x40000090,0x6c,0x4,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x400000ea,0x0,0x0,0x0,0x0,0x6c,0x4,
+	0x8,0x132,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0x6c,0x5,
+	0x10,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0xc00001f8,0x0,0x6c,0x5,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x4000020a,0x0,0x6c,0x5,
+	0xa,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0x6c,0x6,
+	0xc,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0xc000021c,0x0,0x6c,0x6,
+	0x0,0x0,
+	0x0,0x0,0x0,0x0,0x12,0x0,0x24,0x36,0x48,0x5a,0x0,0x0,0x0,0x0,0x6c,0x7,
+	0xe,0x1f8
+};
+
+//The rule lists of the words, each is its count and then its ids
+static SUFFIXTRIE_CONSTEXPR int aRules[20] = {
+	0,1,1,2,2,9,1,3,1,4,1,5,1,6,1,7,
+	1,8,1,10
+};
+
+//Search the data, rCallback(rMatch) is called for every match, return false from it to stop
+//It is a function or a functor (taken by value, like the std algorithms), both are inlined
+template<class Callback>
+inline void Search(const unsigned char* pData,
+				   size_t iLength,
+				   Callback rCallback)
+{
+	unsigned int uiState;
+	uiState=0;
+
+	for (size_t iCount=0; iCount<iLength; ++iCount)
+	{
+		//One load per byte
+		uiState=aDFA[(uiState&DFA_STATE)+aClasses[pData[iCount]]];
+
+		//Do we have words here?
+		if (uiState&DFA_FINAL)
+		{
+			unsigned int uiRow;
+			uiRow=uiState&DFA_STATE;
+
+			//Report us and then the dictionary chain
+			for (unsigned int uiOutput=aDFA[uiRow+COLUMN_FINAL]?uiRow:aDFA[uiRow+COLUMN_OUTPUT];
+				 uiOutput;
+				 uiOutput=aDFA[uiOutput+COLUMN_OUTPUT])
+			{
+				//A match per rule of the word
+				const int* pRules;
+				pRules=aRules+aDFA[uiOutput+COLUMN_FINAL];
+
+				for (int iRule=1; iRule<=pRules[0]; ++iRule)
+				{
+					Match aMatch;
+					aMatch.rule_id=pRules[iRule];
+					aMatch.iFoundPosition=iCount+1-aDFA[uiOutput+COLUMN_DEPTH];
+					aMatch.iEndPosition=iCount;
+
+					if (!rCallback(aMatch))
+						return;
+				}
+			}
+		}
+	}
+}
+
+}
+
+#endif
@@ -0,0 +1,2353 @@
+//Randomized checks of the matchers against a naive scan
+//Random rule sets are searched on random data with every engine and search path, each must find
+//the matches the naive scan finds. Returns 0 if they all did
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <regex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+
+#include "SuffixTrie.h"
+#include "WuManber.h"
+#include "RegexMatcher.h"
+#include "TriePublisher.h"
+#include "TestHeader.h"
+
+//A rule of a random rule set
+typedef struct _Rule {
+	std::string	sString;
+	int			iRuleId;
+} Rule;
+
+typedef std::vector<Rule> RuleVector;
+
+//The matches of a search
+typedef std::vector<CMatcher::Match> MatchVector;
+
+//How many rule sets each test takes, and how many payloads each set is searched on
+static const int TEST_SETS = 40;
+static const int TEST_PAYLOADS = 30;
+
+//Words of the rule bitmaps, the rule ids stay below 64 of them
+static const size_t RULE_WORDS = 64;
+
+//The checks that failed
+static int g_iChecks=0;
+static int g_iFailures=0;
+
+//A random string of these bytes
+static std::string RandomString(size_t iLength,
+								const char* pBytes)
+{
+	size_t iBytes;
+	iBytes=strlen(pBytes);
+
+	std::string sString;
+	for (size_t iCount=0;
+		 iCount<iLength;
+		 ++iCount)
+		sString+=pBytes[rand()%iBytes];
+
+	return sString;
+}
+
+//A random rule set, some strings are given to more than one rule
+static RuleVector RandomRules(int iRules,
+							  size_t iMaxLength,
+							  const char* pBytes)
+{
+	RuleVector aRules;
+	for (int iRule=1;
+		 iRule<=iRules;
+		 ++iRule)
+	{
+		Rule aRule;
+		aRule.iRuleId=iRule;
+		if (!aRules.empty() && !(rand()%8))
+			aRule.sString=aRules[rand()%aRules.size()].sString;
+		else
+			aRule.sString=RandomString(1+rand()%iMaxLength,pBytes);
+		aRules.push_back(aRule);
+	}
+
+	return aRules;
+}
+
+//Random data with the strings of some rules in it, so long strings match too
+static std::string RandomPayload(const RuleVector& rRules,
+								 size_t iLength,
+								 const char* pBytes)
+{
+	std::string sData;
+	while (sData.length()<iLength)
+		if (!rRules.empty() && !(rand()%4))
+			sData+=rRules[rand()%rRules.size()].sString;
+		else
+			sData+=RandomString(1+rand()%10,pBytes);
+
+	return sData;
+}
+
+//Every match of every rule, by trying each of them at each byte
+static MatchVector NaiveScan(const RuleVector& rRules,
+							 const std::string& rData)
+{
+	MatchVector aMatches;
+	for (size_t iRule=0;
+		 iRule<rRules.size();
+		 ++iRule)
+	{
+		const std::string& rString=rRules[iRule].sString;
+		for (size_t iPos=rData.find(rString);
+			 iPos!=std::string::npos;
+			 iPos=rData.find(rString,iPos+1))
+		{
+			CMatcher::Match aMatch;
+			aMatch.rule_id=rRules[iRule].iRuleId;
+			aMatch.iFoundPosition=iPos;
+			aMatch.iEndPosition=iPos+rString.length()-1;
+			aMatches.push_back(aMatch);
+		}
+	}
+
+	return aMatches;
+}
+
+//Matches by rule, end and start
+static bool MatchLess(const CMatcher::Match& rA,
+					  const CMatcher::Match& rB)
+{
+	if (rA.rule_id!=rB.rule_id)
+		return rA.rule_id<rB.rule_id;
+	if (rA.iEndPosition!=rB.iEndPosition)
+		return rA.iEndPosition<rB.iEndPosition;
+	return rA.iFoundPosition<rB.iFoundPosition;
+}
+
+//The same matches (in any order)?
+static bool SameMatches(MatchVector aA,
+						MatchVector aB)
+{
+	if (aA.size()!=aB.size())
+		return false;
+
+	std::sort(aA.begin(),aA.end(),MatchLess);
+	std::sort(aB.begin(),aB.end(),MatchLess);
+
+	for (size_t iMatch=0;
+		 iMatch<aA.size();
+		 ++iMatch)
+		if (MatchLess(aA[iMatch],aB[iMatch]) ||
+			MatchLess(aB[iMatch],aA[iMatch]))
+			return false;
+
+	return true;
+}
+
+//Count a check, tell about the first failures
+static void Check(bool bPassed,
+				  const char* pWhat,
+				  const std::string& rData)
+{
+	++g_iChecks;
+	if (bPassed)
+		return;
+
+	if (++g_iFailures<=10)
+		printf("FAILED %s on \"%s\"\n",pWhat,rData.c_str());
+}
+
+//Collects the matches of a callback search
+static bool CollectMatch(const CMatcher::Match& rMatch,
+						 void* pContext)
+{
+	((MatchVector*)pContext)->push_back(rMatch);
+	return true;
+}
+
+//The matches of the string searches
+static MatchVector FromDataFound(const CSuffixTrie::DataFoundVector& rFound)
+{
+	MatchVector aMatches;
+	for (size_t iFound=0;
+		 iFound<rFound.size();
+		 ++iFound)
+	{
+		CMatcher::Match aMatch;
+		aMatch.rule_id=rFound[iFound].rule_id;
+		aMatch.iFoundPosition=rFound[iFound].iFoundPosition;
+		aMatch.iEndPosition=rFound[iFound].iEndPosition;
+		aMatches.push_back(aMatch);
+	}
+
+	return aMatches;
+}
+
+//The rules set in a rule bitmap
+static bool SameRules(const MatchVector& rMatches,
+					  const unsigned long long* pRules,
+					  size_t iRuleWords)
+{
+	std::vector<unsigned long long> aExpected(iRuleWords,0);
+	for (size_t iMatch=0;
+		 iMatch<rMatches.size();
+		 ++iMatch)
+		aExpected[rMatches[iMatch].rule_id>>6]|=1ULL<<(rMatches[iMatch].rule_id&63);
+
+	return std::equal(aExpected.begin(),aExpected.end(),pRules);
+}
+
+//The policy searches of a matcher
+static void CheckPolicies(const CMatcher& rMatcher,
+						  const MatchVector& rExpected,
+						  const std::string& rData,
+						  const char* pWhat)
+{
+	const unsigned char* pData;
+	pData=(const unsigned char*)rData.data();
+
+	MatchVector aMatches;
+	rMatcher.SearchBytes(pData,rData.length(),CollectMatch,&aMatches);
+	Check(SameMatches(aMatches,rExpected),pWhat,rData);
+
+	Check(rMatcher.SearchCount(pData,rData.length())==rExpected.size(),pWhat,rData);
+	Check(rMatcher.SearchExists(pData,rData.length())==!rExpected.empty(),pWhat,rData);
+
+	std::vector<unsigned long long> aRules(RULE_WORDS,0);
+	rMatcher.SearchRules(pData,rData.length(),&aRules[0],RULE_WORDS);
+	Check(SameRules(rExpected,&aRules[0],RULE_WORDS),pWhat,rData);
+}
+
+//A trie of a rule set, with its index built
+static void BuildTrie(const RuleVector& rRules,
+					  CSuffixTrie& rTrie)
+{
+	for (size_t iRule=0;
+		 iRule<rRules.size();
+		 ++iRule)
+		rTrie.AddString(rRules[iRule].sString,rRules[iRule].iRuleId);
+	rTrie.BuildTreeIndex();
+}
+
+//Every match in one pass of the node walk, the words ending inside other words too (a small
+//alphabet makes many of them)
+static void TestAllMatches()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%60,1+rand()%6,iSet%2?"ab":"abcd");
+
+		CSuffixTrie aTrie;
+		BuildTrie(aRules,aTrie);
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomString(rand()%200,"abcde");
+			Check(SameMatches(FromDataFound(aTrie.SearchAhoCorasikAll(sData)),NaiveScan(aRules,sData)),"node walk",sData);
+		}
+	}
+}
+
+//The dense DFA, on rule sets of a few bytes and of many (so the byte classes vary)
+static void TestDFA()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%60,1+rand()%8,iSet%2?"abcd":"abcdefghijklmnopqrstuvwxyz0123456789");
+
+		CSuffixTrie aTrie;
+		BuildTrie(aRules,aTrie);
+		aTrie.BuildDFA();
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%200,"abcdefz9");
+			Check(SameMatches(FromDataFound(aTrie.SearchDFAMultiple(sData)),NaiveScan(aRules,sData)),"DFA",sData);
+		}
+	}
+}
+
+//The compact encoding, with nodes of few children and of many
+static void TestCompact()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%200,1+rand()%8,iSet%2?"abcd":"abcdefghijklmnopqrstuvwxyz0123456789");
+
+		CSuffixTrie aTrie;
+		BuildTrie(aRules,aTrie);
+		aTrie.BuildCompact();
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%200,"abcdefz9");
+			Check(SameMatches(FromDataFound(aTrie.SearchCompactMultiple(sData)),NaiveScan(aRules,sData)),"compact",sData);
+		}
+	}
+}
+
+//Compile a trie to one of its forms: 0 the node walk, 1 the DFA, 2 the compact encoding
+static void BuildForm(CSuffixTrie& rTrie,
+					  int iForm)
+{
+	if (iForm==1)
+		rTrie.BuildDFA();
+	else if (iForm==2)
+		rTrie.BuildCompact();
+}
+
+//Stops the search after a number of matches
+typedef struct _StopAfter {
+	MatchVector	aMatches;
+	size_t		iStop;
+} StopAfter;
+
+static bool StopMatch(const CMatcher::Match& rMatch,
+					  void* pContext)
+{
+	StopAfter* pStop;
+	pStop=(StopAfter*)pContext;
+
+	pStop->aMatches.push_back(rMatch);
+	return pStop->aMatches.size()<pStop->iStop;
+}
+
+//The same matches in the same order?
+static bool SameOrder(const MatchVector& rA,
+					  const MatchVector& rB)
+{
+	if (rA.size()!=rB.size())
+		return false;
+
+	for (size_t iMatch=0;
+		 iMatch<rA.size();
+		 ++iMatch)
+		if (MatchLess(rA[iMatch],rB[iMatch]) ||
+			MatchLess(rB[iMatch],rA[iMatch]))
+			return false;
+
+	return true;
+}
+
+//SearchBytes on raw bytes with each form: the callback gets every match and stops the search when
+//it returns false, the caller's buffer gets the matches the callback does until it is full
+static void TestSearchBytes()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%60,1+rand()%6,"abcd");
+
+		CSuffixTrie aTrie;
+		BuildTrie(aRules,aTrie);
+		BuildForm(aTrie,iSet%3);
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			//Zeros too, the bytes are raw
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%200,"abcde");
+			if (!sData.empty())
+				sData[rand()%sData.length()]=0;
+
+			const unsigned char* pData;
+			pData=(const unsigned char*)sData.data();
+
+			MatchVector aMatches;
+			aTrie.SearchBytes(pData,sData.length(),CollectMatch,&aMatches);
+			Check(SameMatches(aMatches,NaiveScan(aRules,sData)),"SearchBytes",sData);
+
+			//Stopped by the callback
+			StopAfter aStop;
+			aStop.iStop=1+rand()%5;
+			aTrie.SearchBytes(pData,sData.length(),StopMatch,&aStop);
+			Check(SameOrder(aStop.aMatches,
+							MatchVector(aMatches.begin(),aMatches.begin()+std::min(aStop.iStop,aMatches.size()))),"SearchBytes stop",sData);
+
+			//Into a buffer
+			std::vector<CMatcher::Match> aBuffer(1+rand()%10);
+			size_t iSaved;
+			iSaved=aTrie.SearchBytes(pData,sData.length(),&aBuffer[0],aBuffer.size());
+			Check(iSaved==std::min(aBuffer.size(),aMatches.size()) &&
+				  SameOrder(MatchVector(aBuffer.begin(),aBuffer.begin()+iSaved),
+							MatchVector(aMatches.begin(),aMatches.begin()+iSaved)),"SearchBytes buffer",sData);
+		}
+	}
+}
+
+//Streams cut into random chunks (empty ones too) with each form, the matches spanning chunks are
+//found at their stream offsets, and a copied state goes on like the stream it was copied from
+static void TestStream()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%60,1+rand()%10,"abcd");
+
+		CSuffixTrie aTrie;
+		BuildTrie(aRules,aTrie);
+		BuildForm(aTrie,iSet%3);
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%200,"abcde");
+
+			const unsigned char* pData;
+			pData=(const unsigned char*)sData.data();
+
+			CSuffixTrie::StreamState aStream;
+			CSuffixTrie::ResetStream(aStream);
+
+			//Fork it half way
+			size_t iFork;
+			iFork=sData.length()/2;
+
+			CSuffixTrie::StreamState aFork;
+			CSuffixTrie::ResetStream(aFork);
+
+			MatchVector aStreamed;
+			MatchVector aForked;
+			for (size_t iPos=0;
+				 iPos<sData.length();)
+			{
+				size_t iChunk;
+				iChunk=std::min(sData.length()-iPos,(size_t)(rand()%20));
+				if (iPos<iFork)
+					iChunk=std::min(iChunk,iFork-iPos);
+
+				aTrie.SearchStream(aStream,pData+iPos,iChunk,CollectMatch,&aStreamed);
+				iPos+=iChunk;
+
+				if (iPos==iFork && !aFork.iOffset)
+				{
+					aFork=aStream;
+					aForked=aStreamed;
+				}
+				else if (iPos>iFork)
+					aTrie.SearchStream(aFork,pData+iPos-iChunk,iChunk,CollectMatch,&aForked);
+			}
+
+			MatchVector aExpected;
+			aExpected=NaiveScan(aRules,sData);
+
+			Check(SameMatches(aStreamed,aExpected),"stream",sData);
+			Check(aStream.iOffset==sData.length(),"stream offset",sData);
+			if (iFork)
+				Check(SameMatches(aForked,aExpected),"forked stream",sData);
+		}
+	}
+}
+
+//Bursts of payloads of every length (empty ones too) with each form, each one gets what SearchBytes
+//finds on it, and a payload stopped by the callback doesn't stop the others
+static void TestBatch()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%60,1+rand()%6,"abcd");
+
+		CSuffixTrie aTrie;
+		BuildTrie(aRules,aTrie);
+		BuildForm(aTrie,iSet%3);
+
+		for (int iBurst=0;
+			 iBurst<TEST_PAYLOADS/3;
+			 ++iBurst)
+		{
+			std::vector<std::string> aPieces(1+rand()%40);
+			std::vector<StopAfter> aStops(aPieces.size());
+			std::vector<CSuffixTrie::Payload> aPayloads(aPieces.size());
+
+			for (size_t iPiece=0;
+				 iPiece<aPieces.size();
+				 ++iPiece)
+			{
+				aPieces[iPiece]=RandomPayload(aRules,rand()%100,"abcde");
+				aStops[iPiece].iStop=rand()%4?(size_t)-1:1+rand()%3;
+
+				aPayloads[iPiece].pData=(const unsigned char*)aPieces[iPiece].data();
+				aPayloads[iPiece].iLength=aPieces[iPiece].length();
+				aPayloads[iPiece].pContext=&aStops[iPiece];
+			}
+
+			aTrie.SearchBatch(&aPayloads[0],aPayloads.size(),StopMatch);
+
+			for (size_t iPiece=0;
+				 iPiece<aPieces.size();
+				 ++iPiece)
+			{
+				MatchVector aMatches;
+				aTrie.SearchBytes((const unsigned char*)aPieces[iPiece].data(),aPieces[iPiece].length(),CollectMatch,&aMatches);
+				Check(SameMatches(aMatches,NaiveScan(aRules,aPieces[iPiece])),"batch payload",aPieces[iPiece]);
+
+				//The ones it found before it was stopped
+				aMatches.resize(std::min(aMatches.size(),aStops[iPiece].iStop));
+				Check(SameMatches(aStops[iPiece].aMatches,aMatches),"batch",aPieces[iPiece]);
+			}
+		}
+	}
+}
+
+//The result policies with each form: exists, the first match, the count and the rule bitmap (its
+//bits are only set, and the ids past it are left out)
+static void TestPolicies()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%100,1+rand()%6,"abcd");
+
+		CSuffixTrie aTrie;
+		BuildTrie(aRules,aTrie);
+		BuildForm(aTrie,iSet%3);
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%200,"abcde");
+
+			const unsigned char* pData;
+			pData=(const unsigned char*)sData.data();
+
+			MatchVector aMatches;
+			aTrie.SearchBytes(pData,sData.length(),CollectMatch,&aMatches);
+
+			CheckPolicies(aTrie,NaiveScan(aRules,sData),sData,"policies");
+
+			CMatcher::Match aFirst;
+			bool bFirst;
+			bFirst=aTrie.SearchFirst(pData,sData.length(),aFirst);
+			Check(bFirst==!aMatches.empty() &&
+				  (!bFirst || SameOrder(MatchVector(1,aFirst),MatchVector(1,aMatches[0]))),"first",sData);
+
+			//One word, on top of the bits another search set
+			unsigned long long ulRules;
+			ulRules=1;
+			aTrie.SearchRules(pData,sData.length(),&ulRules,1);
+
+			MatchVector aLow(1);
+			aLow[0].rule_id=0;
+			for (size_t iMatch=0;
+				 iMatch<aMatches.size();
+				 ++iMatch)
+				if (aMatches[iMatch].rule_id<64)
+					aLow.push_back(aMatches[iMatch]);
+			Check(SameRules(aLow,&ulRules,1),"rules word",sData);
+		}
+	}
+}
+
+//Strings added and deleted after the build (on each form), the index is repaired in place, then
+//compiled again
+static void TestIncremental()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%60,1+rand()%6,"abcd");
+
+		CSuffixTrie aTrie;
+		BuildTrie(aRules,aTrie);
+		BuildForm(aTrie,iSet%3);
+
+		for (int iChange=0;
+			 iChange<10;
+			 ++iChange)
+		{
+			if (rand()%2 && !aRules.empty())
+			{
+				//Deletes every rule of the string
+				std::string sString;
+				sString=aRules[rand()%aRules.size()].sString;
+				aTrie.DeleteString(sString);
+				Check(!aTrie.GetAllStringsSet().count(sString),"deleted",sString);
+
+				RuleVector aLeft;
+				for (size_t iRule=0;
+					 iRule<aRules.size();
+					 ++iRule)
+					if (aRules[iRule].sString!=sString)
+						aLeft.push_back(aRules[iRule]);
+				aRules=aLeft;
+			}
+			else
+			{
+				Rule aRule;
+				aRule.sString=RandomString(1+rand()%6,"abcde");
+				aRule.iRuleId=aTrie.AddString(aRule.sString);
+				Check(aTrie.GetAllStringsSet().count(aRule.sString)==1,"added",aRule.sString);
+				aRules.push_back(aRule);
+			}
+
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%200,"abcde");
+			CheckPolicies(aTrie,NaiveScan(aRules,sData),sData,"incremental");
+		}
+
+		//And compiled again
+		aTrie.Compile();
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%200,"abcde");
+			CheckPolicies(aTrie,NaiveScan(aRules,sData),sData,"incremental compiled");
+		}
+	}
+}
+
+//A string in lower case
+static std::string LowerCase(std::string sString)
+{
+	for (size_t iCount=0;
+		 iCount<sString.length();
+		 ++iCount)
+		sString[iCount]=tolower((unsigned char)sString[iCount]);
+
+	return sString;
+}
+
+//The image the tests save and load
+static const char* TEST_IMAGE = "TestMatchers.img";
+
+//Images: saved, mapped and searched (a copy of one too, and case-insensitive ones keep their case),
+//then updated, which drops the image
+static void TestImage()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		bool bNoCase;
+		bNoCase=iSet%4>=2;
+
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%60,1+rand()%8,"abcdAB");
+
+		CSuffixTrie aTrie;
+		aTrie.SetNoCase(bNoCase);
+		BuildTrie(aRules,aTrie);
+		aTrie.BuildDFA();
+		Check(aTrie.SaveImage(TEST_IMAGE),"save image","");
+
+		CSuffixTrie aImage;
+		Check(aImage.LoadImage(TEST_IMAGE,iSet%2==0),"load image","");
+		Check(aImage.GetNoCase()==bNoCase,"image case","");
+
+		//What the image matches, without the case if it has none
+		RuleVector aMatched(aRules);
+		if (bNoCase)
+			for (size_t iRule=0;
+				 iRule<aMatched.size();
+				 ++iRule)
+				aMatched[iRule].sString=LowerCase(aMatched[iRule].sString);
+
+		CSuffixTrie aCopy(aImage);
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%200,"abcdeABE");
+
+			MatchVector aExpected;
+			aExpected=NaiveScan(aMatched,bNoCase?LowerCase(sData):sData);
+
+			CheckPolicies(aImage,aExpected,sData,"image");
+			CheckPolicies(aCopy,aExpected,sData,"image copy");
+		}
+
+		//The image has no strings, an update leaves only the new one (in the copy too)
+		RuleVector aAdded(1);
+		aAdded[0].sString=RandomString(1+rand()%4,"abcd");
+
+		aAdded[0].iRuleId=aImage.AddString(aAdded[0].sString);
+		aImage.BuildTreeIndex();
+
+		aCopy.AddString(aAdded[0].sString,aAdded[0].iRuleId);
+		aCopy.BuildTreeIndex();
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%200,"abcdeABE");
+
+			MatchVector aExpected;
+			aExpected=NaiveScan(aAdded,bNoCase?LowerCase(sData):sData);
+
+			CheckPolicies(aImage,aExpected,sData,"image updated");
+			CheckPolicies(aCopy,aExpected,sData,"image copy updated");
+		}
+	}
+
+	remove(TEST_IMAGE);
+}
+
+//The header of an image as SuffixTrie.h lays it out (ImageHeader), the tests forge corrupt images
+//that still pass the checksum with it
+typedef struct _TestImageHeader {
+	char				aMagic[8];
+	unsigned int		uiVersion;
+	unsigned int		uiByteOrder;
+	unsigned long long	ullSize;
+	unsigned long long	ullChecksum;
+	unsigned int		uiStates;
+	unsigned int		uiClasses;
+	unsigned int		uiPrefixLength;
+	unsigned int		uiRules;
+	unsigned int		uiMaxDepth;
+	unsigned int		uiFlags;
+	unsigned long long	aOffsets[7];
+	unsigned long long	aSizes[7];
+} TestImageHeader;
+
+//The columns after the transitions of a DFA row (depth, rule list, output link)
+static const unsigned int TEST_DFA_COLUMNS = 3;
+
+//Read an image file
+static std::vector<unsigned char> ReadImage(const char* pFileName)
+{
+	std::vector<unsigned char> aImage;
+
+	FILE* pFile;
+	pFile=fopen(pFileName,"rb");
+	if (!pFile)
+		return aImage;
+
+	unsigned char aBuffer[4096];
+	size_t iRead;
+	while ((iRead=fread(aBuffer,1,sizeof(aBuffer),pFile))>0)
+		aImage.insert(aImage.end(),aBuffer,aBuffer+iRead);
+
+	fclose(pFile);
+	return aImage;
+}
+
+//Write an image file, with the checksum (FNV-1a a word at a time, of what follows the header) made
+//to fit what is in it
+static void WriteSealedImage(const char* pFileName,
+							 std::vector<unsigned char> aImage)
+{
+	TestImageHeader aHeader;
+	memcpy(&aHeader,&aImage[0],sizeof(aHeader));
+
+	aHeader.ullChecksum=0xcbf29ce484222325ULL;
+	for (size_t iCount=aHeader.aOffsets[0]; iCount<aImage.size(); iCount+=sizeof(unsigned long long))
+	{
+		unsigned long long ullWord;
+		memcpy(&ullWord,&aImage[iCount],sizeof(ullWord));
+		aHeader.ullChecksum=(aHeader.ullChecksum^ullWord)*0x100000001b3ULL;
+	}
+	memcpy(&aImage[0],&aHeader,sizeof(aHeader));
+
+	FILE* pFile;
+	pFile=fopen(pFileName,"wb");
+	if (!pFile)
+		return;
+
+	fwrite(&aImage[0],1,aImage.size(),pFile);
+	fclose(pFile);
+}
+
+//Corrupt images: a flipped byte (the checksum catches it), and tables that pass the checksum but
+//would walk out of the DFA, report matches starting before the data or loop on the output links
+static void TestCorruptImage()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(2+rand()%60,2+rand()%8,"abcd");
+
+		CSuffixTrie aTrie;
+		BuildTrie(aRules,aTrie);
+		aTrie.BuildDFA();
+		aTrie.SaveImage(TEST_IMAGE);
+
+		std::vector<unsigned char> aImage;
+		aImage=ReadImage(TEST_IMAGE);
+
+		TestImageHeader aHeader;
+		memcpy(&aHeader,&aImage[0],sizeof(aHeader));
+
+		//Resealed as it is, it must still load (else the forging is wrong)
+		CSuffixTrie aLoaded;
+		WriteSealedImage(TEST_IMAGE,aImage);
+		Check(aLoaded.LoadImage(TEST_IMAGE),"resealed image","");
+
+		//A byte of the tables flipped
+		std::vector<unsigned char> aCorrupt(aImage);
+		aCorrupt[aHeader.aOffsets[0]+rand()%(aCorrupt.size()-aHeader.aOffsets[0])]^=1<<(rand()%8);
+
+		FILE* pFile;
+		pFile=fopen(TEST_IMAGE,"wb");
+		fwrite(&aCorrupt[0],1,aCorrupt.size(),pFile);
+		fclose(pFile);
+		Check(!aLoaded.LoadImage(TEST_IMAGE),"flipped image","");
+
+		//A row of the DFA (not the root), and one of its cells
+		unsigned int uiStride;
+		uiStride=aHeader.uiClasses+TEST_DFA_COLUMNS;
+
+		unsigned int uiRow;
+		uiRow=(1+rand()%(aHeader.uiStates-1))*uiStride;
+
+		unsigned int* pDFA;
+		for (int iCase=0;
+			 iCase<4;
+			 ++iCase)
+		{
+			aCorrupt=aImage;
+			pDFA=(unsigned int*)&aCorrupt[aHeader.aOffsets[0]];
+
+			if (iCase==0)
+				//Deeper than the deepest state
+				pDFA[uiRow+aHeader.uiClasses]=aHeader.uiMaxDepth+1+rand()%1000;
+			else if (iCase==1)
+				//A byte from the root that jumps deep
+				pDFA[rand()%aHeader.uiClasses]=uiRow;
+			else if (iCase==2)
+				//An output link to itself
+				pDFA[uiRow+aHeader.uiClasses+2]=uiRow;
+			else
+				//A transition out of the DFA
+				pDFA[uiRow+rand()%aHeader.uiClasses]=aHeader.uiStates*uiStride+rand()%1000;
+
+			//A row at depth 1 from the root is fine
+			if (iCase==1 && pDFA[uiRow+aHeader.uiClasses]<=1)
+				continue;
+
+			WriteSealedImage(TEST_IMAGE,aCorrupt);
+			Check(!aLoaded.LoadImage(TEST_IMAGE),"corrupt image","");
+		}
+	}
+
+	remove(TEST_IMAGE);
+}
+
+//Case-insensitive tries with each form, upper and lower case rules match data of any case (the
+//bytes that are no letters as they are), and the case can't change once strings are in
+static void TestNoCase()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%60,1+rand()%6,"abAB[{");
+
+		CSuffixTrie aTrie;
+		Check(aTrie.SetNoCase(true) && aTrie.GetNoCase(),"set no case","");
+		BuildTrie(aRules,aTrie);
+		BuildForm(aTrie,iSet%3);
+		Check(!aTrie.SetNoCase(false) && aTrie.GetNoCase(),"no case once built","");
+
+		RuleVector aMatched(aRules);
+		for (size_t iRule=0;
+			 iRule<aMatched.size();
+			 ++iRule)
+			aMatched[iRule].sString=LowerCase(aMatched[iRule].sString);
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%200,"abcABC[{@`");
+
+			MatchVector aExpected;
+			aExpected=NaiveScan(aMatched,LowerCase(sData));
+
+			CheckPolicies(aTrie,aExpected,sData,"no case");
+		}
+	}
+}
+
+//The rule set built into TestHeader.h, a word of two rules and words inside words
+static const char* TEST_HEADER_RULES[] = {
+	"he",
+	"she",
+	"his",
+	"hers",
+	"barak",
+	"arakoo",
+	"barakoo",
+	"GET /",
+	"she",
+	"ers"
+};
+
+//The rules of the header, ids by position
+static RuleVector HeaderRules()
+{
+	RuleVector aRules;
+	for (size_t iRule=0;
+		 iRule<sizeof(TEST_HEADER_RULES)/sizeof(TEST_HEADER_RULES[0]);
+		 ++iRule)
+	{
+		Rule aRule;
+		aRule.sString=TEST_HEADER_RULES[iRule];
+		aRule.iRuleId=iRule+1;
+		aRules.push_back(aRule);
+	}
+
+	return aRules;
+}
+
+//Collects the matches of the header's search (a functor, it is taken by value)
+typedef struct _HeaderCollector {
+	MatchVector*	pMatches;
+
+	bool operator()(const TestHeader::Match& rMatch)const
+	{
+		CMatcher::Match aMatch;
+		aMatch.rule_id=rMatch.rule_id;
+		aMatch.iFoundPosition=rMatch.iFoundPosition;
+		aMatch.iEndPosition=rMatch.iEndPosition;
+		pMatches->push_back(aMatch);
+		return true;
+	}
+} HeaderCollector;
+
+//The header SaveHeader writes: TestHeader.h was written by it from TEST_HEADER_RULES, it must be
+//what SaveHeader writes now, and compiled in it must find what the naive scan finds
+static void TestSaveHeader()
+{
+	RuleVector aRules;
+	aRules=HeaderRules();
+
+	CSuffixTrie aTrie;
+	BuildTrie(aRules,aTrie);
+	Check(aTrie.BuildDFA(),"header DFA","");
+	Check(aTrie.SaveHeader("TestHeader.new","TestHeader"),"save header","");
+
+	//The same bytes (else SaveHeader changed, TestHeader.new is the header to check in)
+	std::vector<unsigned char> aNew;
+	aNew=ReadImage("TestHeader.new");
+
+	bool bSame;
+	bSame=!aNew.empty() && aNew==ReadImage("TestHeader.h");
+	Check(bSame,"TestHeader.h is not what SaveHeader writes, see TestHeader.new","");
+	if (bSame)
+		remove("TestHeader.new");
+
+	//Names it won't take
+	Check(!aTrie.SaveHeader("TestHeader.new","1st") &&
+		  !aTrie.SaveHeader("TestHeader.new","a-b"),"header name","");
+
+	for (int iPayload=0;
+		 iPayload<TEST_PAYLOADS*10;
+		 ++iPayload)
+	{
+		std::string sData;
+		sData=RandomPayload(aRules,rand()%200,"abehikorsGET /");
+
+		MatchVector aMatches;
+		HeaderCollector aCollector;
+		aCollector.pMatches=&aMatches;
+		TestHeader::Search((const unsigned char*)sData.data(),sData.length(),aCollector);
+
+		Check(SameMatches(aMatches,NaiveScan(aRules,sData)),"header",sData);
+	}
+}
+
+//The trie built by many threads, with sets big enough for the threads to take part
+static void TestParallelBuild()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS/4;
+		 ++iSet)
+	{
+		//Some empty strings too, they use up their ids
+		CSuffixTrie::StringsVector aStrings;
+		for (int iString=rand()%3000;
+			 iString>=0;
+			 --iString)
+			aStrings.push_back(rand()%50?RandomString(1+rand()%12,"abcdefgh"):std::string());
+
+		std::vector<int> aRuleIds;
+		CSuffixTrie aTrie;
+		aTrie.SetBuildThreads(4);
+		aTrie.AddStrings(aStrings,&aRuleIds);
+		aTrie.Compile();
+
+		//The ids are by position, the same one thread gives
+		CSuffixTrie aSingle;
+		RuleVector aRules;
+		bool bSameIds;
+		bSameIds=aRuleIds.size()==aStrings.size();
+
+		for (size_t iString=0;
+			 iString<aStrings.size();
+			 ++iString)
+		{
+			int iRuleId;
+			iRuleId=aSingle.AddString(aStrings[iString]);
+			bSameIds&=iString<aRuleIds.size() && aRuleIds[iString]==iRuleId;
+
+			if (!aStrings[iString].empty())
+			{
+				Rule aRule;
+				aRule.sString=aStrings[iString];
+				aRule.iRuleId=iRuleId;
+				aRules.push_back(aRule);
+			}
+		}
+		aSingle.BuildTreeIndex();
+
+		Check(bSameIds,"parallel build ids","");
+
+		//And the same trie, node for node
+		CMatcher::MatcherShape aShape;
+		aShape=aTrie.GetStats().aShape;
+
+		CMatcher::MatcherShape aSingleShape;
+		aSingleShape=aSingle.GetStats().aShape;
+
+		Check(aShape.iStates==aSingleShape.iStates &&
+			  aShape.iPatterns==aSingleShape.iPatterns &&
+			  aShape.iRules==aSingleShape.iRules,"parallel build shape","");
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%400,"abcdefghi");
+
+			MatchVector aExpected;
+			aExpected=NaiveScan(aRules,sData);
+
+			CheckPolicies(aTrie,aExpected,sData,"parallel build");
+			Check(SameMatches(FromDataFound(aSingle.SearchAhoCorasikAll(sData)),aExpected),"single build",sData);
+		}
+	}
+}
+
+//One large buffer scanned in chunks by many threads, matches across the chunk edges included
+static void TestParallelSearch()
+{
+	for (int iSet=0;
+		 iSet<6;
+		 ++iSet)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%30,1+rand()%20,"abcd");
+
+		CSuffixTrie aTrie;
+		for (size_t iRule=0;
+			 iRule<aRules.size();
+			 ++iRule)
+			aTrie.AddString(aRules[iRule].sString,aRules[iRule].iRuleId);
+
+		//Each engine in turn
+		if (iSet%3==0)
+			aTrie.BuildTreeIndex();
+		else if (iSet%3==1)
+		{
+			aTrie.BuildTreeIndex();
+			aTrie.BuildDFA();
+		}
+		else
+		{
+			aTrie.BuildTreeIndex();
+			aTrie.BuildCompact();
+		}
+
+		//Big enough for up to 5 chunks
+		std::string sData;
+		sData=RandomPayload(aRules,(2+rand()%4)*256*1024+rand()%1000,"abcde");
+
+		const unsigned char* pData;
+		pData=(const unsigned char*)sData.data();
+
+		MatchVector aSerial;
+		aTrie.SearchBytes(pData,sData.length(),CollectMatch,&aSerial);
+
+		MatchVector aParallel;
+		size_t iMatches;
+		iMatches=aTrie.SearchParallel(pData,sData.length(),aParallel,1+rand()%6);
+
+		//The matches SearchBytes finds, in its order
+		bool bSameOrder;
+		bSameOrder=iMatches==aParallel.size() && aParallel.size()==aSerial.size();
+		for (size_t iMatch=0;
+			 bSameOrder && iMatch<aParallel.size();
+			 ++iMatch)
+			bSameOrder=!MatchLess(aParallel[iMatch],aSerial[iMatch]) &&
+					   !MatchLess(aSerial[iMatch],aParallel[iMatch]);
+
+		Check(bSameOrder,"parallel search order","");
+		Check(SameMatches(aParallel,NaiveScan(aRules,sData)),"parallel search","");
+	}
+}
+
+//The DFA renumbered by a profile, the matches don't change
+static void TestLayout()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%60,1+rand()%8,"abcd");
+
+		CSuffixTrie aTrie;
+		for (size_t iRule=0;
+			 iRule<aRules.size();
+			 ++iRule)
+			aTrie.AddString(aRules[iRule].sString,aRules[iRule].iRuleId);
+		aTrie.BuildTreeIndex();
+		aTrie.BuildDFA();
+
+		//No profile yet
+		Check(!aTrie.LayoutDFA(),"layout without a profile","");
+
+		//Profile on traffic that visits only some of the states
+		for (int iSample=0;
+			 iSample<5;
+			 ++iSample)
+		{
+			std::string sSample;
+			sSample=RandomString(rand()%100,"abc");
+			aTrie.ProfileDFA((const unsigned char*)sSample.data(),sSample.length());
+		}
+		Check(aTrie.LayoutDFA(),"layout","");
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%200,"abcde");
+
+			MatchVector aExpected;
+			aExpected=NaiveScan(aRules,sData);
+
+			Check(SameMatches(FromDataFound(aTrie.SearchDFAMultiple(sData)),aExpected),"layout DFA",sData);
+			CheckPolicies(aTrie,aExpected,sData,"layout policies");
+		}
+	}
+}
+
+//Patterns both CRegex and POSIX extended regexes take the same way
+static const char* TEST_REGEXES[] = {
+	"a[bc]+x",
+	"(ab|yz)[0-9]{1,2}",
+	"x.?y",
+	"[0-9]+z",
+	"[a-c]*0",
+	"c.*1",
+	"(a|b)(x|y)",
+	"[xy][01]",
+	"b(ca)*z"
+};
+
+//Does an anchored regex match the bytes from iStart to iEnd?
+static bool RegexMatch(const regex_t& rRegex,
+					   const std::string& rData,
+					   size_t iStart,
+					   size_t iEnd)
+{
+	return !regexec(&rRegex,rData.substr(iStart,iEnd-iStart+1).c_str(),0,NULL,0);
+}
+
+//Every match of every regex, the longest one ending at each byte (the one CRegex reports)
+static MatchVector RegexScan(const RuleVector& rRegexes,
+							 const std::string& rData)
+{
+	MatchVector aMatches;
+	for (size_t iRule=0;
+		 iRule<rRegexes.size();
+		 ++iRule)
+	{
+		//Anchored, so a substring matches as a whole
+		regex_t aRegex;
+		if (regcomp(&aRegex,("^("+rRegexes[iRule].sString+")$").c_str(),REG_EXTENDED|REG_NOSUB))
+			continue;
+
+		for (size_t iEnd=0;
+			 iEnd<rData.length();
+			 ++iEnd)
+			for (size_t iStart=0;
+				 iStart<=iEnd;
+				 ++iStart)
+				if (RegexMatch(aRegex,rData,iStart,iEnd))
+				{
+					CMatcher::Match aMatch;
+					aMatch.rule_id=rRegexes[iRule].iRuleId;
+					aMatch.iFoundPosition=iStart;
+					aMatch.iEndPosition=iEnd;
+					aMatches.push_back(aMatch);
+					break;
+				}
+
+		regfree(&aRegex);
+	}
+
+	return aMatches;
+}
+
+//A random rule set of literals and regexes (a rule is one or the other)
+static CRegexMatcher* RandomRegexRules(RuleVector& rLiterals,
+									   RuleVector& rRegexes,
+									   int iRules)
+{
+	CRegexMatcher* pMatcher;
+	pMatcher=new CRegexMatcher;
+
+	for (int iRule=1;
+		 iRule<=iRules;
+		 ++iRule)
+		if (rand()%3)
+			for (int iLiteral=1+rand()%2;
+				 iLiteral>0;
+				 --iLiteral)
+			{
+				Rule aRule;
+				aRule.sString=RandomString(1+rand()%3,"abcxyz01");
+				aRule.iRuleId=iRule;
+				pMatcher->AddString(aRule.sString,iRule);
+				rLiterals.push_back(aRule);
+			}
+		else
+		{
+			Rule aRule;
+			aRule.sString=TEST_REGEXES[rand()%(sizeof(TEST_REGEXES)/sizeof(TEST_REGEXES[0]))];
+			aRule.iRuleId=iRule;
+			Check(pMatcher->AddRegex(aRule.sString,iRule)==iRule,"add regex",aRule.sString);
+			rRegexes.push_back(aRule);
+		}
+
+	return pMatcher;
+}
+
+//The regex matcher: the literals and the regexes (some with a cache small enough to be flushed)
+static void TestRegex()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS*2;
+		 ++iSet)
+	{
+		RuleVector aLiterals;
+		RuleVector aRegexes;
+
+		CRegexMatcher* pMatcher;
+		pMatcher=RandomRegexRules(aLiterals,aRegexes,2+rand()%6);
+		if (iSet%2)
+			pMatcher->SetCacheSize(200);
+		pMatcher->Compile();
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomString(rand()%70,"abcxyz01");
+
+			MatchVector aExpected;
+			aExpected=NaiveScan(aLiterals,sData);
+
+			MatchVector aRegexMatches;
+			aRegexMatches=RegexScan(aRegexes,sData);
+			aExpected.insert(aExpected.end(),aRegexMatches.begin(),aRegexMatches.end());
+
+			CheckPolicies(*pMatcher,aExpected,sData,"regex");
+		}
+
+		delete pMatcher;
+	}
+}
+
+//A thread searching a matcher others search too
+typedef struct _SearchThread {
+	const CRegexMatcher*				pMatcher;
+	const std::vector<std::string>*		pPayloads;
+	const std::vector<size_t>*			pCounts;
+	int									iFailures;
+} SearchThread;
+
+//A nested search from the callback
+typedef struct _NestedSearch {
+	const CRegexMatcher*	pMatcher;
+	const std::string*		pData;
+	size_t					iCount;
+	size_t					iNested;
+} NestedSearch;
+
+//Searches the same payload again, while the outer search is in its callback
+static bool NestedMatch(const CMatcher::Match& /*rMatch*/,
+						void* pContext)
+{
+	NestedSearch* pNested;
+	pNested=(NestedSearch*)pContext;
+
+	++pNested->iCount;
+	pNested->iNested+=pNested->pMatcher->SearchCount((const unsigned char*)pNested->pData->data(),
+													 pNested->pData->length());
+	return true;
+}
+
+static void* SearchPayloads(void* pContext)
+{
+	SearchThread* pThread;
+	pThread=(SearchThread*)pContext;
+
+	for (int iRound=0;
+		 iRound<10;
+		 ++iRound)
+		for (size_t iPayload=0;
+			 iPayload<pThread->pPayloads->size();
+			 ++iPayload)
+		{
+			const std::string& rData=(*pThread->pPayloads)[iPayload];
+			size_t iExpected;
+			iExpected=(*pThread->pCounts)[iPayload];
+
+			if (pThread->pMatcher->SearchCount((const unsigned char*)rData.data(),rData.length())!=iExpected)
+				++pThread->iFailures;
+
+			NestedSearch aNested;
+			aNested.pMatcher=pThread->pMatcher;
+			aNested.pData=&rData;
+			aNested.iCount=0;
+			aNested.iNested=0;
+			pThread->pMatcher->SearchBytes((const unsigned char*)rData.data(),rData.length(),NestedMatch,&aNested);
+
+			if (aNested.iCount!=iExpected ||
+				aNested.iNested!=iExpected*iExpected)
+				++pThread->iFailures;
+		}
+
+	return NULL;
+}
+
+//Many threads on one regex matcher with a small cache, so the caches are flushed while others
+//search them, and every callback searches the matcher again
+static void TestRegexThreads()
+{
+	for (int iSet=0;
+		 iSet<4;
+		 ++iSet)
+	{
+		RuleVector aLiterals;
+		RuleVector aRegexes;
+
+		CRegexMatcher* pMatcher;
+		pMatcher=RandomRegexRules(aLiterals,aRegexes,4+rand()%4);
+		pMatcher->SetCacheSize(200);
+		pMatcher->Compile();
+
+		std::vector<std::string> aPayloads;
+		std::vector<size_t> aCounts;
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomString(rand()%70,"abcxyz01");
+			aPayloads.push_back(sData);
+			aCounts.push_back(NaiveScan(aLiterals,sData).size()+RegexScan(aRegexes,sData).size());
+		}
+
+		std::vector<SearchThread> aThreads(6);
+		std::vector<pthread_t> aHandles(aThreads.size());
+		for (size_t iThread=0;
+			 iThread<aThreads.size();
+			 ++iThread)
+		{
+			aThreads[iThread].pMatcher=pMatcher;
+			aThreads[iThread].pPayloads=&aPayloads;
+			aThreads[iThread].pCounts=&aCounts;
+			aThreads[iThread].iFailures=0;
+			pthread_create(&aHandles[iThread],NULL,SearchPayloads,&aThreads[iThread]);
+		}
+
+		for (size_t iThread=0;
+			 iThread<aThreads.size();
+			 ++iThread)
+		{
+			pthread_join(aHandles[iThread],NULL);
+			Check(!aThreads[iThread].iFailures,"regex threads","");
+		}
+
+		delete pMatcher;
+	}
+}
+
+//The windows of a rule set, by rule
+typedef std::map<int,CRegexMatcher::RuleWindow> WindowMap;
+
+//Is a match in the offset and depth of its rule?
+static bool InOffsetDepth(const WindowMap& rWindows,
+						  int iRuleId,
+						  size_t iStart,
+						  size_t iEnd)
+{
+	WindowMap::const_iterator aIterator;
+	aIterator=rWindows.find(iRuleId);
+	if (aIterator==rWindows.end())
+		return true;
+
+	const CRegexMatcher::RuleWindow& rWindow=aIterator->second;
+	return iStart>=rWindow.iOffset &&
+		   (!rWindow.iDepth || iEnd<rWindow.iOffset+rWindow.iDepth);
+}
+
+//The within of a rule, 0 if it has none or it is on a cycle of anchors (the within is dropped)
+static size_t WithinOf(const WindowMap& rWindows,
+					   int iRuleId)
+{
+	WindowMap::const_iterator aIterator;
+	aIterator=rWindows.find(iRuleId);
+	if (aIterator==rWindows.end())
+		return 0;
+
+	//Follow the anchors, a rule that only leads into a cycle keeps its within
+	int iRule;
+	iRule=iRuleId;
+	for (size_t iStep=0;
+		 iStep<=rWindows.size();
+		 ++iStep)
+	{
+		WindowMap::const_iterator aStep;
+		aStep=rWindows.find(iRule);
+		if (aStep==rWindows.end() ||
+			!aStep->second.iWithin)
+			break;
+
+		iRule=aStep->second.iAnchor;
+		if (iRule==iRuleId)
+			return 0;
+	}
+
+	return aIterator->second.iWithin;
+}
+
+//Every match of a rule the brute force way, each start and end (the windows aren't checked)
+static MatchVector AllMatches(const RuleVector& rLiterals,
+							  const RuleVector& rRegexes,
+							  const std::vector<regex_t>& rCompiled,
+							  int iRuleId,
+							  const std::string& rData)
+{
+	RuleVector aLiterals;
+	for (size_t iRule=0;
+		 iRule<rLiterals.size();
+		 ++iRule)
+		if (rLiterals[iRule].iRuleId==iRuleId)
+			aLiterals.push_back(rLiterals[iRule]);
+
+	MatchVector aMatches;
+	aMatches=NaiveScan(aLiterals,rData);
+
+	for (size_t iRule=0;
+		 iRule<rRegexes.size();
+		 ++iRule)
+		if (rRegexes[iRule].iRuleId==iRuleId)
+			for (size_t iEnd=0;
+				 iEnd<rData.length();
+				 ++iEnd)
+				for (size_t iStart=0;
+					 iStart<=iEnd;
+					 ++iStart)
+					if (RegexMatch(rCompiled[iRule],rData,iStart,iEnd))
+					{
+						CMatcher::Match aMatch;
+						aMatch.rule_id=iRuleId;
+						aMatch.iFoundPosition=iStart;
+						aMatch.iEndPosition=iEnd;
+						aMatches.push_back(aMatch);
+					}
+
+	return aMatches;
+}
+
+//The first anchor end in [iFrom,iTo] (-1 if none)
+static size_t FirstAnchor(const std::vector<size_t>& rEnds,
+						  size_t iFrom,
+						  size_t iTo)
+{
+	std::vector<size_t>::const_iterator aIterator;
+	aIterator=std::lower_bound(rEnds.begin(),rEnds.end(),iFrom);
+	if (aIterator==rEnds.end() ||
+		*aIterator>iTo)
+		return (size_t)-1;
+
+	return *aIterator;
+}
+
+//The matches of a rule set with windows, checked at every start and end
+//A literal needs an anchor match ending in [end-within,start-1], a regex match ending at a byte
+//starts after the first anchor that ends in [end-within,end-1] (the longest such match is reported)
+static MatchVector WindowScan(const RuleVector& rLiterals,
+							  const RuleVector& rRegexes,
+							  const WindowMap& rWindows,
+							  const std::string& rData)
+{
+	std::vector<regex_t> aCompiled(rRegexes.size());
+	for (size_t iRule=0;
+		 iRule<rRegexes.size();
+		 ++iRule)
+		regcomp(&aCompiled[iRule],("^("+rRegexes[iRule].sString+")$").c_str(),REG_EXTENDED|REG_NOSUB);
+
+	std::set<int> aRuleIds;
+	for (size_t iRule=0;
+		 iRule<rLiterals.size();
+		 ++iRule)
+		aRuleIds.insert(rLiterals[iRule].iRuleId);
+	for (size_t iRule=0;
+		 iRule<rRegexes.size();
+		 ++iRule)
+		aRuleIds.insert(rRegexes[iRule].iRuleId);
+
+	MatchVector aMatches;
+	for (std::set<int>::const_iterator aRuleId=aRuleIds.begin();
+		 aRuleId!=aRuleIds.end();
+		 ++aRuleId)
+	{
+		int iRuleId;
+		iRuleId=*aRuleId;
+
+		//Where the anchor matches end, in its own offset and depth
+		size_t iWithin;
+		iWithin=WithinOf(rWindows,iRuleId);
+
+		std::vector<size_t> aAnchorEnds;
+		if (iWithin)
+		{
+			int iAnchor;
+			iAnchor=rWindows.find(iRuleId)->second.iAnchor;
+
+			MatchVector aAnchors;
+			aAnchors=AllMatches(rLiterals,rRegexes,aCompiled,iAnchor,rData);
+			for (size_t iMatch=0;
+				 iMatch<aAnchors.size();
+				 ++iMatch)
+				if (InOffsetDepth(rWindows,iAnchor,aAnchors[iMatch].iFoundPosition,aAnchors[iMatch].iEndPosition))
+					aAnchorEnds.push_back(aAnchors[iMatch].iEndPosition);
+			std::sort(aAnchorEnds.begin(),aAnchorEnds.end());
+		}
+
+		//The literals
+		RuleVector aLiterals;
+		for (size_t iRule=0;
+			 iRule<rLiterals.size();
+			 ++iRule)
+			if (rLiterals[iRule].iRuleId==iRuleId)
+				aLiterals.push_back(rLiterals[iRule]);
+
+		MatchVector aFound;
+		aFound=NaiveScan(aLiterals,rData);
+		for (size_t iMatch=0;
+			 iMatch<aFound.size();
+			 ++iMatch)
+		{
+			size_t iStart;
+			iStart=aFound[iMatch].iFoundPosition;
+
+			size_t iEnd;
+			iEnd=aFound[iMatch].iEndPosition;
+
+			if (!InOffsetDepth(rWindows,iRuleId,iStart,iEnd))
+				continue;
+
+			if (iWithin &&
+				(!iStart || FirstAnchor(aAnchorEnds,iEnd>iWithin?iEnd-iWithin:0,iStart-1)==(size_t)-1))
+				continue;
+
+			aMatches.push_back(aFound[iMatch]);
+		}
+
+		//The regexes
+		size_t iOffset;
+		iOffset=rWindows.count(iRuleId)?rWindows.find(iRuleId)->second.iOffset:0;
+
+		for (size_t iRule=0;
+			 iRule<rRegexes.size();
+			 ++iRule)
+			if (rRegexes[iRule].iRuleId==iRuleId)
+				for (size_t iEnd=0;
+					 iEnd<rData.length();
+					 ++iEnd)
+				{
+					if (!InOffsetDepth(rWindows,iRuleId,iOffset,iEnd))
+						continue;
+
+					size_t iFirst;
+					iFirst=iOffset;
+					if (iWithin)
+					{
+						size_t iAnchorEnd;
+						iAnchorEnd=iEnd?FirstAnchor(aAnchorEnds,iEnd>iWithin?iEnd-iWithin:0,iEnd-1):(size_t)-1;
+						if (iAnchorEnd==(size_t)-1)
+							continue;
+
+						iFirst=std::max(iFirst,iAnchorEnd+1);
+					}
+
+					for (size_t iStart=iFirst;
+						 iStart<=iEnd;
+						 ++iStart)
+						if (RegexMatch(aCompiled[iRule],rData,iStart,iEnd))
+						{
+							CMatcher::Match aMatch;
+							aMatch.rule_id=iRuleId;
+							aMatch.iFoundPosition=iStart;
+							aMatch.iEndPosition=iEnd;
+							aMatches.push_back(aMatch);
+							break;
+						}
+				}
+	}
+
+	for (size_t iRule=0;
+		 iRule<aCompiled.size();
+		 ++iRule)
+		regfree(&aCompiled[iRule]);
+
+	return aMatches;
+}
+
+//Rules with offset, depth and within (the anchors may go round in cycles), the matches past the
+//scan end must not be missed
+static void TestWindows()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS*4;
+		 ++iSet)
+	{
+		RuleVector aLiterals;
+		RuleVector aRegexes;
+
+		int iRules;
+		iRules=2+rand()%6;
+
+		CRegexMatcher* pMatcher;
+		pMatcher=RandomRegexRules(aLiterals,aRegexes,iRules);
+
+		WindowMap aWindows;
+		for (int iRule=1;
+			 iRule<=iRules;
+			 ++iRule)
+			if (rand()%4)
+			{
+				CRegexMatcher::RuleWindow aWindow;
+				aWindow.iOffset=rand()%3?0:rand()%15;
+				aWindow.iDepth=rand()%2?0:1+rand()%30;
+				aWindow.iWithin=rand()%2?0:1+rand()%10;
+				aWindow.iAnchor=aWindow.iWithin?1+rand()%iRules:0;
+				if (aWindow.iAnchor==iRule)
+				{
+					aWindow.iWithin=0;
+					aWindow.iAnchor=0;
+				}
+
+				Check(pMatcher->SetWindow(iRule,aWindow),"set window","");
+				aWindows[iRule]=aWindow;
+			}
+
+		pMatcher->Compile();
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomString(rand()%70,"abcxyz01");
+
+			MatchVector aExpected;
+			aExpected=WindowScan(aLiterals,aRegexes,aWindows,sData);
+			CheckPolicies(*pMatcher,aExpected,sData,"windows");
+
+			//Nothing matches past the scan end
+			if (pMatcher->GetScanEnd()<sData.length())
+				CheckPolicies(*pMatcher,aExpected,sData.substr(0,pMatcher->GetScanEnd()),"scan end");
+		}
+
+		delete pMatcher;
+	}
+}
+
+//Wu-Manber, with long patterns (the shift table) and short ones (its trie)
+static void TestWuManber()
+{
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		//Up to 24 bytes, the ones of 16 and more go to the shift table
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%40,24,"abcd");
+
+		CWuManber aWuManber;
+		for (size_t iRule=0;
+			 iRule<aRules.size();
+			 ++iRule)
+			aWuManber.AddString(aRules[iRule].sString,aRules[iRule].iRuleId);
+		aWuManber.Compile();
+
+		//The shape is of all the patterns, the same a trie of them has
+		CSuffixTrie aTrie;
+		for (size_t iRule=0;
+			 iRule<aRules.size();
+			 ++iRule)
+			aTrie.AddString(aRules[iRule].sString,aRules[iRule].iRuleId);
+		aTrie.BuildTreeIndex();
+
+		CMatcher::MatcherShape aShape;
+		aShape=aWuManber.GetStats().aShape;
+
+		CMatcher::MatcherShape aTrieShape;
+		aTrieShape=aTrie.GetStats().aShape;
+
+		Check(aShape.iPatterns==aTrieShape.iPatterns &&
+			  aShape.iRules==aTrieShape.iRules &&
+			  aShape.iMinLength==aTrieShape.iMinLength &&
+			  aShape.iMaxLength==aTrieShape.iMaxLength &&
+			  aShape.iLongPatterns==aTrieShape.iLongPatterns &&
+			  aShape.iTotalLength==aTrieShape.iTotalLength &&
+			  aShape.uiAlphabet==aTrieShape.uiAlphabet &&
+			  aShape.iStates==aTrieShape.iStates,"Wu-Manber shape","");
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%400,"abcde");
+			CheckPolicies(aWuManber,NaiveScan(aRules,sData),sData,"Wu-Manber");
+		}
+	}
+}
+
+//How many tries the publisher test swaps in while its readers search
+static const int PUBLISH_ROUNDS = 300;
+
+//Live copies of the trie of every round (the replicas are copies too)
+static int g_aLiveTries[PUBLISH_ROUNDS+1];
+
+//A trie that counts its live copies, so we see when the publisher frees it
+class CCountedTrie : public CSuffixTrie {
+public:
+	//The trie of a round
+	int GetRound()const
+	{
+		return m_iRound;
+	}
+
+	//The replicas are clones, they are counted too
+	virtual CMatcher* Clone()const
+	{
+		return new CCountedTrie(*this);
+	}
+
+	//Ctor and Dtor
+	explicit CCountedTrie(int iRound) : m_iRound(iRound)
+	{
+		__atomic_add_fetch(&g_aLiveTries[m_iRound],1,__ATOMIC_RELEASE);
+	}
+	CCountedTrie(const CCountedTrie& rTrie) : CSuffixTrie(rTrie),
+											  m_iRound(rTrie.m_iRound)
+	{
+		__atomic_add_fetch(&g_aLiveTries[m_iRound],1,__ATOMIC_RELEASE);
+	}
+	virtual ~CCountedTrie()
+	{
+		__atomic_sub_fetch(&g_aLiveTries[m_iRound],1,__ATOMIC_RELEASE);
+	}
+private:
+	//No assignments
+	CCountedTrie& operator=(const CCountedTrie& rTrie);
+
+	//Our round
+	int m_iRound;
+};
+
+//The trie of a round, its one rule (numbered by the round) is in every payload
+static CCountedTrie* RoundTrie(int iRound)
+{
+	CCountedTrie* pTrie;
+	pTrie=new CCountedTrie(iRound);
+	pTrie->AddString("abc",iRound);
+	pTrie->AddString("xyz",iRound);
+	pTrie->Compile();
+
+	return pTrie;
+}
+
+//Is the trie of a round still alive?
+static bool IsTrieLive(int iRound)
+{
+	return __atomic_load_n(&g_aLiveTries[iRound],__ATOMIC_ACQUIRE)>0;
+}
+
+//A reader of the published tries
+typedef struct _PublishReader {
+	CTriePublisher*	pPublisher;
+	int				iReader;
+	int*			pStop;
+	int				iReads;
+	int				iFailures;
+} PublishReader;
+
+static void* ReadPublished(void* pContext)
+{
+	PublishReader* pReader;
+	pReader=(PublishReader*)pContext;
+
+	static const std::string sData="..abc..";
+
+	int iLastRound;
+	iLastRound=0;
+
+	while (!__atomic_load_n(pReader->pStop,__ATOMIC_ACQUIRE))
+	{
+		const CCountedTrie* pTrie;
+		pTrie=(const CCountedTrie*)pReader->pPublisher->Read();
+
+		if (pTrie)
+		{
+			//Never older than the one we had before our last quiescent state
+			int iRound;
+			iRound=pTrie->GetRound();
+			if (iRound<iLastRound || !IsTrieLive(iRound))
+				++pReader->iFailures;
+			iLastRound=iRound;
+
+			//It finds its own rule, and it is still alive after the search
+			MatchVector aMatches;
+			pTrie->SearchBytes((const unsigned char*)sData.data(),sData.length(),CollectMatch,&aMatches);
+			sched_yield();
+
+			if (aMatches.size()!=1 ||
+				aMatches[0].rule_id!=iRound ||
+				!IsTrieLive(iRound))
+				++pReader->iFailures;
+			++pReader->iReads;
+		}
+
+		//Done with it, and now and then we block a while
+		pReader->pPublisher->Quiescent(pReader->iReader);
+		if (!(pReader->iReads%64))
+		{
+			pReader->pPublisher->Offline(pReader->iReader);
+			sched_yield();
+			pReader->pPublisher->Online(pReader->iReader);
+		}
+	}
+
+	pReader->pPublisher->Offline(pReader->iReader);
+	return NULL;
+}
+
+//A retired trie is freed only after every online reader passed a quiescent state, first step
+//by step, then with readers searching while the tries are swapped
+static void TestPublisher()
+{
+	//Two readers, one holds the first trie
+	CTriePublisher* pPublisher;
+	pPublisher=new CTriePublisher(2);
+	pPublisher->Publish(RoundTrie(1));
+
+	Check(((const CCountedTrie*)pPublisher->Read())->GetRound()==1,"publisher read","");
+	pPublisher->Publish(RoundTrie(2));
+
+	Check(pPublisher->Reclaim()==1 && IsTrieLive(1),"publisher kept","");
+	pPublisher->Quiescent(0);
+	Check(pPublisher->Reclaim()==1 && IsTrieLive(1),"publisher kept","");
+	pPublisher->Quiescent(1);
+	Check(pPublisher->Reclaim()==0 && !IsTrieLive(1),"publisher freed","");
+
+	//An offline reader isn't waited for
+	pPublisher->Publish(RoundTrie(3));
+	pPublisher->Offline(0);
+	Check(pPublisher->Reclaim()==1 && IsTrieLive(2),"publisher kept","");
+	pPublisher->Offline(1);
+	Check(pPublisher->Reclaim()==0 && !IsTrieLive(2),"publisher freed","");
+
+	delete pPublisher;
+	Check(!IsTrieLive(3),"publisher deleted","");
+
+	//Now the readers run while we swap
+	std::vector<PublishReader> aReaders(4);
+	std::vector<pthread_t> aHandles(aReaders.size());
+	pPublisher=new CTriePublisher(aReaders.size());
+
+	int iStop;
+	iStop=0;
+
+	for (size_t iReader=0;
+		 iReader<aReaders.size();
+		 ++iReader)
+	{
+		aReaders[iReader].pPublisher=pPublisher;
+		aReaders[iReader].iReader=iReader;
+		aReaders[iReader].pStop=&iStop;
+		aReaders[iReader].iReads=0;
+		aReaders[iReader].iFailures=0;
+		pthread_create(&aHandles[iReader],NULL,ReadPublished,&aReaders[iReader]);
+	}
+
+	for (int iRound=1;
+		 iRound<=PUBLISH_ROUNDS;
+		 ++iRound)
+	{
+		pPublisher->Publish(RoundTrie(iRound));
+		if (iRound%4==0)
+			pPublisher->Reclaim();
+		sched_yield();
+	}
+
+	__atomic_store_n(&iStop,1,__ATOMIC_RELEASE);
+	for (size_t iReader=0;
+		 iReader<aReaders.size();
+		 ++iReader)
+	{
+		pthread_join(aHandles[iReader],NULL);
+		Check(!aReaders[iReader].iFailures,"publisher readers","");
+	}
+
+	//Only the last one is left, once for each replica
+	pPublisher->Synchronize();
+
+	bool bFreed;
+	bFreed=true;
+	for (int iRound=1;
+		 iRound<PUBLISH_ROUNDS;
+		 ++iRound)
+		bFreed=bFreed && !IsTrieLive(iRound);
+
+	Check(bFreed && g_aLiveTries[PUBLISH_ROUNDS]==pPublisher->GetReplicas(),"publisher synchronize","");
+
+	delete pPublisher;
+	Check(!IsTrieLive(PUBLISH_ROUNDS),"publisher deleted","");
+}
+
+//A reader pinned to a cpu, it searches the replica of its cpu
+typedef struct _ReplicaReader {
+	CTriePublisher*						pPublisher;
+	int									iCpu;
+	const std::vector<std::string>*		pPayloads;
+	const std::vector<MatchVector>*		pExpected;
+	bool								bPinned;
+	const CMatcher*						pRead;
+	int									iFailures;
+} ReplicaReader;
+
+static void* ReadReplica(void* pContext)
+{
+	ReplicaReader* pReader;
+	pReader=(ReplicaReader*)pContext;
+
+	//Run on our cpu (we may not be allowed to)
+	cpu_set_t aCpus;
+	CPU_ZERO(&aCpus);
+	CPU_SET(pReader->iCpu,&aCpus);
+
+	pReader->bPinned=!pthread_setaffinity_np(pthread_self(),sizeof(aCpus),&aCpus) &&
+					 sched_getcpu()==pReader->iCpu;
+
+	pReader->pPublisher->Online(pReader->iCpu);
+	pReader->pRead=pReader->pPublisher->Read();
+
+	for (size_t iPayload=0;
+		 pReader->pRead && iPayload<pReader->pPayloads->size();
+		 ++iPayload)
+	{
+		const std::string& rData=(*pReader->pPayloads)[iPayload];
+
+		MatchVector aMatches;
+		pReader->pRead->SearchBytes((const unsigned char*)rData.data(),rData.length(),CollectMatch,&aMatches);
+		if (!SameMatches(aMatches,(*pReader->pExpected)[iPayload]))
+			++pReader->iFailures;
+	}
+
+	pReader->pPublisher->Offline(pReader->iCpu);
+	return NULL;
+}
+
+//Forced replicas on one node, every cpu reads the replica it is in, and the replicas find the
+//same matches after each reload
+static void TestReplicas()
+{
+	//A reader for every cpu, each of them on it
+	long lCpus;
+	lCpus=sysconf(_SC_NPROCESSORS_CONF);
+	if (lCpus<1)
+		lCpus=1;
+	if (lCpus>CPU_SETSIZE)
+		lCpus=CPU_SETSIZE;
+
+	CTriePublisher aPublisher(lCpus,2);
+	Check(aPublisher.GetReplicas()==2 &&
+		  aPublisher.GetReplicaNode(0)==-1 &&
+		  aPublisher.GetReplicaNode(1)==-1 &&
+		  !aPublisher.GetReplicaMemory(0),"forced replicas","");
+
+	//The cpus are split between them, the readers come online when they run
+	for (long lCpu=0;
+		 lCpu<lCpus;
+		 ++lCpu)
+	{
+		Check(aPublisher.GetCpuReplica(lCpu)==lCpu%2,"replica cpus","");
+		aPublisher.Offline(lCpu);
+	}
+
+	for (int iReload=0;
+		 iReload<4;
+		 ++iReload)
+	{
+		RuleVector aRules;
+		aRules=RandomRules(1+rand()%30,1+rand()%10,"abcd");
+
+		CSuffixTrie* pTrie;
+		pTrie=new CSuffixTrie;
+		for (size_t iRule=0;
+			 iRule<aRules.size();
+			 ++iRule)
+			pTrie->AddString(aRules[iRule].sString,aRules[iRule].iRuleId);
+		pTrie->Compile();
+
+		aPublisher.Publish(pTrie);
+		aPublisher.Synchronize();
+
+		std::vector<std::string> aPayloads;
+		std::vector<MatchVector> aExpected;
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			aPayloads.push_back(RandomPayload(aRules,rand()%300,"abcde"));
+			aExpected.push_back(NaiveScan(aRules,aPayloads.back()));
+		}
+
+		//Each replica is its own copy, with its own memory, and finds the same matches
+		Check(aPublisher.ReadReplica(0)!=aPublisher.ReadReplica(1),"replica copies","");
+
+		for (int iReplica=0;
+			 iReplica<aPublisher.GetReplicas();
+			 ++iReplica)
+		{
+			const CMatcher* pReplica;
+			pReplica=aPublisher.ReadReplica(iReplica);
+
+			Check(aPublisher.GetReplicaMemory(iReplica)>0 &&
+				  aPublisher.GetReplicaMemory(iReplica)==pReplica->GetStats().iMemory,"replica memory","");
+
+			for (size_t iPayload=0;
+				 iPayload<aPayloads.size();
+				 ++iPayload)
+			{
+				MatchVector aMatches;
+				pReplica->SearchBytes((const unsigned char*)aPayloads[iPayload].data(),aPayloads[iPayload].length(),
+									  CollectMatch,&aMatches);
+				Check(SameMatches(aMatches,aExpected[iPayload]),"replica matches",aPayloads[iPayload]);
+			}
+		}
+
+		//Each cpu reads its own replica
+		std::vector<ReplicaReader> aReaders(lCpus);
+		std::vector<pthread_t> aHandles(lCpus);
+
+		for (long lCpu=0;
+			 lCpu<lCpus;
+			 ++lCpu)
+		{
+			aReaders[lCpu].pPublisher=&aPublisher;
+			aReaders[lCpu].iCpu=lCpu;
+			aReaders[lCpu].pPayloads=&aPayloads;
+			aReaders[lCpu].pExpected=&aExpected;
+			aReaders[lCpu].bPinned=false;
+			aReaders[lCpu].pRead=NULL;
+			aReaders[lCpu].iFailures=0;
+			pthread_create(&aHandles[lCpu],NULL,ReadReplica,&aReaders[lCpu]);
+		}
+
+		for (long lCpu=0;
+			 lCpu<lCpus;
+			 ++lCpu)
+		{
+			pthread_join(aHandles[lCpu],NULL);
+
+			Check(!aReaders[lCpu].iFailures,"replica reader matches","");
+			Check(!aReaders[lCpu].bPinned ||
+				  aReaders[lCpu].pRead==aPublisher.ReadReplica(lCpu%2),"replica reader","");
+		}
+	}
+}
+
+//A shape of so many long and short patterns
+static CMatcher::MatcherShape ShapeOf(size_t iLong,
+									  size_t iShort)
+{
+	CMatcher::MatcherShape aShape;
+	aShape.iPatterns=iLong+iShort;
+	aShape.iRules=aShape.iPatterns;
+	aShape.iMinLength=iShort?4:CMatcher::LONG_PATTERN;
+	aShape.iMaxLength=iLong?100:4;
+	aShape.iLongPatterns=iLong;
+	aShape.iTotalLength=iLong*100+iShort*4;
+	aShape.uiAlphabet=64;
+	aShape.iStates=aShape.iTotalLength+1;
+
+	return aShape;
+}
+
+//The strings of a rule set, the ids are their positions (the missing ones empty)
+static std::vector<std::string> RuleStrings(const RuleVector& rRules)
+{
+	std::vector<std::string> aStrings;
+	for (size_t iRule=0;
+		 iRule<rRules.size();
+		 ++iRule)
+	{
+		aStrings.resize(std::max<size_t>(aStrings.size(),rRules[iRule].iRuleId));
+		aStrings[rRules[iRule].iRuleId-1]=rRules[iRule].sString;
+	}
+
+	return aStrings;
+}
+
+//Long pattern sets go to Wu-Manber, the rest to a trie, and Build gives the engine it picked
+static void TestSelectEngine()
+{
+	//By the shape
+	std::string sReason;
+	Check(CMatcher::SelectEngine(ShapeOf(0,0),sReason)==CMatcher::meTrie,"select nothing","");
+	Check(CMatcher::SelectEngine(ShapeOf(CMatcher::WU_MANBER_PATTERNS,0),sReason)==CMatcher::meWuManber,"select long","");
+	Check(CMatcher::SelectEngine(ShapeOf(CMatcher::WU_MANBER_PATTERNS-1,0),sReason)==CMatcher::meDFA,"select few long","");
+	Check(CMatcher::SelectEngine(ShapeOf(90,3),sReason)==CMatcher::meWuManber,"select some short","");
+	Check(CMatcher::SelectEngine(ShapeOf(90,10),sReason)==CMatcher::meDFA,"select many short","");
+	Check(CMatcher::SelectEngine(ShapeOf(0,20),sReason)==CMatcher::meDFA &&
+		  CMatcher::SelectTrieEngine(ShapeOf(0,20),sReason)==CMatcher::meDFA,"select short","");
+
+	for (int iSet=0;
+		 iSet<TEST_SETS;
+		 ++iSet)
+	{
+		//Long patterns (now and then one is short), or patterns of any length
+		bool bLong;
+		bLong=iSet%2==0;
+
+		RuleVector aRules;
+		if (bLong)
+		{
+			aRules=RandomRules(2*CMatcher::WU_MANBER_PATTERNS+rand()%40,24,"abcd");
+			for (size_t iRule=iSet%4?0:1;
+				 iRule<aRules.size();
+				 ++iRule)
+				aRules[iRule].sString+=RandomString(CMatcher::LONG_PATTERN,"abcd");
+		}
+		else
+			aRules=RandomRules(1+rand()%40,1+rand()%20,"abcd");
+
+		//Some rules have no string
+		for (size_t iRule=0;
+			 iRule<aRules.size();
+			 ++iRule)
+			if (!(rand()%10))
+				aRules.erase(aRules.begin()+iRule);
+
+		CMatcher* pMatcher;
+		pMatcher=CMatcher::Build(RuleStrings(aRules));
+
+		//The engine its shape needs, the reason tells why
+		CMatcher::MatcherStats aStats;
+		aStats=pMatcher->GetStats();
+
+		CMatcher::MatcherEngine eEngine;
+		eEngine=CMatcher::SelectEngine(aStats.aShape,sReason);
+
+		Check(aStats.eEngine==eEngine &&
+			  aStats.sReason.find(sReason)==0,"build engine","");
+		Check(!bLong || aStats.eEngine==CMatcher::meWuManber,"build long","");
+
+		//A trie of them compiles to its own best, but tells it is not the best
+		CSuffixTrie aTrie;
+		for (size_t iRule=0;
+			 iRule<aRules.size();
+			 ++iRule)
+			aTrie.AddString(aRules[iRule].sString,aRules[iRule].iRuleId);
+		aTrie.Compile();
+
+		Check(aTrie.GetStats().eEngine==CMatcher::SelectTrieEngine(aStats.aShape,sReason) &&
+			  aTrie.GetStats().aShape.iLongPatterns==aStats.aShape.iLongPatterns,"trie engine","");
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%400,"abcde");
+			CheckPolicies(*pMatcher,NaiveScan(aRules,sData),sData,"build");
+		}
+
+		delete pMatcher;
+	}
+}
+
+//The rule files of long literals
+static const char* TEST_RULE_FILES[] = {
+	"100_rules.conf",
+	"1000_rules.conf"
+};
+
+//The literal rules of a rules file, numbered by their lines like pthread_sample does
+//(the match string follows the addresses, ports and protocol, between quotes)
+static bool ReadRuleFile(const char* pFileName,
+						 RuleVector& rRules)
+{
+	FILE* pFile;
+	pFile=fopen(pFileName,"r");
+	if (!pFile)
+		return false;
+
+	char aLine[4096];
+	int iLine;
+	iLine=0;
+
+	while (fgets(aLine,sizeof(aLine),pFile))
+	{
+		++iLine;
+
+		const char* pFirst;
+		pFirst=strchr(aLine,'"');
+		const char* pLast;
+		pLast=strrchr(aLine,'"');
+		if (!pFirst || pLast<=pFirst+1)
+			continue;
+
+		Rule aRule;
+		aRule.iRuleId=iLine;
+		aRule.sString.assign(pFirst+1,pLast);
+		rRules.push_back(aRule);
+	}
+
+	fclose(pFile);
+	return true;
+}
+
+//The shipped rule files are long literals, they are built to Wu-Manber and find what the trie finds
+//(and the naive scan)
+static void TestRuleFiles()
+{
+	for (size_t iFile=0;
+		 iFile<sizeof(TEST_RULE_FILES)/sizeof(TEST_RULE_FILES[0]);
+		 ++iFile)
+	{
+		RuleVector aRules;
+		Check(ReadRuleFile(TEST_RULE_FILES[iFile],aRules) &&
+			  !aRules.empty(),"read rule file",TEST_RULE_FILES[iFile]);
+
+		CMatcher* pMatcher;
+		pMatcher=CMatcher::Build(RuleStrings(aRules));
+		Check(pMatcher->GetStats().eEngine==CMatcher::meWuManber,"rule file engine",TEST_RULE_FILES[iFile]);
+
+		CSuffixTrie aTrie;
+		BuildTrie(aRules,aTrie);
+		aTrie.Compile();
+
+		for (int iPayload=0;
+			 iPayload<TEST_PAYLOADS;
+			 ++iPayload)
+		{
+			std::string sData;
+			sData=RandomPayload(aRules,rand()%4000,"abcdefghijklmnopqrstuvwxyz!#$%&*+-/<>@^");
+
+			MatchVector aExpected;
+			aExpected=NaiveScan(aRules,sData);
+
+			MatchVector aTrieMatches;
+			aTrie.SearchBytes((const unsigned char*)sData.data(),sData.length(),CollectMatch,&aTrieMatches);
+
+			Check(SameMatches(aTrieMatches,aExpected),"rule file trie",TEST_RULE_FILES[iFile]);
+			CheckPolicies(*pMatcher,aExpected,sData,TEST_RULE_FILES[iFile]);
+		}
+
+		delete pMatcher;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	//The same sets every run, unless a seed is given
+	srand(argc>1?atoi(argv[1]):1);
+
+	TestAllMatches();
+	TestDFA();
+	TestCompact();
+	TestSearchBytes();
+	TestStream();
+	TestBatch();
+	TestPolicies();
+	TestIncremental();
+	TestImage();
+	TestCorruptImage();
+	TestNoCase();
+	TestSaveHeader();
+	TestParallelBuild();
+	TestParallelSearch();
+	TestLayout();
+	TestWuManber();
+	TestSelectEngine();
+	TestRuleFiles();
+	TestRegex();
+	TestRegexThreads();
+	TestWindows();
+	TestPublisher();
+	TestReplicas();
+
+	printf("%d checks, %d failed\n",g_iChecks,g_iFailures);
+	return g_iFailures?1:0;
+}
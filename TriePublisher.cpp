@@ -0,0 +1,437 @@
+#include "TriePublisher.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sched.h>
+
+//Read a sysfs cpu (or node) list, like 0-3,8-11
+static bool ReadCpuList(const char* pPath,
+						std::vector<int>& rList)
+{
+	FILE* pFile;
+	pFile=fopen(pPath,"r");
+	if (!pFile)
+		return false;
+
+	char aLine[4096];
+	bool bRead;
+	bRead=fgets(aLine,sizeof(aLine),pFile)!=NULL;
+	fclose(pFile);
+
+	if (!bRead)
+		return false;
+
+	//The ranges
+	char* pPos;
+	pPos=aLine;
+
+	while (*pPos>='0' && *pPos<='9')
+	{
+		long lFirst;
+		lFirst=strtol(pPos,&pPos,10);
+
+		long lLast;
+		lLast=lFirst;
+		if (*pPos=='-')
+			lLast=strtol(pPos+1,&pPos,10);
+
+		for (long lCount=lFirst;
+			 lCount<=lLast;
+			 ++lCount)
+			rList.push_back((int)lCount);
+
+		if (*pPos==',')
+			++pPos;
+	}
+
+	//Done
+	return true;
+}
+
+CTriePublisher::CTriePublisher(int iReaders,
+							   int iReplicas) : m_pTries(NULL),
+												m_iReplicas(0),
+												m_ulEpoch(1),
+												m_pReaders(NULL),
+												m_iReaders(iReaders)
+{
+	//Where the replicas go
+	LoadTopology(iReplicas);
+
+	//Our slots, cache line aligned so readers don't share lines
+	void* pMemory;
+	if (posix_memalign(&pMemory,64,sizeof(ReaderSlot)*(iReaders?iReaders:1)))
+		pMemory=NULL;
+	m_pReaders=(ReaderSlot*)pMemory;
+
+	//Everybody starts online
+	for (int iCount=0;
+		 m_pReaders && iCount<iReaders;
+		 ++iCount)
+		m_pReaders[iCount].ulEpoch=m_ulEpoch;
+
+	//Init the writer lock
+	pthread_mutex_init(&m_aLock,NULL);
+}
+
+CTriePublisher::~CTriePublisher()
+{
+	//Nobody reads anymore, free everything
+	for (size_t iCount=0;
+		 iCount<m_aRetired.size();
+		 ++iCount)
+		FreeReplicas(m_aRetired[iCount].pTries);
+
+	FreeReplicas(m_pTries);
+	free(m_pReaders);
+
+	pthread_mutex_destroy(&m_aLock);
+}
+
+void CTriePublisher::LoadTopology(int iReplicas)
+{
+	//The NUMA nodes, the ones without cpus have no readers
+	if (!iReplicas)
+	{
+		std::vector<int> aNodes;
+		ReadCpuList("/sys/devices/system/node/online",aNodes);
+
+		for (size_t iNode=0;
+			 iNode<aNodes.size();
+			 ++iNode)
+		{
+			char aPath[64];
+			snprintf(aPath,
+					 sizeof(aPath),
+					 "/sys/devices/system/node/node%d/cpulist",
+					 aNodes[iNode]);
+
+			std::vector<int> aCpus;
+			if (ReadCpuList(aPath,aCpus) &&
+				!aCpus.empty())
+			{
+				m_aReplicaNodes.push_back(aNodes[iNode]);
+				m_aReplicaCpus.push_back(aCpus);
+			}
+		}
+	}
+
+	//Forced (or we don't know the nodes), split the cpus round robin
+	if (m_aReplicaCpus.empty())
+	{
+		int iCount;
+		iCount=iReplicas>0?iReplicas:1;
+
+		long lCpus;
+		lCpus=sysconf(_SC_NPROCESSORS_CONF);
+		if (lCpus<1)
+			lCpus=1;
+
+		m_aReplicaNodes.assign(iCount,-1);
+		m_aReplicaCpus.resize(iCount);
+
+		for (long lCpu=0;
+			 lCpu<lCpus;
+			 ++lCpu)
+			m_aReplicaCpus[lCpu%iCount].push_back((int)lCpu);
+	}
+
+	m_iReplicas=(int)m_aReplicaCpus.size();
+
+	//The replica of every cpu
+	for (int iReplica=0;
+		 iReplica<m_iReplicas;
+		 ++iReplica)
+		for (size_t iCpu=0;
+			 iCpu<m_aReplicaCpus[iReplica].size();
+			 ++iCpu)
+		{
+			int iIndex;
+			iIndex=m_aReplicaCpus[iReplica][iCpu];
+
+			if (iIndex>=(int)m_aCpuReplicas.size())
+				m_aCpuReplicas.resize(iIndex+1,0);
+			m_aCpuReplicas[iIndex]=iReplica;
+		}
+}
+
+int CTriePublisher::GetReplicas()const
+{
+	return m_iReplicas;
+}
+
+int CTriePublisher::GetReplicaNode(int iReplica)const
+{
+	if (iReplica<0 || iReplica>=m_iReplicas)
+		return -1;
+	else
+		return m_aReplicaNodes[iReplica];
+}
+
+int CTriePublisher::GetCpuReplica(int iCpu)const
+{
+	//Cpus we don't know read the first one
+	if (iCpu<0 || iCpu>=(int)m_aCpuReplicas.size())
+		return 0;
+	else
+		return m_aCpuReplicas[iCpu];
+}
+
+size_t CTriePublisher::GetReplicaMemory(int iReplica)const
+{
+	//Sanity check
+	if (iReplica<0 || iReplica>=m_iReplicas)
+		return 0;
+
+	//The writers don't retire it while we look
+	pthread_mutex_lock(&m_aLock);
+
+	size_t iMemory;
+	if (m_pTries)
+		iMemory=m_pTries[iReplica]->GetStats().iMemory;
+	else
+		iMemory=0;
+
+	pthread_mutex_unlock(&m_aLock);
+
+	//Done
+	return iMemory;
+}
+
+void* CTriePublisher::CloneThread(void* pJob)
+{
+	//Our pages are touched first by us, so they are on our node
+	CloneJob* pCloneJob;
+	pCloneJob=(CloneJob*)pJob;
+	pCloneJob->pClone=pCloneJob->pTrie->Clone();
+
+	//Done
+	return NULL;
+}
+
+CMatcher** CTriePublisher::MakeReplicas(CMatcher* pTrie)const
+{
+	//Nothing to replicate
+	if (!pTrie)
+		return NULL;
+
+	CMatcher** pTries;
+	pTries=new CMatcher*[m_iReplicas];
+
+	//The trie was built here, it is the replica of our node
+	int iOwn;
+	iOwn=m_iReplicas>1?GetCpuReplica(sched_getcpu()):0;
+
+	//Clone it for the others, each on the cpus of its replica
+	std::vector<CloneJob> aJobs(m_iReplicas);
+	std::vector<pthread_t> aThreads(m_iReplicas);
+	std::vector<bool> aStarted(m_iReplicas,false);
+
+	for (int iReplica=0;
+		 iReplica<m_iReplicas;
+		 ++iReplica)
+	{
+		if (iReplica==iOwn)
+			continue;
+
+		aJobs[iReplica].pTrie=pTrie;
+		aJobs[iReplica].pClone=NULL;
+
+		//Pin it
+		cpu_set_t aCpus;
+		CPU_ZERO(&aCpus);
+
+		for (size_t iCpu=0;
+			 iCpu<m_aReplicaCpus[iReplica].size();
+			 ++iCpu)
+			if (m_aReplicaCpus[iReplica][iCpu]<CPU_SETSIZE)
+				CPU_SET(m_aReplicaCpus[iReplica][iCpu],&aCpus);
+
+		pthread_attr_t aAttr;
+		pthread_attr_init(&aAttr);
+		pthread_attr_setaffinity_np(&aAttr,sizeof(aCpus),&aCpus);
+
+		aStarted[iReplica]=!pthread_create(&aThreads[iReplica],&aAttr,CloneThread,&aJobs[iReplica]);
+		pthread_attr_destroy(&aAttr);
+
+		//Can't run there, clone it here (it is the same trie, only not local)
+		if (!aStarted[iReplica])
+			CloneThread(&aJobs[iReplica]);
+	}
+
+	//Collect them
+	for (int iReplica=0;
+		 iReplica<m_iReplicas;
+		 ++iReplica)
+	{
+		if (aStarted[iReplica])
+			pthread_join(aThreads[iReplica],NULL);
+
+		if (iReplica==iOwn)
+			pTries[iReplica]=pTrie;
+		else
+			pTries[iReplica]=aJobs[iReplica].pClone;
+	}
+
+	//Done
+	return pTries;
+}
+
+void CTriePublisher::FreeReplicas(CMatcher** pTries)const
+{
+	if (!pTries)
+		return;
+
+	for (int iReplica=0;
+		 iReplica<m_iReplicas;
+		 ++iReplica)
+		delete pTries[iReplica];
+
+	delete [] pTries;
+}
+
+const CMatcher* CTriePublisher::Read()const
+{
+	//Pairs with the release in Publish
+	CMatcher** pTries;
+	pTries=__atomic_load_n(&m_pTries,__ATOMIC_ACQUIRE);
+
+	if (!pTries)
+		return NULL;
+
+	//One replica, we don't need to know where we run
+	if (m_iReplicas==1)
+		return pTries[0];
+
+	//The replica of our node (if we move it is still the same trie, only not local)
+	return pTries[GetCpuReplica(sched_getcpu())];
+}
+
+const CMatcher* CTriePublisher::ReadReplica(int iReplica)const
+{
+	//Sanity check
+	if (iReplica<0 || iReplica>=m_iReplicas)
+		return NULL;
+
+	//Pairs with the release in Publish
+	CMatcher** pTries;
+	pTries=__atomic_load_n(&m_pTries,__ATOMIC_ACQUIRE);
+
+	if (!pTries)
+		return NULL;
+	else
+		return pTries[iReplica];
+}
+
+void CTriePublisher::Quiescent(int iReader)
+{
+	//Everything we read before is done, and we see the current epoch's trie from now on
+	__atomic_store_n(&m_pReaders[iReader].ulEpoch,
+					 __atomic_load_n(&m_ulEpoch,__ATOMIC_ACQUIRE),
+					 __ATOMIC_RELEASE);
+}
+
+void CTriePublisher::Offline(int iReader)
+{
+	//We hold nothing, don't wait for us
+	__atomic_store_n(&m_pReaders[iReader].ulEpoch,0,__ATOMIC_RELEASE);
+}
+
+void CTriePublisher::Online(int iReader)
+{
+	//Tell the writers we are here before we read any trie
+	__atomic_store_n(&m_pReaders[iReader].ulEpoch,
+					 __atomic_load_n(&m_ulEpoch,__ATOMIC_ACQUIRE),
+					 __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void CTriePublisher::Publish(CMatcher* pTrie)
+{
+	//The replicas, made before we lock so the other writers don't wait on the clones
+	CMatcher** pTries;
+	pTries=MakeReplicas(pTrie);
+
+	pthread_mutex_lock(&m_aLock);
+
+	//Swap them all in at once
+	CMatcher** pOld;
+	pOld=__atomic_exchange_n(&m_pTries,pTries,__ATOMIC_ACQ_REL);
+
+	//New epoch, a reader that saw it can't see the old trie
+	unsigned long ulEpoch;
+	ulEpoch=__atomic_add_fetch(&m_ulEpoch,1,__ATOMIC_ACQ_REL);
+
+	//Retire the old one
+	if (pOld)
+	{
+		Retired aRetired;
+		aRetired.pTries=pOld;
+		aRetired.ulEpoch=ulEpoch;
+		m_aRetired.push_back(aRetired);
+	}
+
+	pthread_mutex_unlock(&m_aLock);
+}
+
+unsigned long CTriePublisher::GetOldestEpoch()const
+{
+	//Order our read of the slots after the epoch change
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	//The oldest online reader
+	unsigned long ulOldest;
+	ulOldest=0;
+
+	for (int iCount=0;
+		 iCount<m_iReaders;
+		 ++iCount)
+	{
+		//Is it online?
+		unsigned long ulEpoch;
+		ulEpoch=__atomic_load_n(&m_pReaders[iCount].ulEpoch,__ATOMIC_ACQUIRE);
+
+		if (ulEpoch &&
+			(!ulOldest || ulEpoch<ulOldest))
+			ulOldest=ulEpoch;
+	}
+
+	//Done
+	return ulOldest;
+}
+
+size_t CTriePublisher::Reclaim()
+{
+	pthread_mutex_lock(&m_aLock);
+
+	//Where are the readers?
+	unsigned long ulOldest;
+	ulOldest=GetOldestEpoch();
+
+	//Free what nobody can see
+	size_t iKept;
+	iKept=0;
+
+	for (size_t iCount=0;
+		 iCount<m_aRetired.size();
+		 ++iCount)
+		if (!ulOldest ||
+			m_aRetired[iCount].ulEpoch<=ulOldest)
+			FreeReplicas(m_aRetired[iCount].pTries);
+		else
+			m_aRetired[iKept++]=m_aRetired[iCount];
+
+	m_aRetired.resize(iKept);
+
+	pthread_mutex_unlock(&m_aLock);
+
+	//Done
+	return iKept;
+}
+
+void CTriePublisher::Synchronize()
+{
+	//Wait for the readers to pass a quiescent state
+	while (Reclaim())
+		sched_yield();
+}
@@ -0,0 +1,131 @@
+#ifndef TRIEPUBLISHER_H
+#define TRIEPUBLISHER_H
+
+#include <vector>
+#include <pthread.h>
+
+#include "Matcher.h"
+
+//Publishes a compiled trie (any CMatcher) to matcher threads and swaps it while they keep scanning
+//Readers never lock, they only announce from time to time that they hold no trie
+//(quiescent state), the old tries are freed once every reader did that after a swap
+//On a NUMA machine every node gets its own replica of the trie, allocated by a thread running on
+//the node (first touch), and a reader gets the replica of the node it runs on
+class CTriePublisher {
+
+public:
+	//Reader side, no locks and no atomic read-modify-write
+
+	//Get the current trie (the replica of our node), it stays valid until this reader calls Quiescent or Offline
+	const CMatcher* Read()const;
+
+	//Get the current trie of a replica, any node's (to check the replicas), it stays valid like the one of Read
+	const CMatcher* ReadReplica(int iReplica)const;
+
+	//The reader holds no trie anymore (call it between packets or batches)
+	void Quiescent(int iReader);
+
+	//The reader is going to block for a while (it must not hold a trie)
+	void Offline(int iReader);
+
+	//The reader is back
+	void Online(int iReader);
+
+	//Writer side, writers are serialized
+
+	//Publish a new trie, we own it from now on (the old one is retired)
+	//It becomes the replica of the node we run on, the other nodes get a clone, all of them are
+	//swapped in at once so the readers never see two rule sets
+	void Publish(CMatcher* pTrie);
+
+	//Free the retired tries no reader can see anymore
+	//Returns how many are still waiting
+	size_t Reclaim();
+
+	//Wait until all the retired tries are freed
+	void Synchronize();
+
+	//Replicas
+
+	//How many replicas
+	int GetReplicas()const;
+
+	//The NUMA node of a replica (-1 if the replicas are forced)
+	int GetReplicaNode(int iReplica)const;
+
+	//Memory used by the current trie of a replica (in bytes, 0 if nothing was published)
+	size_t GetReplicaMemory(int iReplica)const;
+
+	//Which replica a cpu reads
+	int GetCpuReplica(int iCpu)const;
+
+	//Ctor and Dtor (readers are numbered 0..iReaders-1, they start online)
+	//With iReplicas 0 there is a replica per NUMA node, else the cpus are split between iReplicas
+	//replicas (forced, to test the replicas on one node)
+	CTriePublisher(int iReaders,
+				   int iReplicas=0);
+	virtual ~CTriePublisher();
+private:
+	//No copies
+	CTriePublisher(const CTriePublisher& rPublisher);
+	CTriePublisher& operator=(const CTriePublisher& rPublisher);
+
+	//A reader slot, one per cache line
+	typedef struct _ReaderSlot {
+		unsigned long	ulEpoch;	//Last epoch the reader saw, 0 when offline
+		char			aPad[64-sizeof(unsigned long)];
+	} ReaderSlot;
+
+	//A retired trie
+	typedef struct _Retired {
+		CMatcher**		pTries;		//The trie of every replica
+		unsigned long	ulEpoch;	//Readers must have seen this epoch before we free it
+	} Retired;
+
+	//A clone made on a replica's cpus
+	typedef struct _CloneJob {
+		const CMatcher*	pTrie;		//Clone it
+		CMatcher*		pClone;		//Here
+	} CloneJob;
+
+	//Which cpus are in which replica (the NUMA nodes, or the forced split)
+	void LoadTopology(int iReplicas);
+
+	//Make the trie of every replica, pTrie is one of them
+	CMatcher** MakeReplicas(CMatcher* pTrie)const;
+
+	//Free the trie of every replica
+	void FreeReplicas(CMatcher** pTries)const;
+
+	//Clones a trie (runs on the cpus of a replica)
+	static void* CloneThread(void* pJob);
+
+	//Oldest epoch a reader can still be in (0 if no reader is online)
+	unsigned long GetOldestEpoch()const;
+
+	//The current trie of every replica (NULL if nothing was published)
+	CMatcher** m_pTries;
+
+	//The replicas, their NUMA nodes and cpus
+	int m_iReplicas;
+	std::vector<int> m_aReplicaNodes;
+	std::vector<std::vector<int> > m_aReplicaCpus;
+
+	//The replica of every cpu
+	std::vector<int> m_aCpuReplicas;
+
+	//Current epoch, goes up on every publish
+	unsigned long m_ulEpoch;
+
+	//The readers
+	ReaderSlot* m_pReaders;
+	int m_iReaders;
+
+	//Tries waiting to be freed
+	std::vector<Retired> m_aRetired;
+
+	//Serializes the writers (and the memory reports)
+	mutable pthread_mutex_t m_aLock;
+};
+
+#endif
@@ -0,0 +1,404 @@
+#include "WuManber.h"
+#include <algorithm>
+#include <cstring>
+#include <time.h>
+#include <stdio.h>
+
+const unsigned int CWuManber::WINDOW_MIN;
+const unsigned int CWuManber::BLOCK_LENGTH;
+const unsigned int CWuManber::HASH_BITS;
+const unsigned int CWuManber::PREFIX_LENGTH;
+
+//Monotonic time in milliseconds
+static double GetTimeMS()
+{
+	timespec aTime;
+	clock_gettime(CLOCK_MONOTONIC,&aTime);
+	return aTime.tv_sec*1000.0+aTime.tv_nsec/1000000.0;
+}
+
+CWuManber::CWuManber()
+{
+	//Nothing was built yet
+	Clear();
+}
+
+CWuManber::~CWuManber()
+{
+}
+
+void CWuManber::Clear()
+{
+	//No patterns (ids start over)
+	m_aPatterns.clear();
+	m_aPatternRules.clear();
+	m_aPatternIndex.clear();
+	m_aShort.Clear();
+	m_iShort=0;
+	m_iRuleId=0;
+
+	//No tables
+	m_iWindow=0;
+	m_aShift.clear();
+	m_aBuckets.clear();
+	m_aEntries.clear();
+	m_dBuildTime=0;
+	m_sReason.clear();
+}
+
+int CWuManber::AddString(const std::string& rString,
+						 int iRuleId)
+{
+	//Sanity check
+	if (rString.empty() || iRuleId<0)
+		return 0;
+
+	//Our rule id, the next one if we don't have it (ids start at 1)
+	if (!iRuleId)
+		iRuleId=m_iRuleId+1;
+	m_iRuleId=std::max(m_iRuleId,iRuleId);
+
+	//A short one goes to the trie, with our id
+	if (rString.length()<WINDOW_MIN)
+	{
+		m_aShort.AddString(rString,iRuleId);
+		++m_iShort;
+		return iRuleId;
+	}
+
+	//Do we have the pattern?
+	unsigned int uiPattern;
+	std::map<std::string,unsigned int>::const_iterator aIterator;
+	aIterator=m_aPatternIndex.find(rString);
+	if (aIterator==m_aPatternIndex.end())
+	{
+		uiPattern=m_aPatterns.size();
+		m_aPatternIndex[rString]=uiPattern;
+		m_aPatterns.push_back(rString);
+		m_aPatternRules.push_back(RuleVector());
+	}
+	else
+		uiPattern=aIterator->second;
+
+	//Add the rule (once)
+	RuleVector& rRules=m_aPatternRules[uiPattern];
+	RuleVector::iterator aRule;
+	aRule=std::lower_bound(rRules.begin(),rRules.end(),iRuleId);
+	if (aRule==rRules.end() || *aRule!=iRuleId)
+		rRules.insert(aRule,iRuleId);
+
+	//Done
+	return iRuleId;
+}
+
+unsigned int CWuManber::BlockHash(const unsigned char* pData)const
+{
+	//The block bytes, then a multiplicative hash
+	unsigned int uiBlock;
+	uiBlock=pData[-2] | pData[-1]<<8 | pData[0]<<16;
+	return (uiBlock*2654435761U)>>(32-HASH_BITS);
+}
+
+void CWuManber::Compile()
+{
+	//Time the build
+	double dStart;
+	dStart=GetTimeMS();
+
+	//The short ones
+	if (m_iShort)
+		m_aShort.Compile();
+
+	//Drop the tables
+	m_iWindow=0;
+	m_aShift.clear();
+	m_aBuckets.clear();
+	m_aEntries.clear();
+
+	//The window is the shortest long pattern
+	if (!m_aPatterns.empty())
+	{
+		m_iWindow=m_aPatterns[0].length();
+		for (size_t iPattern=1; iPattern<m_aPatterns.size(); ++iPattern)
+			m_iWindow=std::min(m_iWindow,m_aPatterns[iPattern].length());
+
+		//A block found nowhere in the windows lets the window jump past it (as far as a byte holds)
+		m_aShift.assign(1<<HASH_BITS,(unsigned char)std::min<size_t>(m_iWindow-BLOCK_LENGTH+1,255));
+
+		//Every block of every window, the nearer the end the less we can jump
+		for (size_t iPattern=0; iPattern<m_aPatterns.size(); ++iPattern)
+		{
+			const unsigned char* pPattern;
+			pPattern=(const unsigned char*)m_aPatterns[iPattern].data();
+
+			for (size_t iEnd=BLOCK_LENGTH-1; iEnd<m_iWindow; ++iEnd)
+			{
+				unsigned int uiHash;
+				uiHash=BlockHash(pPattern+iEnd);
+				m_aShift[uiHash]=(unsigned char)std::min<size_t>(m_aShift[uiHash],m_iWindow-1-iEnd);
+			}
+		}
+
+		//The patterns by the hash of their last window block (counted then placed)
+		m_aBuckets.assign((1<<HASH_BITS)+1,0);
+		for (size_t iPattern=0; iPattern<m_aPatterns.size(); ++iPattern)
+			++m_aBuckets[BlockHash((const unsigned char*)m_aPatterns[iPattern].data()+m_iWindow-1)+1];
+
+		for (size_t iHash=0; iHash<(1U<<HASH_BITS); ++iHash)
+			m_aBuckets[iHash+1]+=m_aBuckets[iHash];
+
+		std::vector<unsigned int> aNext(m_aBuckets.begin(),m_aBuckets.end()-1);
+		m_aEntries.resize(m_aPatterns.size());
+		for (size_t iPattern=0; iPattern<m_aPatterns.size(); ++iPattern)
+		{
+			WindowEntry aEntry;
+			memcpy(&aEntry.uiPrefix,m_aPatterns[iPattern].data(),PREFIX_LENGTH);
+			aEntry.uiPattern=iPattern;
+			m_aEntries[aNext[BlockHash((const unsigned char*)m_aPatterns[iPattern].data()+m_iWindow-1)]++]=aEntry;
+		}
+	}
+
+	//Done
+	m_dBuildTime=GetTimeMS()-dStart;
+}
+
+template<class Policy>
+bool CWuManber::SearchWindows(const unsigned char* pData,
+							  size_t iLength,
+							  Policy& rPolicy)const
+{
+	//Nothing long to find
+	if (!m_iWindow || iLength<m_iWindow)
+		return true;
+
+	//Our tables
+	const unsigned char* pShift;
+	pShift=&m_aShift[0];
+
+	//The last byte of the window
+	size_t iEnd;
+	iEnd=m_iWindow-1;
+
+	while (iEnd<iLength)
+	{
+		//Jump while no window ends with this block
+		unsigned int uiHash;
+		uiHash=BlockHash(pData+iEnd);
+		if (pShift[uiHash])
+		{
+			iEnd+=pShift[uiHash];
+			continue;
+		}
+
+		//The window starts here, check the patterns ending it with this block
+		size_t iStart;
+		iStart=iEnd+1-m_iWindow;
+
+		unsigned int uiPrefix;
+		memcpy(&uiPrefix,pData+iStart,PREFIX_LENGTH);
+
+		for (unsigned int uiEntry=m_aBuckets[uiHash];
+			 uiEntry<m_aBuckets[uiHash+1];
+			 ++uiEntry)
+		{
+			//The leading bytes first
+			const WindowEntry& rEntry=m_aEntries[uiEntry];
+			if (rEntry.uiPrefix!=uiPrefix)
+				continue;
+
+			//Then all of it (it may go past the window)
+			const std::string& rPattern=m_aPatterns[rEntry.uiPattern];
+			if (rPattern.length()>iLength-iStart ||
+				memcmp(pData+iStart+PREFIX_LENGTH,
+					   rPattern.data()+PREFIX_LENGTH,
+					   rPattern.length()-PREFIX_LENGTH))
+				continue;
+
+			//Report every rule of it
+			Match aMatch;
+			aMatch.iFoundPosition=iStart;
+			aMatch.iEndPosition=iStart+rPattern.length()-1;
+
+			const RuleVector& rRules=m_aPatternRules[rEntry.uiPattern];
+			for (size_t iRule=0; iRule<rRules.size(); ++iRule)
+			{
+				aMatch.rule_id=rRules[iRule];
+				if (!rPolicy.Report(aMatch))
+					return false;
+			}
+		}
+
+		//Next window
+		++iEnd;
+	}
+
+	//Done
+	return true;
+}
+
+void CWuManber::SearchBytes(const unsigned char* pData,
+							size_t iLength,
+							MatchCallback pCallback,
+							void* pContext)const
+{
+	//The long ones, then the short ones (unless the caller stopped us)
+	CallbackPolicy aPolicy;
+	aPolicy.pCallback=pCallback;
+	aPolicy.pContext=pContext;
+	if (SearchWindows(pData,iLength,aPolicy) && m_iShort)
+		m_aShort.SearchBytes(pData,iLength,pCallback,pContext);
+}
+
+bool CWuManber::SearchExists(const unsigned char* pData,
+							 size_t iLength)const
+{
+	//Stop at the first one
+	ExistsPolicy aPolicy;
+	aPolicy.bFound=false;
+	SearchWindows(pData,iLength,aPolicy);
+
+	//Done
+	return aPolicy.bFound ||
+		   (m_iShort && m_aShort.SearchExists(pData,iLength));
+}
+
+size_t CWuManber::SearchCount(const unsigned char* pData,
+							  size_t iLength)const
+{
+	//Count them all
+	CountPolicy aPolicy;
+	aPolicy.iCount=0;
+	SearchWindows(pData,iLength,aPolicy);
+
+	//Done
+	return aPolicy.iCount+
+		   (m_iShort?m_aShort.SearchCount(pData,iLength):0);
+}
+
+void CWuManber::SearchRules(const unsigned char* pData,
+							size_t iLength,
+							unsigned long long* pRules,
+							size_t iRuleWords)const
+{
+	//Set their bits
+	RulesPolicy aPolicy;
+	aPolicy.pRules=pRules;
+	aPolicy.iRuleWords=iRuleWords;
+	SearchWindows(pData,iLength,aPolicy);
+	if (m_iShort)
+		m_aShort.SearchRules(pData,iLength,pRules,iRuleWords);
+}
+
+CMatcher* CWuManber::Clone()const
+{
+	return new CWuManber(*this);
+}
+
+CWuManber::MatcherStats CWuManber::GetStats()const
+{
+	//Our stats
+	MatcherStats aStats;
+	aStats.eEngine=meWuManber;
+	aStats.iMemory=GetSize();
+	aStats.dBuildTime=m_dBuildTime;
+
+	//The shape of the short ones, then ours
+	MatcherShape& rShape=aStats.aShape;
+	rShape=m_aShort.GetStats().aShape;
+
+	size_t iShort;
+	iShort=rShape.iPatterns;
+
+	for (size_t iPattern=0; iPattern<m_aPatterns.size(); ++iPattern)
+	{
+		const std::string& rPattern=m_aPatterns[iPattern];
+		rShape.iMinLength=rShape.iPatterns?std::min(rShape.iMinLength,rPattern.length()):rPattern.length();
+		rShape.iMaxLength=std::max(rShape.iMaxLength,rPattern.length());
+		rShape.iTotalLength+=rPattern.length();
+		rShape.iRules+=m_aPatternRules[iPattern].size();
+		++rShape.iPatterns;
+		++rShape.iLongPatterns;
+	}
+
+	//The bytes and the trie states of all the patterns, as one trie would have them (a state per
+	//distinct prefix, the sorted patterns add what they don't share with the one before)
+	std::vector<std::string> aAll;
+	aAll=m_aShort.GetAllStringsVector();
+	aAll.insert(aAll.end(),m_aPatterns.begin(),m_aPatterns.end());
+	std::sort(aAll.begin(),aAll.end());
+
+	bool aUsed[256];
+	memset(aUsed,0,sizeof(aUsed));
+	rShape.iStates=1;
+
+	for (size_t iPattern=0; iPattern<aAll.size(); ++iPattern)
+	{
+		const std::string& rPattern=aAll[iPattern];
+		for (size_t iCount=0; iCount<rPattern.length(); ++iCount)
+			aUsed[(unsigned char)rPattern[iCount]]=true;
+
+		size_t iShared;
+		iShared=0;
+		if (iPattern)
+			while (iShared<rPattern.length() &&
+				   iShared<aAll[iPattern-1].length() &&
+				   rPattern[iShared]==aAll[iPattern-1][iShared])
+				++iShared;
+
+		rShape.iStates+=rPattern.length()-iShared;
+	}
+
+	rShape.uiAlphabet=std::count(aUsed,aUsed+256,true);
+
+	//How it was built
+	char aReason[256];
+	if (!m_iWindow && !m_iShort)
+		snprintf(aReason,
+				 sizeof(aReason),
+				 "nothing was compiled");
+	else if (!m_iWindow)
+		snprintf(aReason,
+				 sizeof(aReason),
+				 "no pattern is %u bytes or longer, the %lu patterns are in the trie",
+				 WINDOW_MIN,
+				 (unsigned long)iShort);
+	else
+	{
+		//How far the window jumps on a block no window ends with
+		size_t iJumps;
+		iJumps=0;
+		for (size_t iHash=0; iHash<m_aShift.size(); ++iHash)
+			iJumps+=m_aShift[iHash];
+
+		snprintf(aReason,
+				 sizeof(aReason),
+				 "%lu patterns over a %lu byte window, %u byte blocks jump %.1f bytes on average, %lu shorter than %u bytes in the trie",
+				 (unsigned long)m_aPatterns.size(),
+				 (unsigned long)m_iWindow,
+				 BLOCK_LENGTH,
+				 (double)iJumps/m_aShift.size(),
+				 (unsigned long)iShort,
+				 WINDOW_MIN);
+	}
+	aStats.sReason=m_sReason.empty()?aReason:m_sReason+", "+aReason;
+
+	//Done
+	return aStats;
+}
+
+size_t CWuManber::GetSize()const
+{
+	//The tables
+	size_t iSize;
+	iSize=m_aShift.capacity()+
+		  m_aBuckets.capacity()*sizeof(unsigned int)+
+		  m_aEntries.capacity()*sizeof(WindowEntry);
+
+	//The patterns
+	for (size_t iPattern=0; iPattern<m_aPatterns.size(); ++iPattern)
+		iSize+=m_aPatterns[iPattern].capacity()+
+			   m_aPatternRules[iPattern].capacity()*sizeof(int);
+
+	//And the trie
+	return iSize+m_aShort.GetStats().iMemory;
+}
@@ -0,0 +1,130 @@
+#ifndef WUMANBER_H
+#define WUMANBER_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Matcher.h"
+#include "SuffixTrie.h"
+
+//Wu-Manber multi pattern matcher, for rule sets of long patterns
+//A window as long as the shortest pattern slides over the data, the shift table tells how far
+//it can jump by the last block of bytes in it, so long patterns skip most of the data
+//Patterns shorter than WINDOW_MIN would make the jumps short, they are searched by a trie instead
+//The matches are the same as the trie reports (but not in the same order), the case matters
+//CMatcher::Build picks it for rule sets of long patterns (like the shipped rule files)
+class CWuManber : public CMatcher {
+
+public:
+	//Add a pattern for a rule, returns the rule id (0 if the pattern is empty)
+	//With iRuleId 0 the matcher gives the next id (ids start at 1)
+	//A pattern added for many rules is one pattern, its matches report every rule it has
+	virtual int AddString(const std::string& rString,
+						  int iRuleId=0);
+
+	//Build the shift table (and the trie of the short patterns)
+	//This is done when all the patterns were added, the searches need it
+	virtual void Compile();
+
+	//Search raw bytes and call pCallback for every match
+	//The long patterns report by where they start, then the short ones by where they end
+	virtual void SearchBytes(const unsigned char* pData,
+							 size_t iLength,
+							 MatchCallback pCallback,
+							 void* pContext)const;
+
+	//Did anything match? (stops at the first match)
+	virtual bool SearchExists(const unsigned char* pData,
+							  size_t iLength)const;
+
+	//How many matches
+	virtual size_t SearchCount(const unsigned char* pData,
+							   size_t iLength)const;
+
+	//Set the bit of every rule that matched (bit rule_id of pRules, it has iRuleWords words)
+	virtual void SearchRules(const unsigned char* pData,
+							 size_t iLength,
+							 unsigned long long* pRules,
+							 size_t iRuleWords)const;
+
+	//What was compiled
+	virtual MatcherStats GetStats()const;
+
+	//A copy
+	virtual CMatcher* Clone()const;
+
+	//Drop all the patterns (ids start over)
+	void Clear();
+
+	//Memory used by the tables and the patterns (in bytes)
+	size_t GetSize()const;
+
+	//Ctor and Dtor
+	CWuManber();
+	virtual ~CWuManber();
+private:
+	//The rules of a pattern (sorted)
+	typedef std::vector<int> RuleVector;
+
+	//A pattern the shift table found, its leading bytes are checked before the pattern
+	typedef struct _WindowEntry {
+		unsigned int	uiPrefix;	//The first PREFIX_LENGTH bytes of the pattern
+		unsigned int	uiPattern;	//Which pattern
+	} WindowEntry;
+
+	//Shorter patterns go to the trie
+	static const unsigned int WINDOW_MIN = LONG_PATTERN;
+
+	//Bytes of a block, the hash of the last block of the window picks the shift
+	static const unsigned int BLOCK_LENGTH = 3;
+
+	//Bits of the block hash (the shift table has an entry per hash)
+	static const unsigned int HASH_BITS = 16;
+
+	//Leading bytes checked before the pattern
+	static const unsigned int PREFIX_LENGTH = 4;
+private:
+	//Hash of the block ending at pData (the last byte of the window)
+	unsigned int BlockHash(const unsigned char* pData)const;
+
+	//Slide the window over the data, rPolicy.Report(rMatch) gets the matches of the long patterns
+	//Returns false if the policy stopped it
+	template<class Policy>
+	bool SearchWindows(const unsigned char* pData,
+					   size_t iLength,
+					   Policy& rPolicy)const;
+
+	//The long patterns and their rules (same index)
+	std::vector<std::string> m_aPatterns;
+	std::vector<RuleVector> m_aPatternRules;
+
+	//Where each long pattern is
+	std::map<std::string,unsigned int> m_aPatternIndex;
+
+	//The short patterns
+	CSuffixTrie m_aShort;
+	size_t m_iShort;
+
+	//The last rule id we gave (or were given)
+	int m_iRuleId;
+
+	//Length of the window, the shortest long pattern (0 if there are no tables)
+	size_t m_iWindow;
+
+	//How far the window can jump for the hash of its last block (0 is a candidate)
+	std::vector<unsigned char> m_aShift;
+
+	//The candidates of each hash, aEntries[aBuckets[hash]..aBuckets[hash+1])
+	std::vector<unsigned int> m_aBuckets;
+	std::vector<WindowEntry> m_aEntries;
+
+	//Time of the last build
+	double m_dBuildTime;
+
+	//Why Build picked us (empty if the caller did)
+	friend class CMatcher;
+	std::string m_sReason;
+};
+
+#endif
@@ -66,6 +66,11 @@ struct rule_t{
     port_t *        dst_port;
     char *          protocol;
     char *          match_str;
+    int             is_regex;           /* match_str is a regex */
+    unsigned int    offset;             /* Match starts this far into the payload */
+    unsigned int    depth;              /* And ends in depth bytes from offset (0: no bound) */
+    unsigned int    within;             /* Ends at most within bytes after a match of the
+                                           previous rule (0: none) */
 }; /* Data structure for storing the whole rule */
 
 
@@ -73,7 +78,8 @@ struct rule_t{
 cidr_t* parse_cidr(char * in_str);
 port_t* parse_port(char * in_str);
 char*   parse_protocol(char * in_str);
-char*   parse_match_string(char * in_str);
+char*   parse_match_string(char * in_str, int * is_regex);
+void    parse_window(char * in_str, rule_t * rule);
 
 // ==== Main course ====
 int main( int argc, char* argv[] ) {
@@ -112,7 +118,8 @@ int main( int argc, char* argv[] ) {
             rule.dst_ip = parse_cidr(dst_ip_str);
             rule.dst_port = parse_port(dst_port_str);
             rule.protocol = parse_protocol(protocol_str);
-            rule.match_str = parse_match_string(match_str);
+            parse_window(match_str, &rule);
+            rule.match_str = parse_match_string(match_str, &rule.is_regex);
 
             /*
              * We parse each line of the configuration file into a rule
@@ -154,7 +161,15 @@ int main( int argc, char* argv[] ) {
         cout << it->dst_port->lower << ":" <<
                 it->dst_port->upper << "  ";
         cout << it->protocol        << "  ";
-        cout << "\"" << it->match_str << "\"" << endl;
+        if ( it->is_regex ) {
+            cout << "/" << it->match_str << "/";
+        } else {
+            cout << "\"" << it->match_str << "\"";
+        }
+        if ( it->offset )   { cout << " offset " << it->offset; }
+        if ( it->depth )    { cout << " depth " << it->depth; }
+        if ( it->within )   { cout << " within " << it->within; }
+        cout << endl;
     }
 
     return 0;
@@ -389,11 +404,13 @@ char * parse_protocol(char * in_str){
 
 
 /*
- * char * parse_match_string(char * in_str)
+ * char * parse_match_string(char * in_str, int * is_regex)
  * Parse an input char[] into matching string.
  * Input string can include spaces, but shall be enclosed in " ".
+ * A string enclosed in / / instead is a regex (see Regex.h for the syntax),
+ * is_regex is then set to 1.
  */
-char * parse_match_string(char * in_str){
+char * parse_match_string(char * in_str, int * is_regex){
     int  i;
     int  n_st_sp = 0;       /* Number of leading white spaces */
     int  n_ed_sp = 0;       /* Number of trailing white spaces */
@@ -401,6 +418,8 @@ char * parse_match_string(char * in_str){
     int  len = strlen(in_str);
     char * res = (char *) malloc(sizeof(char) * MAX_STRING);
 
+    *is_regex = 0;
+
 
     /*
      * Count the number of leading and trailing white spaces of in_str.
@@ -432,10 +451,13 @@ char * parse_match_string(char * in_str){
     }
 
     /*
-     * Check if the trimmed string is enclosed in quotation marks.
+     * Check if the trimmed string is enclosed in quotation marks (or in
+     * slashes for a regex).
      */
-    else if(in_str[n_st_sp] != '\"' ||
-            in_str[len - n_ed_sp - 1] != '\"'){
+    else if((in_str[n_st_sp] != '\"' ||
+             in_str[len - n_ed_sp - 1] != '\"') &&
+            (in_str[n_st_sp] != '/' ||
+             in_str[len - n_ed_sp - 1] != '/')){
         strcpy(res, "");
     }
 
@@ -449,6 +471,8 @@ char * parse_match_string(char * in_str){
         }
         else{
             strncpy(res, in_str + (n_st_sp+sizeof(char)), n_chars);
+            res[n_chars] = 0;
+            *is_regex = in_str[n_st_sp] == '/';
         }
     }
 
@@ -459,3 +483,65 @@ char * parse_match_string(char * in_str){
 
     return res;
 }
+
+
+
+
+/*
+ * void parse_window(char * in_str, rule_t * rule)
+ * Parse the window of a rule, the "offset N", "depth N" and "within N" pairs
+ * after the matching string, and cut them off in_str (it is then the matching
+ * string alone). A missing or illegal value is 0, i.e. no bound.
+ */
+void parse_window(char * in_str, rule_t * rule){
+    int  i;
+    int  len = strlen(in_str);
+    int  first = -1;        /* Opening quotation mark (or slash) */
+    int  last = -1;         /* Closing one */
+    char * name;
+    char * value;
+
+    rule->offset = 0;
+    rule->depth = 0;
+    rule->within = 0;
+
+    for(i=0 ; i<len ; i++){
+        if(in_str[i] != ' ') { first = i; break; }
+    }
+
+    if(first < 0 || (in_str[first] != '\"' && in_str[first] != '/')) { return; }
+
+    for(i=len-1 ; i>first ; i--){
+        if(in_str[i] == in_str[first]) { last = i; break; }
+    }
+
+    if(last < 0) { return; }
+
+    /*
+     * Each name is followed by its value.
+     */
+    name = strtok(in_str + last + 1, " ");
+    while(name != NULL){
+        value = strtok(NULL, " ");
+        if(value == NULL) { break; }
+
+        char * ptr;
+        long number = strtol(value, &ptr, 10);
+        if(*ptr != 0 || number < 0) { number = 0; }
+
+        if(strcmp(name, "offset") == 0)         { rule->offset = number; }
+        else if(strcmp(name, "depth") == 0)     { rule->depth = number; }
+        else if(strcmp(name, "within") == 0)    { rule->within = number; }
+
+        name = strtok(NULL, " ");
+    }
+
+    in_str[last + 1] = 0;
+
+#ifdef DEBUG
+    cout << "Parsed window: ";
+    cout << rule->offset    << " " <<
+            rule->depth     << " " <<
+            rule->within    << endl;
+#endif
+}
@@ -15,20 +15,33 @@
 #include <time.h>
 #include <cstdio>
 #include <deque>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "SuffixTrie.h"
+#include "RegexMatcher.h"
+#include "TriePublisher.h"
 
 // ---- Macros ----
 #define N_THREADS 5         // Number of string matching threads.
 #define MAX_FIFO_SIZE 1000  // Size of each FIFO queue, in elements.
 #define PKT_INTERVAL 10000  // Simulated packet arrival interval, in useconds.
 #define UPDATE_INTERVAL 1   // Counter update interval, in seconds
-#define RAND_RNG  100
-#define THRESHOLD 90
+#define RAND_RNG  100       // Number of simulated payloads, a packet picks one.
+#define THRESHOLD 90        // Payloads above it carry a match string of the rules.
+#define PAYLOAD_LEN 64      // Length of the random text around it, in bytes.
 #define PRINT_COUNTER 1
+#define N_REPLICAS 0        // Rule matcher replicas, 0 = one per NUMA node.
 
 using namespace std;
 
 // ---- Global vars ----
 bool stop = 0;
+CTriePublisher* publisher = NULL;   // Hands the current rule matcher to the matchers
+vector<string> literals;            // The literal match strings of the rules last loaded
+vector<string> payloads;            // The simulated payloads, a packet is an index in it
 
 // ---- Define argument data structure ----
 typedef struct{
@@ -61,10 +74,15 @@ typedef struct{
 void * count_func(void * fifos);    // Counter thread function
 void * pcapt_func(void * fifos);    // Packet capture thread function
 void * match_func(void * fifo);     // String matching thread function
+void print_replicas();              // Print the memory of every replica
+void make_payloads();               // Simulate the payloads with the rules' literals
+
+CMatcher* load_trie(const char * path, bool image = false);    // Build a matcher from a rules file (or map an image)
 
 // ---- Main course ----
-int main(){
+int main( int argc, char* argv[] ) {
     int         i, res;
+    const char* rules = argc > 1 ? argv[1] : "test_rules.conf";
 
     pthread_t   count_thread;
     pthread_t   pcapt_thread;
@@ -78,6 +96,23 @@ int main(){
 
     srand(time(NULL));
 
+    // ---- Compile the rules into an image and quit, the matchers can then map it ----
+    if ( argc > 2 ) {
+        CMatcher* matcher = load_trie(rules, true);
+        CSuffixTrie* trie = dynamic_cast<CSuffixTrie*>(matcher);
+        res = trie && trie->SaveImage(argv[2]);
+        printf("%s %s.\n", res ? "Compiled the rules into" :
+               trie ? "Could not write" : "Rules with regexes or windows can't be compiled into", argv[2]);
+        delete matcher;
+        return res ? 0 : 1;
+    }
+
+    // ---- Publish the first rule set ----
+    publisher = new CTriePublisher(N_THREADS, N_REPLICAS);
+    publisher->Publish(load_trie(rules));
+    print_replicas();
+    make_payloads();
+
     // ---- Initialize the fifos ----
     for ( i = 0; i < N_THREADS; i++ ) {
         fifos[i].tid = i;
@@ -110,8 +145,16 @@ int main(){
     }
 
     // ---- Press enter to raise the signal of thread termination ----
-    printf("Press ENTER to terminate the threads.\n");
-    getchar();
+    // ---- 'r' + ENTER rebuilds the trie and swaps it in while the matchers run ----
+    printf("Press ENTER to terminate the threads, r + ENTER to reload %s.\n", rules);
+    while ( ( res = getchar() ) == 'r' ) {
+        publisher->Publish(load_trie(rules));
+        publisher->Reclaim();
+        printf("Rules reloaded.\n");
+        print_replicas();
+
+        while ( res != '\n' && res != EOF ) { res = getchar(); }
+    }
     stop = 1;
 
     // ---- Wait for all threads to finish ----
@@ -135,9 +178,176 @@ int main(){
         printf("  detected = %lu\n", match_rets[i]->n_detected);
     }
 
+    delete publisher;
+
     return 0;
 }
 
+/*
+ *  CMatcher* load_trie(const char * path, bool image)
+ *  Build and compile a matcher from the match strings of a rules file,
+ *  or map the image compiled from one. With image the literals always
+ *  go to a trie (only a trie has an image).
+ */
+CMatcher* load_trie(const char * path, bool image){
+    CSuffixTrie* trie = new CSuffixTrie;
+    CMatcher* matcher = trie;
+
+    // A compiled image is mapped as is, no parsing or building
+    if ( trie->LoadImage( path ) ) {
+        return trie;
+    }
+
+    ifstream config_file( path );
+    string line;
+    CSuffixTrie::StringsVector strings;
+    vector<bool> is_regex;
+    vector<CRegexMatcher::RuleWindow> windows;
+    CRegexMatcher::RuleWindow no_window = { 0, 0, 0, 0 };
+    bool plain = true;
+
+    literals.clear();
+
+    // A rule's id is its line (like config_parse_sample.cpp numbers them), the lines
+    // without a match string get an empty one, it uses up its id
+    while ( getline( config_file, line ) ) {
+        int id = strings.size() + 1;
+        strings.push_back( "" );
+        is_regex.push_back( false );
+        windows.push_back( no_window );
+
+        // The match string follows the addresses, ports and protocol
+        stringstream fields( line );
+        string field, match;
+        for ( int i = 0; i < 5; i++ ) { fields >> field; }
+        getline( fields, match );
+
+        // Between quotes it is a literal, between slashes a regex
+        size_t first = match.find_first_not_of(' ');
+        if ( first == string::npos ||
+             ( match[first] != '\"' && match[first] != '/' ) ) {
+            continue;
+        }
+
+        size_t last = match.rfind( match[first] );
+        if ( last <= first + 1 ) {
+            continue;
+        }
+
+        // Then the window: offset, depth and within (after the rule on the line before)
+        CRegexMatcher::RuleWindow window = { 0, 0, 0, 0 };
+        stringstream modifiers( match.substr( last + 1 ) );
+        string name;
+        size_t value;
+
+        while ( modifiers >> name >> value ) {
+            if ( name == "offset" )         { window.iOffset = value; }
+            else if ( name == "depth" )     { window.iDepth = value; }
+            else if ( name == "within" )    { window.iWithin = value; }
+        }
+
+        if ( window.iWithin ) {
+            window.iAnchor = id - 1;
+        }
+
+        strings.back() = match.substr( first + 1, last - first - 1 );
+        is_regex.back() = match[first] == '/';
+        windows.back() = window;
+
+        if ( !is_regex.back() ) {
+            literals.push_back( strings.back() );
+        }
+
+        plain = plain && !is_regex.back() &&
+                !window.iOffset && !window.iDepth && !window.iWithin;
+    }
+
+    if ( plain && image ) {
+        // The build uses every core, the rules are inserted and indexed in parallel
+        trie->SetBuildThreads( 0 );
+        trie->AddStrings( strings );
+        trie->Compile();
+    } else if ( plain ) {
+        // The engine is picked by the shape of the rule set, long literals skip ahead with Wu-Manber
+        delete trie;
+        matcher = CMatcher::Build( strings );
+    } else {
+        // The regexes run where their literals hit, the windows bound how far a payload is searched
+        CRegexMatcher* regex_matcher = new CRegexMatcher;
+        delete trie;
+        matcher = regex_matcher;
+
+        for ( size_t i = 0; i < strings.size(); i++ ) {
+            string error;
+            int id = i + 1;
+
+            if ( strings[i].empty() ) {
+                continue;
+            } else if ( !is_regex[i] ) {
+                regex_matcher->AddString( strings[i], id );
+            } else if ( !regex_matcher->AddRegex( strings[i], id, &error ) ) {
+                printf("Rule %d: bad regex /%s/: %s.\n", id,
+                       strings[i].c_str(), error.c_str());
+            }
+
+            // The anchor of a within is the rule on the line before, it needs a match string
+            bool has_window = windows[i].iOffset || windows[i].iDepth || windows[i].iWithin;
+            if ( windows[i].iWithin && ( !i || strings[i - 1].empty() ) ) {
+                printf("Rule %d: within needs a match string on the line before, its window is ignored.\n", id);
+            } else if ( has_window && !regex_matcher->SetWindow( id, windows[i] ) ) {
+                printf("Rule %d: bad window, it is ignored.\n", id);
+            }
+        }
+
+        // The engine of the literals is picked by the shape of the rule set
+        regex_matcher->Compile();
+    }
+
+    CMatcher::MatcherStats stats = matcher->GetStats();
+    printf("Compiled %lu rules to %s (%lu KB in %.1f ms): %s.\n",
+           (unsigned long) stats.aShape.iRules,
+           CMatcher::GetEngineName(stats.eEngine),
+           (unsigned long) stats.iMemory / 1024,
+           stats.dBuildTime,
+           stats.sReason.c_str());
+
+    return matcher;
+}
+
+
+/*
+ *  void make_payloads()
+ *  Fill the payloads with random text, the ones above THRESHOLD get a literal
+ *  of the rules somewhere in it (an image has none, its packets are random text).
+ */
+void make_payloads() {
+    payloads.resize( RAND_RNG );
+
+    for ( int i = 0; i < RAND_RNG; i++ ) {
+        string& payload = payloads[i];
+        payload.clear();
+
+        for ( int j = 0; j < PAYLOAD_LEN; j++ ) {
+            payload += "abcdefghijklmnopqrstuvwxyz "[rand() % 27];
+        }
+
+        if ( i > THRESHOLD && !literals.empty() ) {
+            payload.insert( rand() % ( PAYLOAD_LEN + 1 ), literals[rand() % literals.size()] );
+        }
+    }
+}
+
+/*
+ *  void print_replicas()
+ *  Print where the replicas of the rule matcher are and how big they are.
+ */
+void print_replicas() {
+    for ( int i = 0; i < publisher->GetReplicas(); i++ ) {
+        printf("Replica #%d (node %d): %lu bytes\n",
+                i, publisher->GetReplicaNode(i),
+                (unsigned long)publisher->GetReplicaMemory(i));
+    }
+}
 
 /*
  *  void * count_func(void * fifos)
@@ -204,9 +414,10 @@ void * pcapt_func(void * fifos){
     while ( !stop ) {
         /*
          *  In the packet capture function, we simulate packet capturing by
-         *  generating random integers and assign them to each string matching
-         *  thread's FIFO in a round-robin manner. It is up to you to integrate
-         *  PCAP interface into this piece of code.
+         *  generating random integers (the index of the packet's payload) and
+         *  assign them to each string matching thread's FIFO in a round-robin
+         *  manner. It is up to you to integrate PCAP interface into this piece
+         *  of code.
          */
         pkt = rand() % RAND_RNG;
         res->n_captured ++;
@@ -242,6 +453,13 @@ void* match_func( void* fifo ) {
     fifo_t* fptr = (fifo_t*)fifo;
 
     while ( !stop ) {
+        /*
+         * The trie we match with (the replica of our NUMA node). It stays
+         * valid until we announce a quiescent state below, so a reload
+         * never stops this thread.
+         */
+        const CMatcher* trie = publisher->Read();
+
         if ( !fptr->queue.empty() ) {
             pkt = fptr->queue.front();
             pthread_mutex_lock( &fptr->lock_queue );
@@ -253,18 +471,24 @@ void* match_func( void* fifo ) {
             pthread_mutex_unlock( &fptr->lock_n_proc );
 
             /*
-             * We simulate pattern detection by checking packets (which are
-             * simulated by integers) against a threshold value. It is up to you
-             * to integrate string matching algorithm into this piece of code.
+             * A packet is detected when the trie finds a rule in its payload
+             * (packets are simulated by integers, the index of their payload).
              */
-            if ( pkt != -1 && pkt > THRESHOLD ) {
+            if ( trie != NULL && pkt != -1 &&
+                 trie->SearchExists( (const unsigned char*)payloads[pkt].data(),
+                                     payloads[pkt].size() ) ) {
                 pthread_mutex_lock( &fptr->lock_n_detd );
                 fptr->n_detd++;
                 pthread_mutex_unlock( &fptr->lock_n_detd );
             }
         }
+
+        // Done with this packet, we hold no trie now.
+        publisher->Quiescent( fptr->tid );
     }
 
+    publisher->Offline( fptr->tid );
+
     res->n_queued = fptr->n_proc;
     res->n_detected = fptr->n_detd;
     
@@ -0,0 +1,118 @@
+/*
+ * trie_codegen.cpp
+ *
+ * Builds the match strings of a rules file (config_parse_sample.cpp format)
+ * into a C++ header, for rule sets that never change at run time. The header
+ * holds the built DFA as constant tables and a search function for them, so
+ * the program has no build to do at startup and the tables are read-only
+ * data shared by every process running it.
+ *
+ * Usage: trie_codegen <rules file> <header> <name> [nocase]
+ *
+ * The header then needs nothing else:
+ *
+ *     #include "rules.h"
+ *     bool report(const rules::Match& m) { ...; return true; }
+ *     rules::Search(data, length, report);
+ */
+
+// ---- Includes ----
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "SuffixTrie.h"
+
+using namespace std;
+
+// ---- Main course ----
+int main( int argc, char* argv[] ) {
+    if ( argc < 4 ) {
+        printf("Usage: %s <rules file> <header> <name> [nocase]\n", argv[0]);
+        return 1;
+    }
+
+    ifstream config_file( argv[1] );
+    if ( !config_file.is_open() ) {
+        printf("Could not open %s.\n", argv[1]);
+        return 1;
+    }
+
+    CSuffixTrie trie;
+    trie.SetNoCase( argc > 4 && strcmp(argv[4], "nocase") == 0 );
+
+    // A rule's id is its line, like config_parse_sample.cpp numbers them. Every line
+    // gets a string, an empty one for the lines without a literal (it uses up its id)
+    string line;
+    CSuffixTrie::StringsVector strings;
+    int literals = 0;
+    int unsupported = 0;
+
+    while ( getline( config_file, line ) ) {
+        int id = strings.size() + 1;
+        strings.push_back( "" );
+
+        // The match string follows the addresses, ports and protocol
+        stringstream fields( line );
+        string field, match;
+        for ( int i = 0; i < 5; i++ ) { fields >> field; }
+        getline( fields, match );
+
+        size_t first = match.find_first_not_of(' ');
+        if ( first == string::npos ||
+             ( match[first] != '\"' && match[first] != '/' ) ) {
+            continue;
+        }
+
+        size_t last = match.rfind( match[first] );
+        if ( last <= first + 1 ) {
+            continue;
+        }
+
+        // The header is a plain DFA, it has no regexes and no windows
+        if ( match[first] == '/' ) {
+            printf("Rule %d: regex rules can't be built into a header.\n", id);
+            unsupported++;
+            continue;
+        }
+
+        if ( match.find_first_not_of(' ', last + 1) != string::npos ) {
+            printf("Rule %d: rules with offset, depth or within can't be built into a header.\n", id);
+            unsupported++;
+            continue;
+        }
+
+        strings.back() = match.substr( first + 1, last - first - 1 );
+        literals++;
+    }
+
+    // The header would match what the rule set doesn't
+    if ( unsupported ) {
+        printf("%d rules can't be built, %s was not written.\n", unsupported, argv[2]);
+        return 1;
+    }
+
+    // Built with every core
+    trie.SetBuildThreads( 0 );
+    trie.AddStrings( strings );
+    trie.BuildTreeIndex();
+
+    // The header is a DFA, a rule set of more states than it can number needs the compact encoding
+    if ( !trie.BuildDFA() ) {
+        printf("The %d literals are too many states for a DFA, %s was not written.\n", literals, argv[2]);
+        return 1;
+    }
+
+    if ( !trie.SaveHeader( argv[2], argv[3] ) ) {
+        printf("Could not write %s.\n", argv[2]);
+        return 1;
+    }
+
+    printf("Built the %d literals of %d rules into %s (%lu bytes of tables).\n",
+           literals, (int) strings.size(), argv[2], (unsigned long) trie.GetDFASize());
+
+    return 0;
+}